@@ -10,6 +10,7 @@ namespace AskCropFormatLayer
 {
 	int width, height;
 	Rectangle plus_x, plus_y, minus_x, minus_y;
+	Rectangle skip_uniform;
 
 	static void Load()
 	{
@@ -34,6 +35,8 @@ namespace AskCropFormatLayer
 				Variables::ask_crop_dialog_result.y += 1;
 			else if (CheckCollisionPointRec(mouse_pos, minus_y) && Variables::ask_crop_dialog_result.y != 0)
 				Variables::ask_crop_dialog_result.y -= 1;
+			else if (CheckCollisionPointRec(mouse_pos, skip_uniform))
+				Variables::crop_skip_uniform_cells = !Variables::crop_skip_uniform_cells;
 		}
 
 		return false;
@@ -80,6 +83,11 @@ namespace AskCropFormatLayer
 		Vector2 y_text_size = MeasureTextEx(GetFontDefault(), y_text.c_str(), 30, 3.0f);
 		DrawText(y_text.c_str(), width / 2 - (int)y_text_size.x / 2, (int)plus_y.y + (int)plus_y.height / 2 - (int)y_text_size.y / 2, 30, Colors::DIALOG_TEXT);
 
+		DrawRectangleLinesEx(skip_uniform, 2.0f, CheckCollisionPointRec(mouse_pos, skip_uniform) ? Colors::BUTTON_HOVER : Colors::BUTTON_NORMAL);
+		if (Variables::crop_skip_uniform_cells)
+			DrawRectangle((int)skip_uniform.x + 4, (int)skip_uniform.y + 4, (int)skip_uniform.width - 8, (int)skip_uniform.height - 8, Colors::BUTTON_NORMAL);
+		DrawText("Skip single-colour cells", (int)(skip_uniform.x + skip_uniform.width) + 8, (int)skip_uniform.y + 1, 15, Colors::DIALOG_TEXT);
+
 		std::string title_text = "Crop";
 		Vector2 title_text_size = MeasureTextEx(GetFontDefault(), title_text.c_str(), 30, 3.0f);
 		DrawText(title_text.c_str(), width / 2 - (int)title_text_size.x / 2, height / 10 - (int)title_text_size.y / 2, 30, Colors::DIALOG_TEXT);
@@ -109,6 +117,11 @@ namespace AskCropFormatLayer
 		minus_y.width = width / 5.0f;
 		minus_y.x = width / 5.0f; 
 		minus_y.y = (height / 5.0f) * 3.5f - 15.0f;
+
+		skip_uniform.height = 16;
+		skip_uniform.width = 16;
+		skip_uniform.x = width / 5.0f;
+		skip_uniform.y = (height / 5.0f) * 4.5f - 8.0f;
 	}
 
 	Layer GetLayer()
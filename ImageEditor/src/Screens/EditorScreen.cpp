@@ -8,7 +8,10 @@
 
 #include <cstdint>
 #include <limits>
+#include <memory>
 #include <vector>
+#include <deque>
+#include <chrono>
 #include <map>
 #include <algorithm>
 #include <cmath>
@@ -21,62 +24,147 @@
 #include "Globals.hpp"
 #include "Variables.h"
 #include "Utils/ConsoleLog.h"
+#include "Utils/AsyncImageLoader.h"
+#include "Utils/ImagePiece.h"
+#include "Utils/PieceEntity.h"
+#include "Utils/EditHistory.h"
+#include "Utils/PieceIndex.h"
+#include "Utils/PieceRenderer.h"
+#include "Utils/TiledTexture.h"
+#include "Utils/PieceExporter.h"
+#include "Utils/AtlasPacker.h"
+#include "Utils/ProjectFile.h"
+#include "Utils/AutoSlicer.h"
+#include "Utils/SimilarPieceFinder.h"
+#include "Utils/MappedImage.h"
 
 #include "Layers/AskConfirmLayer.h"
 #include "Layers/AskCropFormatLayer.h"
 
 #define CAMERA_SPEED 300
+// Keeps the frame time low while a new image is sent to the GPU
+#define UPLOAD_BYTES_PER_FRAME (16 * 1024 * 1024)
+#define PROJECT_EXTENSION ".ieproj"
 
 enum SubMenuType
 {
 	MENU_SAVE,
+	MENU_EXPORT_ALL,
+	MENU_EXPORT_TRIMMED,
+	MENU_EXPORT_ATLAS,
+	MENU_EXPORT_DEDUPLICATE,
+	MENU_EXPORT_ENCODER,
 	MENU_OPEN,
+	MENU_SAVE_PROJECT,
+	MENU_OPEN_PROJECT,
 	MENU_QUIT,
+	MENU_UNDO,
+	MENU_REDO,
 	MENU_CROP,
+	MENU_COALESCE,
+	MENU_AUTO_SLICE,
+	MENU_FIND_SIMILAR,
+	MENU_COLLAPSE_SIMILAR,
 	MENU_BASE_BAR,
 	MENU_NONE
 };
 
-struct SourceDestinationPair
+struct MenuItem
 {
-	Rectangle source;
-	Rectangle destination;
+	bool is_open = false;
+	std::string name;
+	std::map<SubMenuType, std::string> items;
 };
 
-struct ImagePiece
+struct EncoderPreset
 {
-	std::vector<SourceDestinationPair> sources_dests;
-	Vector2 first_piece_pos;
+	const char* name;
+	ExportFormat format;
+	int png_compression_level;
+	int png_filter;
 };
 
+// Cycled by the File menu, Save and Export all use the selected one
+static const EncoderPreset ENCODER_PRESETS[] =
+{
+	{"PNG", ExportFormat::PNG, 6, -1},
+	{"PNG fast", ExportFormat::PNG, 1, 2}, // The up filter alone with the shortest match search
+	{"PNG small", ExportFormat::PNG, 9, -1},
+	{"QOI", ExportFormat::QOI, 6, -1},
+};
 
-struct MenuItem
+struct SourceImage
 {
-	bool is_open = false;
-	std::string name;
-	std::map<SubMenuType, std::string> items;
+	std::string filepath;
+	Image pixels = {}; // CPU copy in R8G8B8A8 with its mipmaps, level 0 is used to export pieces
+	Texture2D texture = {};
+	TiledTexture tiled; // Used instead of texture when the image does not fit in a single texture
+};
+
+struct PendingLoad
+{
+	std::unique_ptr<AsyncImageLoader> loader;
+	bool new_document; // Replaces the document instead of being added to it
+	int32_t project_image = -1; // Index in the project being opened, its pieces come from the project file
 };
 
 namespace EditorScreen
 {
-	static Texture2D image;
+	static std::deque<SourceImage> images; // Indexed by SourceDestinationPair::image, a deque so the tiles keep pointing to valid pixels
+	static std::vector<Texture2D> image_textures; // Same order as images
+	static std::vector<PendingLoad> pending_loads; // In the order the files were opened or dropped
+	static ProjectFile opened_project; // Stays mapped until the images it refers to are loaded
+	static std::string opened_project_path;
+	static std::vector<uint32_t> project_image_ids; // Document image of every image of the opened project, UINT32_MAX until loaded
 	static ECS::Entity camera;
 
-	static std::vector<ImagePiece> pieces;
+	static entt::registry pieces;
+	static PieceIndex pieces_index;
+	static PieceRenderer pieces_renderer;
 	static Vector2 previous_mouse_pos = {0.0f, 0.0f};
-	static int selected_piece = -1;
+	static PieceHandle selected_piece = entt::null;
+	static EditHistory history;
+	static PieceHandle dragged_piece = entt::null;
+	static Vector2 drag_start_position = {0.0f, 0.0f};
 
-	static std::pair<int, int> combine_pieces = {-1, -1};
+	static std::pair<PieceHandle, PieceHandle> combine_pieces = {entt::null, entt::null};
+	static Vector2 combine_start_position = {0.0f, 0.0f}; // Of the second piece, before it was bound to the first
 	static bool ask_combine = false;
 	
-	static int crop_piece = -1;
+	static PieceHandle crop_piece = entt::null;
 	static bool ask_crop = false;
 
+	static SimilarPieceFinder similar_finder;
+	static std::vector<std::vector<PieceHandle>> similar_groups; // First piece of a group is the one kept when collapsing it
+	static int similar_group_index = -1; // Selected group, tab selects the next one
+
 	static Layer ask_confirm_layer;
 	static Layer ask_crop_format_layer;
 
 	static std::vector<MenuItem> menu;
 
+	// The item shows whether the next exports skip duplicates
+	static std::string GetDeduplicateItemText()
+	{
+		return Variables::export_deduplicate ? "[x] Skip duplicates" : "[ ] Skip duplicates";
+	}
+
+	// The item shows the encoder of the next saves and exports
+	static std::string GetEncoderItemText()
+	{
+		return fmt::format("Format: {}", ENCODER_PRESETS[Variables::export_encoder].name);
+	}
+
+	static ExportOptions GetEncoderOptions()
+	{
+		const EncoderPreset& preset = ENCODER_PRESETS[Variables::export_encoder];
+		ExportOptions options;
+		options.format = preset.format;
+		options.png_compression_level = preset.png_compression_level;
+		options.png_filter = preset.png_filter;
+		return options;
+	}
+
 	static ConsoleLog console_log;
 	static void Log(Logger::LogLevel level, std::string message)
 	{
@@ -123,12 +211,25 @@ namespace EditorScreen
 		MenuItem file_menu;
 		file_menu.name = "File";
 		file_menu.items[SubMenuType::MENU_SAVE] = "Save";
+		file_menu.items[SubMenuType::MENU_EXPORT_ALL] = "Export all";
+		file_menu.items[SubMenuType::MENU_EXPORT_TRIMMED] = "Export all trimmed";
+		file_menu.items[SubMenuType::MENU_EXPORT_ATLAS] = "Export atlas";
+		file_menu.items[SubMenuType::MENU_EXPORT_DEDUPLICATE] = GetDeduplicateItemText();
+		file_menu.items[SubMenuType::MENU_EXPORT_ENCODER] = GetEncoderItemText();
 		file_menu.items[SubMenuType::MENU_OPEN] = "Open";
+		file_menu.items[SubMenuType::MENU_SAVE_PROJECT] = "Save project";
+		file_menu.items[SubMenuType::MENU_OPEN_PROJECT] = "Open project";
 		file_menu.items[SubMenuType::MENU_QUIT] = "Quit";
 
 		MenuItem edit_menu;
 		edit_menu.name = "Edit";
+		edit_menu.items[SubMenuType::MENU_UNDO] = "Undo";
+		edit_menu.items[SubMenuType::MENU_REDO] = "Redo";
 		edit_menu.items[SubMenuType::MENU_CROP] = "Crop";
+		edit_menu.items[SubMenuType::MENU_COALESCE] = "Coalesce";
+		edit_menu.items[SubMenuType::MENU_AUTO_SLICE] = "Auto slice";
+		edit_menu.items[SubMenuType::MENU_FIND_SIMILAR] = "Find similar pieces";
+		edit_menu.items[SubMenuType::MENU_COLLAPSE_SIMILAR] = "Collapse similar group";
 
 		menu.emplace_back(file_menu);
 		menu.emplace_back(edit_menu);
@@ -139,45 +240,297 @@ namespace EditorScreen
 		ask_crop_format_layer = AskCropFormatLayer::GetLayer();
 		ask_crop_format_layer.Load();
 
+		pieces_renderer.Load();
+
 		console_log.Load({0.0f, 0.0f, 1.0f, 1.0f}, 5.0f);
 		Logger::Bind(&Log);
 
 		NFD::Init();
 	}
 
+	static void UnloadImages()
+	{
+		for (SourceImage& source_image : images)
+		{
+			source_image.tiled.Unload();
+			UnloadTexture(source_image.texture);
+			MappedImage::Unload(source_image.pixels);
+		}
+		images.clear();
+		image_textures.clear();
+	}
+
+	static void CancelLoads()
+	{
+		for (PendingLoad& load : pending_loads)
+		{
+			Logger::Warn("Loading cancelled: {}", load.loader->GetFilepath());
+			load.loader->Cancel();
+		}
+		pending_loads.clear();
+		console_log.ClearStatus();
+
+		if (opened_project.IsOpen())
+		{
+			Logger::Warn("Opening cancelled: {}", opened_project_path);
+			opened_project.Close();
+			project_image_ids.clear();
+		}
+	}
+
+	static std::vector<Image> GetImagePixels()
+	{
+		std::vector<Image> result;
+		for (const SourceImage& source_image : images)
+			result.push_back(source_image.pixels);
+
+		return result;
+	}
+
+	static bool HasTiledImages()
+	{
+		return std::any_of(images.begin(), images.end(), [](const SourceImage& source_image) { return source_image.tiled.IsLoaded(); });
+	}
+
 	void Unload()
 	{
-		UnloadTexture(image);
+		for (PendingLoad& load : pending_loads)
+			load.loader->Unload();
+		pending_loads.clear();
+		similar_finder.Cancel();
+		UnloadImages();
 		ask_confirm_layer.Unload();
 		ask_crop_format_layer.Unload();
+		pieces_renderer.Unload();
 		console_log.Unload();
 		NFD::Quit();
 	}
 
+	static void StartLoad(const std::string& filepath, bool new_document, int32_t project_image = -1)
+	{
+		PendingLoad load;
+		load.loader = std::make_unique<AsyncImageLoader>();
+		load.loader->Start(filepath);
+		load.new_document = new_document;
+		load.project_image = project_image;
+		pending_loads.emplace_back(std::move(load));
+		Logger::Info("Loading file: {}", filepath);
+	}
+
+	// The current document stays usable until the new one is ready in OnFileLoaded
 	void LoadFile(const std::string& filepath)
 	{
-		UnloadTexture(image);
+		CancelLoads();
+		StartLoad(filepath, true);
+	}
+
+	// The image is added to the current document as a new piece
+	void AddFile(const std::string& filepath)
+	{
+		StartLoad(filepath, false);
+	}
+
+	static void ClearDocument()
+	{
+		similar_finder.Cancel();
+		similar_groups.clear();
+		similar_group_index = -1;
+		UnloadImages();
 		pieces.clear();
-		image = LoadTexture(filepath.c_str());
-		SetTextureFilter(image, TEXTURE_FILTER_BILINEAR);
-		SetTextureFilter(image, TEXTURE_FILTER_TRILINEAR);
+		history.Clear();
 
-		Vector2 window_size = WindowManager::GetWindowSize();
-		Rectangle image_source = {0.0f, 0.0f, (float)image.width, (float)image.height};
-		Rectangle image_dest = {0.0f, 0.0f, (float)image.width, (float)image.height};
-		Vector2 image_pos = {window_size.x / 2.0f - image.width / 2.0f, window_size.y / 2.0f - image.height / 2.0f};
-		ImagePiece image_piece;
-		image_piece.sources_dests.push_back({image_source, image_dest});
-		image_piece.first_piece_pos = image_pos;
-		pieces.emplace_back(image_piece);
+		selected_piece = entt::null;
+		combine_pieces = {entt::null, entt::null};
+		crop_piece = entt::null;
+		ask_combine = false;
+		ask_crop = false;
+	}
+
+	static bool IsAnyProjectImageLoaded()
+	{
+		return std::any_of(project_image_ids.begin(), project_image_ids.end(), [](uint32_t image_id) { return image_id != std::numeric_limits<uint32_t>::max(); });
+	}
+
+	// Called once every image of the opened project was loaded or failed to
+	static void RestoreProject()
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		// The document is replaced by the first project image that loads, unless none could
+		if (!IsAnyProjectImageLoaded())
+			ClearDocument();
+
+		opened_project.CreatePieces(pieces, project_image_ids);
+		pieces_index.Rebuild(pieces);
+		pieces_renderer.Invalidate();
+
+		size_t missing_images = std::count(project_image_ids.begin(), project_image_ids.end(), std::numeric_limits<uint32_t>::max());
+		if (missing_images > 0)
+			Logger::Warn("{} image(s) of the project could not be loaded, their rectangles are left empty", missing_images);
+
+		float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		Logger::Info("Opened project '{}': {} pieces, {} rectangles in {:.1f} ms", opened_project_path, opened_project.GetPieceCount(), opened_project.GetRectangleCount(), milliseconds);
+
+		opened_project.Close();
+		project_image_ids.clear();
+	}
+
+	// The images are loaded like opened files, the pieces are created once they are all there
+	static void OpenProject(const std::string& filepath)
+	{
+		CancelLoads();
+		if (!opened_project.Open(filepath))
+			return;
+
+		opened_project_path = filepath;
+		const std::vector<ProjectImage>& project_images = opened_project.GetImages();
+		project_image_ids.assign(project_images.size(), std::numeric_limits<uint32_t>::max());
+		if (project_images.empty())
+		{
+			RestoreProject();
+			return;
+		}
+
+		// Images that were moved along with the project are looked for next to it
+		std::string project_directory = GetDirectoryPath(filepath.c_str());
+		for (size_t i = 0; i < project_images.size(); i++)
+		{
+			std::string image_path = project_images[i].filepath;
+			if (!FileExists(image_path.c_str()))
+			{
+				std::string moved_path = project_directory + "/" + GetFileName(image_path.c_str());
+				if (FileExists(moved_path.c_str()))
+					image_path = moved_path;
+			}
+			StartLoad(image_path, false, i);
+		}
+	}
+
+	static void SaveProject(const std::string& filepath)
+	{
+		if (!pending_loads.empty())
+			Logger::Warn("Images still loading are not part of the saved project");
+
+		auto start = std::chrono::steady_clock::now();
+
+		std::vector<ProjectImage> project_images;
+		for (const SourceImage& source_image : images)
+			project_images.push_back({source_image.filepath, source_image.pixels.width, source_image.pixels.height, ProjectFile::HashImage(source_image.pixels)});
+
+		if (ProjectFile::Save(filepath, pieces, project_images))
+		{
+			float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			Logger::Info("Project saved as '{}' in {:.1f} ms", filepath, milliseconds);
+		}
+	}
+
+	static void OnFileLoaded(PendingLoad& load)
+	{
+		std::string filepath = load.loader->GetFilepath();
+		bool is_project_image = load.project_image >= 0 && (size_t)load.project_image < project_image_ids.size();
+
+		// The first image of a project that loads replaces the document
+		if (load.new_document || (is_project_image && !IsAnyProjectImageLoaded()))
+			ClearDocument();
+
+		uint32_t image_id = images.size();
+		SourceImage& source_image = images.emplace_back();
+		source_image.filepath = filepath;
+		load.loader->Take(source_image.pixels, source_image.texture);
+		if (!IsTextureReady(source_image.texture))
+		{
+			source_image.tiled.Load(&source_image.pixels);
+			Logger::Info("'{}' is too big for a single texture, drawing it from tiles", filepath);
+			if (MappedImage::IsMapped(source_image.pixels))
+				Logger::Info("'{}' was decoded into a cache file to keep it out of memory", filepath);
+		}
+		image_textures.push_back(source_image.texture);
+
+		if (is_project_image)
+		{
+			const ProjectImage& project_image = opened_project.GetImages()[load.project_image];
+			if (project_image.hash != ProjectFile::HashImage(source_image.pixels))
+				Logger::Warn("'{}' changed since the project was saved, its pieces may not match", filepath);
+
+			project_image_ids[load.project_image] = image_id;
+			Logger::Info("Loaded file: {}", filepath);
+			return;
+		}
+
+		// A new document is centered in the window, added images in the view
+		Vector2 center = WindowManager::GetWindowSize();
+		center = {center.x / 2.0f, center.y / 2.0f};
+		if (!load.new_document)
+			center = camera.GetComponent<Camera2DComponent>().camera.target;
 
-		selected_piece = -1;
-		combine_pieces = {-1, -1};
-		crop_piece = -1;
+		float width = (float)source_image.pixels.width;
+		float height = (float)source_image.pixels.height;
+		ImagePiece image_piece;
+		Piece::AddRectangle(image_piece, {{0.0f, 0.0f, width, height}, {0.0f, 0.0f, width, height}, image_id});
+		image_piece.first_piece_pos = {center.x - width / 2.0f, center.y - height / 2.0f};
+		PieceHandle piece = PieceEntity::Create(pieces, image_piece);
+		if (load.new_document)
+			pieces_index.Rebuild(pieces);
+		else
+			pieces_index.Insert(pieces, piece);
+		pieces_renderer.Invalidate();
 
 		Logger::Info("Loaded file: {}", filepath);
 	}
 
+	static void UpdateFileLoading()
+	{
+		if (pending_loads.empty())
+			return;
+
+		if (IsKeyPressed(KEY_BACKSPACE))
+		{
+			CancelLoads();
+			return;
+		}
+
+		// Files are decoded in parallel, but uploaded and added to the document in the order they came in
+		size_t upload_budget = UPLOAD_BYTES_PER_FRAME;
+		for (size_t i = 0; i < pending_loads.size();)
+		{
+			PendingLoad& load = pending_loads[i];
+			AsyncLoadState state = load.loader->Update(upload_budget);
+			if (state == AsyncLoadState::FAILED)
+			{
+				Logger::Error("Could not load file: {}", load.loader->GetFilepath());
+				load.loader->Cancel();
+				pending_loads.erase(pending_loads.begin() + i);
+				continue;
+			}
+
+			if (state == AsyncLoadState::READY && i == 0)
+			{
+				OnFileLoaded(load);
+				pending_loads.erase(pending_loads.begin());
+				continue;
+			}
+
+			i++;
+		}
+
+		bool is_project_loading = std::any_of(pending_loads.begin(), pending_loads.end(), [](const PendingLoad& load) { return load.project_image >= 0; });
+		if (opened_project.IsOpen() && !is_project_loading)
+			RestoreProject();
+
+		if (pending_loads.empty())
+		{
+			console_log.ClearStatus();
+			return;
+		}
+
+		const AsyncImageLoader& loader = *pending_loads.front().loader;
+		std::string others = pending_loads.size() > 1 ? fmt::format(" (+{} more)", pending_loads.size() - 1) : "";
+		if (loader.GetState() == AsyncLoadState::UPLOADING)
+			console_log.SetStatus(fmt::format("Uploading {}: {}%{} (backspace to cancel)", loader.GetFilepath(), (int)(loader.GetUploadProgress() * 100), others), Colors::MENU_TEXT_HOVER);
+		else
+			console_log.SetStatus(fmt::format("Decoding {}...{} (backspace to cancel)", loader.GetFilepath(), others), Colors::MENU_TEXT_HOVER);
+	}
+
 	static SubMenuType GetPressedMenuItem()
 	{
 		Vector2 mouse_pos = GetMousePosition();
@@ -232,95 +585,141 @@ namespace EditorScreen
 		return SubMenuType::MENU_NONE;
 	}
 
-	static int GetCollidingPieceIndex(Vector2 pos)
+	static PieceHandle GetCollidingPiece(Vector2 pos)
 	{
 		if (ask_combine)
 		{
-			for (auto& [source, dest] : pieces[combine_pieces.first].sources_dests)
-			{
-				Rectangle temp_dest = dest;
-				temp_dest.x += pieces[combine_pieces.first].first_piece_pos.x;
-				temp_dest.y += pieces[combine_pieces.first].first_piece_pos.y;
-				if (CheckCollisionPointRec(pos, temp_dest))
-					return combine_pieces.first;
-			}
+			if (pieces_index.HitsPiece(pieces, combine_pieces.first, pos))
+				return combine_pieces.first;
 
-			for (auto& [source, dest] : pieces[combine_pieces.second].sources_dests)
-			{
-				Rectangle temp_dest = dest;
-				temp_dest.x += pieces[combine_pieces.second].first_piece_pos.x;
-				temp_dest.y += pieces[combine_pieces.second].first_piece_pos.y;
-				if (CheckCollisionPointRec(pos, temp_dest))
-					return combine_pieces.second;
-			}
+			if (pieces_index.HitsPiece(pieces, combine_pieces.second, pos))
+				return combine_pieces.second;
+
+			return entt::null;
+		}
 
-			return -1;
+		return pieces_index.Pick(pieces, pos);
+	}
+
+	// World space area seen by the camera
+	static Rectangle GetVisibleArea(const Camera2D& camera)
+	{
+		Vector2 top_left = GetScreenToWorld2D({0.0f, 0.0f}, camera);
+		Vector2 bottom_right = GetScreenToWorld2D({(float)GetScreenWidth(), (float)GetScreenHeight()}, camera);
+		return {top_left.x, top_left.y, bottom_right.x - top_left.x, bottom_right.y - top_left.y};
+	}
+
+	void DrawPiece(PieceHandle piece, bool selected)
+	{
+		auto [position, rectangles] = pieces.get<PiecePosition, PieceRectangles>(piece);
+		Camera2D ecs_camera = ECS::GetPrimaryCamera();
+		Rectangle visible_area = GetVisibleArea(ecs_camera);
+
+		for (auto [source, dest, image]: rectangles.sources_dests)
+		{
+			dest.x += position.value.x;
+			dest.y += position.value.y;
+			if (image >= images.size() || !CheckCollisionRecs(dest, visible_area))
+				continue;
+			
+			Rectangle outline = dest;
+			float offset = 1.0f / ecs_camera.zoom;
+			outline.x -= offset;
+			outline.y -= offset;
+			outline.width += 2.0f * offset;
+			outline.height += 2.0f * offset;
+			DrawRectangleRec(outline, selected ? Colors::SELECTED_PIECE_OUTLINE : Colors::PIECE_OUTLINE);
+			SourceImage& source_image = images[image];
+			if (source_image.tiled.IsLoaded())
+				source_image.tiled.Draw(source, dest, ecs_camera.zoom, WHITE);
+			else
+				DrawTexturePro(source_image.texture, source, dest, {0.0f, 0.0f}, 0.0f, WHITE);
 		}
+	}
 
-		for (int i = (int)pieces.size() - 1; i >= 0; i--)
+	// Pieces of the selected similar group that still exist, empty when there are less than two
+	static std::vector<PieceHandle> GetSimilarGroup()
+	{
+		std::vector<PieceHandle> result;
+		if (similar_group_index < 0 || similar_group_index >= (int)similar_groups.size())
+			return result;
+
+		for (PieceHandle piece : similar_groups[similar_group_index])
 		{
-			for (auto& [source, dest]: pieces[i].sources_dests)
-			{
-				Rectangle temp_dest = dest;
-				temp_dest.x += pieces[i].first_piece_pos.x;
-				temp_dest.y += pieces[i].first_piece_pos.y;
-				if (CheckCollisionPointRec(pos, temp_dest))
-					return i;
-			}
+			if (PieceEntity::Exists(pieces, piece))
+				result.push_back(piece);
 		}
 
-		return -1;
+		if (result.size() < 2)
+			result.clear();
+		return result;
 	}
 
-	// Relative to first_piece_pos
-	Rectangle GetBounds(const ImagePiece& piece)
+	static void SelectNextSimilarGroup()
 	{
-		float top = MAXFLOAT;
-		float bottom = -MAXFLOAT;
-		float left = MAXFLOAT;
-		float right = -MAXFLOAT;
-		for (auto& [source, dest]: piece.sources_dests)
+		for (size_t i = 0; i < similar_groups.size(); i++)
 		{
-			if (dest.x < left)
-				left = dest.x;
-			if (dest.y < top)
-				top = dest.y;
-			if (dest.x + dest.width > right)
-				right = dest.x + dest.width;
-			if (dest.y + dest.height > bottom)
-				bottom = dest.y + dest.height;
+			similar_group_index = (similar_group_index + 1) % similar_groups.size();
+			std::vector<PieceHandle> group = GetSimilarGroup();
+			if (group.empty())
+				continue;
+
+			selected_piece = group[0];
+			Rectangle bounds = PieceEntity::GetWorldBounds(pieces, selected_piece);
+			camera.GetComponent<Camera2DComponent>().camera.target = {bounds.x + bounds.width / 2.0f, bounds.y + bounds.height / 2.0f};
+			Logger::Info("Similar group {}/{}: {} pieces", similar_group_index + 1, similar_groups.size(), group.size());
+			return;
 		}
 
-		return {left, top, right - left, bottom - top};
+		similar_group_index = -1;
+		Logger::Warn("No group of similar pieces left");
 	}
 
-	void DrawPiece(const ImagePiece& piece, bool selected, bool serialize = false)
+	static void UpdateSimilarFinder()
 	{
-		Camera2D ecs_camera = ECS::GetPrimaryCamera();
-		Rectangle bounds = GetBounds(piece);
-
-		for (auto [source, dest]: piece.sources_dests)
+		if (similar_finder.IsBusy())
 		{
-			if (serialize)
-			{
-				dest.x -= bounds.x;
-				dest.y -= bounds.y;
-			}
-			else
-			{
-				dest.x += piece.first_piece_pos.x;
-				dest.y += piece.first_piece_pos.y;
-				
-				Rectangle outline = dest;
-				float offset = 1.0f / ecs_camera.zoom;
-				outline.x -= offset;
-				outline.y -= offset;
-				outline.width += 2.0f * offset;
-				outline.height += 2.0f * offset;
-				DrawRectangleRec(outline, selected ? Colors::SELECTED_PIECE_OUTLINE : Colors::PIECE_OUTLINE);
-			}
-			DrawTexturePro(image, source, dest, {0.0f, 0.0f}, 0.0f, WHITE);
+			if (pending_loads.empty())
+				console_log.SetStatus(fmt::format("Finding similar pieces: {}/{}", similar_finder.GetHashedCount(), similar_finder.GetPieceCount()), Colors::MENU_TEXT_HOVER);
+			return;
 		}
+
+		if (!similar_finder.TakeGroups(similar_groups))
+			return;
+
+		if (pending_loads.empty())
+			console_log.ClearStatus();
+
+		similar_group_index = -1;
+		size_t grouped = 0;
+		for (const std::vector<PieceHandle>& group : similar_groups)
+			grouped += group.size();
+		if (similar_groups.empty())
+			Logger::Info("No similar pieces found");
+		else
+			Logger::Info("Found {} groups of similar pieces ({} pieces), press tab to select them", similar_groups.size(), grouped);
+	}
+
+	static void Undo()
+	{
+		if (ask_combine || ask_crop || dragged_piece != entt::null)
+			return;
+
+		if (history.Undo(pieces, pieces_index))
+			pieces_renderer.Invalidate();
+		else
+			Logger::Warn("Nothing to undo");
+	}
+
+	static void Redo()
+	{
+		if (ask_combine || ask_crop || dragged_piece != entt::null)
+			return;
+
+		if (history.Redo(pieces, pieces_index))
+			pieces_renderer.Invalidate();
+		else
+			Logger::Warn("Nothing to redo");
 	}
 
 	bool HandleMenu()
@@ -330,40 +729,77 @@ namespace EditorScreen
 		{
 			case SubMenuType::MENU_SAVE:
 				{
-					if (selected_piece < 0)
+					if (selected_piece == entt::null)
 					{
 						Logger::Warn("No piece selected");
 						break;
 					}
 
-					if (!IsTextureReady(image))
+					if (images.empty())
 					{
 						Logger::Warn("No image loaded");
 						break;
 					}
 
+					ExportOptions options = GetEncoderOptions();
 					NFD::UniquePath out_path;
-					nfdfilteritem_t filter_item[1] = {{"Image File", "png"}};
-					std::string path = "image.png";
-					nfdresult_t result = NFD::SaveDialog(out_path, filter_item, 1, nullptr, path.c_str());
+					nfdfilteritem_t filter_item[2] = {{"PNG Image", "png"}, {"QOI Image", "qoi"}};
+					std::string path = fmt::format("image.{}", PieceExporter::GetExtension(options.format));
+					nfdresult_t result = NFD::SaveDialog(out_path, filter_item, 2, nullptr, path.c_str());
 
 					if (result == NFD_OKAY)
 					{
-						Rectangle piece_bounds = GetBounds(pieces[selected_piece]);
-						RenderTexture out_texture = LoadRenderTexture((int)piece_bounds.width, (int)piece_bounds.height);
-
-						BeginTextureMode(out_texture);
-						DrawPiece(pieces[selected_piece], false, true);
-						EndTextureMode();
-
 						path = out_path.get();
-						Image out_image = LoadImageFromTexture(out_texture.texture);
-						ImageFlipVertical(&out_image);
-						ExportImage(out_image, path.c_str());
+						// The extension picked in the dialog wins over the selected format, a PNG then keeps the default settings when QOI was selected
+						ExportFormat format = IsFileExtension(path.c_str(), ".qoi") ? ExportFormat::QOI : ExportFormat::PNG;
+						if (format != options.format)
+							options = ExportOptions();
+						options.format = format;
+
+						Image out_image = Piece::Compose(GetImagePixels(), PieceEntity::ToImagePiece(pieces, selected_piece));
+						auto start = std::chrono::steady_clock::now();
+						bool is_saved = PieceExporter::SaveImage(out_image, path, options);
+						float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 						UnloadImage(out_image);
-						UnloadRenderTexture(out_texture);
 
-						Logger::Info("Piece saved successfully as '{}'", path);
+						if (is_saved)
+							Logger::Info("Piece saved successfully as '{}' in {:.1f}ms", path, milliseconds);
+						else
+							Logger::Error("Failed to write '{}'", path);
+					}
+					else if (result != NFD_CANCEL)
+					{
+        				LOG_ERROR(NFD::GetError());
+					}
+				}
+				break;
+
+			case SubMenuType::MENU_EXPORT_ALL:
+			case SubMenuType::MENU_EXPORT_TRIMMED:
+				{
+					if (pieces.view<PieceRectangles>().empty() || images.empty())
+					{
+						Logger::Warn("No image loaded");
+						break;
+					}
+
+					NFD::UniquePath out_path;
+					nfdresult_t result = NFD::PickFolder(out_path);
+
+					if (result == NFD_OKAY)
+					{
+						std::vector<ImagePiece> export_pieces = PieceEntity::ToImagePieces(pieces);
+						ExportOptions options = GetEncoderOptions();
+						options.trim_transparent = clicked_item == SubMenuType::MENU_EXPORT_TRIMMED;
+						options.deduplicate = Variables::export_deduplicate;
+						ExportStats stats = PieceExporter::ExportAll(GetImagePixels(), export_pieces, out_path.get(), "piece", options);
+						float seconds = std::max(stats.seconds, 0.001f);
+						size_t exported = stats.pieces_written + stats.duplicates_skipped;
+						Logger::Info("Exported {}/{} pieces as {} to '{}' in {:.2f}s ({:.1f} pieces/s, {:.1f} MB/s)", exported, export_pieces.size(), ENCODER_PRESETS[Variables::export_encoder].name, out_path.get(), stats.seconds, exported / seconds, stats.bytes_written / (1024.0f * 1024.0f) / seconds);
+						if (options.trim_transparent)
+							Logger::Info("Trimmed {} transparent pixels, offsets written to 'piece_trim.json'", stats.pixels_trimmed);
+						if (options.deduplicate)
+							Logger::Info("{} duplicates share the image of another piece, saving {:.1f} KB, see 'piece_manifest.json'", stats.duplicates_skipped, stats.bytes_saved / 1024.0f);
 					}
 					else if (result != NFD_CANCEL)
 					{
@@ -372,6 +808,42 @@ namespace EditorScreen
 				}
 				break;
 
+			case SubMenuType::MENU_EXPORT_ATLAS:
+				{
+					if (pieces.view<PieceRectangles>().empty() || images.empty())
+					{
+						Logger::Warn("No image loaded");
+						break;
+					}
+
+					NFD::UniquePath out_path;
+					nfdresult_t result = NFD::PickFolder(out_path);
+
+					if (result == NFD_OKAY)
+					{
+						std::vector<ImagePiece> export_pieces = PieceEntity::ToImagePieces(pieces);
+						AtlasOptions options;
+						options.encoding = GetEncoderOptions();
+						AtlasStats stats = AtlasPacker::ExportAtlas(GetImagePixels(), export_pieces, out_path.get(), "atlas", options);
+						Logger::Info("Packed {}/{} pieces in {} sheets ({:.0f}% filled) to '{}' in {:.2f}s", stats.pieces_packed, export_pieces.size(), stats.sheets_written, stats.fill_ratio * 100.0f, out_path.get(), stats.seconds);
+					}
+					else if (result != NFD_CANCEL)
+					{
+        				LOG_ERROR(NFD::GetError());
+					}
+				}
+				break;
+
+			case SubMenuType::MENU_EXPORT_DEDUPLICATE:
+				Variables::export_deduplicate = !Variables::export_deduplicate;
+				menu[0].items[SubMenuType::MENU_EXPORT_DEDUPLICATE] = GetDeduplicateItemText();
+				break;
+
+			case SubMenuType::MENU_EXPORT_ENCODER:
+				Variables::export_encoder = (Variables::export_encoder + 1) % (sizeof(ENCODER_PRESETS) / sizeof(ENCODER_PRESETS[0]));
+				menu[0].items[SubMenuType::MENU_EXPORT_ENCODER] = GetEncoderItemText();
+				break;
+
 			case SubMenuType::MENU_OPEN:
 				{
 
@@ -391,19 +863,62 @@ namespace EditorScreen
 				}
 				break;
 
+			case SubMenuType::MENU_SAVE_PROJECT:
+				{
+					if (images.empty())
+					{
+						Logger::Warn("No image loaded");
+						break;
+					}
+
+					NFD::UniquePath out_path;
+					nfdfilteritem_t filter_item[1] = {{"Project File", PROJECT_EXTENSION + 1}};
+					std::string path = std::string("project") + PROJECT_EXTENSION;
+					nfdresult_t result = NFD::SaveDialog(out_path, filter_item, 1, nullptr, path.c_str());
+					if (result == NFD_OKAY)
+						SaveProject(out_path.get());
+					else if (result != NFD_CANCEL)
+					{
+        				LOG_ERROR(NFD::GetError());
+					}
+				}
+				break;
+
+			case SubMenuType::MENU_OPEN_PROJECT:
+				{
+					NFD::UniquePath out_path;
+					nfdfilteritem_t filter_item[1] = {{"Project File", PROJECT_EXTENSION + 1}};
+					nfdresult_t result = NFD::OpenDialog(out_path, filter_item, 1);
+					if (result == NFD_OKAY)
+						OpenProject(out_path.get());
+					else if (result != NFD_CANCEL)
+					{
+        				LOG_ERROR(NFD::GetError());
+					}
+				}
+				break;
+
 			case SubMenuType::MENU_QUIT:
 				WindowManager::CloseWindow();
 				break;
 
+			case SubMenuType::MENU_UNDO:
+				Undo();
+				break;
+
+			case SubMenuType::MENU_REDO:
+				Redo();
+				break;
+
 			case SubMenuType::MENU_CROP:
 				{
-					if (pieces.size() < 1)
+					if (pieces.view<PieceRectangles>().empty())
 					{
 						Logger::Warn("No image loaded");
 						break;
 					}
 
-					if (selected_piece < 0)
+					if (selected_piece == entt::null)
 					{
 						Logger::Warn("No piece selected");
 						break;
@@ -413,6 +928,91 @@ namespace EditorScreen
 				}
 				break;
 
+			case SubMenuType::MENU_COALESCE:
+				{
+					if (ask_combine || ask_crop)
+						break;
+
+					// The selected piece, or every piece when none is
+					std::vector<PieceHandle> targets = {selected_piece};
+					if (selected_piece == entt::null)
+						targets = PieceEntity::GetDrawOrder(pieces);
+
+					size_t rectangle_count = 0;
+					for (PieceHandle piece : targets)
+						rectangle_count += PieceEntity::Exists(pieces, piece) ? pieces.get<PieceRectangles>(piece).sources_dests.size() : 0;
+
+					size_t merged = history.Coalesce(pieces, pieces_index, targets);
+					if (merged > 0)
+						pieces_renderer.Invalidate();
+					Logger::Info("Coalesced {} rectangles into {}", rectangle_count, rectangle_count - merged);
+				}
+				break;
+
+			case SubMenuType::MENU_AUTO_SLICE:
+				{
+					if (ask_combine || ask_crop)
+						break;
+
+					if (selected_piece == entt::null)
+					{
+						Logger::Warn("No piece selected");
+						break;
+					}
+
+					auto start = std::chrono::steady_clock::now();
+					std::vector<Rectangle> regions = AutoSlicer::FindRegions(GetImagePixels(), PieceEntity::ToImagePiece(pieces, selected_piece));
+					float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+					if (regions.empty())
+					{
+						Logger::Warn("The piece is fully transparent, nothing to slice");
+						break;
+					}
+
+					size_t region_count = regions.size();
+					history.CropRegions(pieces, pieces_index, selected_piece, std::move(regions));
+					pieces_renderer.Invalidate();
+					Logger::Info("Auto sliced the piece into {} pieces, regions found in {:.1f} ms", region_count, milliseconds);
+				}
+				break;
+
+			case SubMenuType::MENU_FIND_SIMILAR:
+				{
+					if (ask_combine || ask_crop)
+						break;
+
+					if (pieces.view<PieceRectangles>().empty() || images.empty())
+					{
+						Logger::Warn("No image loaded");
+						break;
+					}
+
+					// Later edits are fine, groups only keep the pieces that still exist when they are selected
+					similar_groups.clear();
+					similar_group_index = -1;
+					similar_finder.Start(GetImagePixels(), PieceEntity::ToImagePieces(pieces), PieceEntity::GetDrawOrder(pieces));
+				}
+				break;
+
+			case SubMenuType::MENU_COLLAPSE_SIMILAR:
+				{
+					if (ask_combine || ask_crop)
+						break;
+
+					std::vector<PieceHandle> group = GetSimilarGroup();
+					if (group.empty())
+					{
+						Logger::Warn("No similar group selected, use Find similar pieces then tab");
+						break;
+					}
+
+					size_t removed = history.Remove(pieces, pieces_index, std::vector<PieceHandle>(group.begin() + 1, group.end()));
+					pieces_renderer.Invalidate();
+					selected_piece = group[0];
+					Logger::Info("Collapsed the group into its first piece, {} pieces removed", removed);
+				}
+				break;
+
 			case SubMenuType::MENU_BASE_BAR:
 				break;
 
@@ -434,16 +1034,12 @@ namespace EditorScreen
 	}
 
 	// Binds the pieces position-wise but keeps them separated
-	Vector2 BindPieces(ImagePiece& first, ImagePiece& second)
+	Vector2 BindPieces(PieceHandle first, PieceHandle second)
 	{
-		Rectangle first_bounds = GetBounds(first);	
-		Rectangle second_bounds = GetBounds(second);
-
-		first_bounds.x += first.first_piece_pos.x;
-		first_bounds.y += first.first_piece_pos.y;
-
-		second_bounds.x += second.first_piece_pos.x;
-		second_bounds.y += second.first_piece_pos.y;
+		Rectangle first_bounds = PieceEntity::GetWorldBounds(pieces, first);
+		Rectangle second_bounds = PieceEntity::GetWorldBounds(pieces, second);
+		Vector2& first_pos = pieces.get<PiecePosition>(first).value;
+		Vector2& second_pos = pieces.get<PiecePosition>(second).value;
 
 		bool should_bind = true;
 		if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT))
@@ -506,8 +1102,8 @@ namespace EditorScreen
 			{
 				Vector2 offset = Vector2Subtract({final_rect.x, final_rect.y}, {second_bounds.x, second_bounds.y});
 
-				second.first_piece_pos.x += offset.x;
-				second.first_piece_pos.y += offset.y;
+				second_pos.x += offset.x;
+				second_pos.y += offset.y;
 
 				should_bind = false;
 			}
@@ -515,41 +1111,33 @@ namespace EditorScreen
 		else if (should_bind)
 		{
 			if (second_bounds.x > first_bounds.x + first_bounds.width)
-				second.first_piece_pos.x -= second_bounds.x - first_bounds.x - first_bounds.width;
+				second_pos.x -= second_bounds.x - first_bounds.x - first_bounds.width;
 			if (second_bounds.y > first_bounds.y + first_bounds.height)
-				second.first_piece_pos.y -= second_bounds.y - first_bounds.y - first_bounds.height;
+				second_pos.y -= second_bounds.y - first_bounds.y - first_bounds.height;
 			if (second_bounds.x + second_bounds.width < first_bounds.x)
-				second.first_piece_pos.x -= second_bounds.x + second_bounds.width - first_bounds.x;
+				second_pos.x -= second_bounds.x + second_bounds.width - first_bounds.x;
 			if (second_bounds.y + second_bounds.height < first_bounds.y)
-				second.first_piece_pos.y -= second_bounds.y + second_bounds.height - first_bounds.y;
+				second_pos.y -= second_bounds.y + second_bounds.height - first_bounds.y;
 		}
 
 		Vector2 result;
-		result.x = second.first_piece_pos.x - first.first_piece_pos.x;
-		result.y = second.first_piece_pos.y - first.first_piece_pos.y;
+		result.x = second_pos.x - first_pos.x;
+		result.y = second_pos.y - first_pos.y;
 		return result;
 	}
 
 	// @param contact_point A vector relative to the position of the first piece where to attach the second piece
-	static void CombinePieces(uint32_t first, uint32_t second, Vector2 offset)
+	static void CombinePieces(PieceHandle first, PieceHandle second, Vector2 offset)
 	{
-		if (first >= pieces.size() || second >= pieces.size())
+		if (!PieceEntity::Exists(pieces, first) || !PieceEntity::Exists(pieces, second) || first == second)
 			return;
 
-		for (auto source_dest_pair : pieces[second].sources_dests)
-		{
-			source_dest_pair.destination.x += offset.x;
-			source_dest_pair.destination.y += offset.y;
-
-			pieces[first].sources_dests.emplace_back(source_dest_pair);
-		}
-
-		pieces.erase(pieces.begin() + second);
+		history.Combine(pieces, pieces_index, first, second, offset, combine_start_position);
 	}
 
 	// Crop pieces
 	// @return true if crop is successfull, false if crop has failed
-	static bool CropPiece(uint32_t piece_index, int x_times, int y_times)
+	static bool CropPiece(PieceHandle cropped_piece, int x_times, int y_times)
 	{
 		if (x_times < 1 || y_times < 1)
 		{
@@ -563,49 +1151,15 @@ namespace EditorScreen
 			return false;
 		}
 
-		Rectangle piece_bounds = GetBounds(pieces[piece_index]);
-		piece_bounds.x += pieces[piece_index].first_piece_pos.x;
-		piece_bounds.y += pieces[piece_index].first_piece_pos.y;
-		Vector2 new_piece_size = {piece_bounds.width / x_times, piece_bounds.height / y_times};
-		for (int y = 0; y < y_times; y++)
+		if (!Variables::crop_skip_uniform_cells)
 		{
-			for (int x = 0; x < x_times; x++)
-			{
-				Rectangle new_piece_bounds = {piece_bounds.x + x * new_piece_size.x, piece_bounds.y + y * new_piece_size.y, new_piece_size.x, new_piece_size.y};
-				ImagePiece new_piece;
-				new_piece.first_piece_pos.x = new_piece_bounds.x;
-				new_piece.first_piece_pos.y = new_piece_bounds.y;
-
-				bool found_collision = false;
-				for (auto [source, dest] : pieces[piece_index].sources_dests)
-				{
-					dest.x += pieces[piece_index].first_piece_pos.x;
-					dest.y += pieces[piece_index].first_piece_pos.y;
-					if (CheckCollisionRecs(dest, new_piece_bounds))
-					{
-						found_collision = true;
-						SourceDestinationPair new_source_dest_pair;
-
-						Rectangle collision_area = GetCollisionRec(dest, new_piece_bounds);
-
-						new_source_dest_pair.source.x = source.x + collision_area.x - dest.x;
-						new_source_dest_pair.source.y = source.y + collision_area.y - dest.y;
-						new_source_dest_pair.source.width = collision_area.width;
-						new_source_dest_pair.source.height = collision_area.height;
-
-						new_source_dest_pair.destination.x = collision_area.x - new_piece_bounds.x;
-						new_source_dest_pair.destination.y = collision_area.y - new_piece_bounds.y;
-						new_source_dest_pair.destination.width= collision_area.width;
-						new_source_dest_pair.destination.height = collision_area.height;
-
-						new_piece.sources_dests.emplace_back(new_source_dest_pair);
-					}
-				}
-				if (found_collision)
-					pieces.emplace_back(new_piece);
-			}
+			history.Crop(pieces, pieces_index, cropped_piece, x_times, y_times);
+			return true;
 		}
 
+		std::vector<Image> sources = GetImagePixels();
+		size_t skipped = history.Crop(pieces, pieces_index, cropped_piece, x_times, y_times, &sources);
+		Logger::Info("Skipped {} single-colour cells out of {}", skipped, x_times * y_times);
 		return true;
 	}
 
@@ -614,9 +1168,51 @@ namespace EditorScreen
 		if (IsFileDropped())
 		{
 			FilePathList dropped_files = LoadDroppedFiles();
-			LoadFile(dropped_files.paths[0]);
+			std::vector<std::string> project_paths;
+			for (unsigned int i = 0; i < dropped_files.count; i++)
+			{
+				if (IsFileExtension(dropped_files.paths[i], PROJECT_EXTENSION))
+					project_paths.push_back(dropped_files.paths[i]);
+			}
+
+			// Opening a project replaces the document and cancels the loads, so the images dropped along with it would be lost
+			if (project_paths.empty())
+			{
+				for (unsigned int i = 0; i < dropped_files.count; i++)
+					AddFile(dropped_files.paths[i]);
+			}
+			else
+			{
+				if (project_paths.size() > 1)
+					Logger::Warn("{} projects dropped, only '{}' is opened", project_paths.size(), project_paths[0]);
+				if (dropped_files.count > project_paths.size())
+					Logger::Warn("{} image(s) dropped along with a project were ignored, drop them once it is open", dropped_files.count - project_paths.size());
+				OpenProject(project_paths[0]);
+			}
 			UnloadDroppedFiles(dropped_files);
 		}
+		UpdateFileLoading();
+		UpdateSimilarFinder();
+
+		// Handles are never confused with newer pieces, so a selection that was combined, cropped or undone away is just dropped
+		if (!PieceEntity::Exists(pieces, selected_piece))
+			selected_piece = entt::null;
+		if (!ask_combine && !PieceEntity::Exists(pieces, combine_pieces.first))
+			combine_pieces.first = entt::null;
+
+		bool control_down = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+		bool shift_down = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+		if (control_down && IsKeyPressed(KEY_Z))
+		{
+			if (shift_down)
+				Redo();
+			else
+				Undo();
+		}
+		if (control_down && IsKeyPressed(KEY_Y))
+			Redo();
+		if (IsKeyPressed(KEY_TAB) && !similar_groups.empty() && !ask_combine && !ask_crop)
+			SelectNextSimilarGroup();
 
 		auto& camera_component = camera.GetComponent<Camera2DComponent>();
 		camera_component.camera.zoom += GetMouseWheelMove() * camera_component.camera.zoom * 0.1f;
@@ -644,18 +1240,21 @@ namespace EditorScreen
 		if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
 		{
 			if (!HandleMenu())
-				selected_piece = GetCollidingPieceIndex(mouse_pos);
+				selected_piece = GetCollidingPiece(mouse_pos);
 		}
 
 		if (IsMouseButtonReleased(MOUSE_BUTTON_RIGHT) && !is_dialog)
 		{
-			if (combine_pieces.first == -1)
-				combine_pieces.first = GetCollidingPieceIndex(mouse_pos);
+			if (combine_pieces.first == entt::null)
+				combine_pieces.first = GetCollidingPiece(mouse_pos);
 			else
 			{
-				combine_pieces.second = GetCollidingPieceIndex(mouse_pos);
-				if (combine_pieces.second > -1)
+				combine_pieces.second = GetCollidingPiece(mouse_pos);
+				if (combine_pieces.second != entt::null)
+				{
 					ask_combine = true;
+					combine_start_position = pieces.get<PiecePosition>(combine_pieces.second).value;
+				}
 			}
 		}
 
@@ -663,16 +1262,24 @@ namespace EditorScreen
 		{
 			if (!ask_crop || !CheckCollisionPointRec(GetMousePosition(), {(float)ask_crop_format_layer.x, (float)ask_crop_format_layer.y, (float)ask_crop_format_layer.width, (float)ask_crop_format_layer.height}))
 			{
-				if (selected_piece == -1)
-					selected_piece = GetCollidingPieceIndex(mouse_pos);
+				if (selected_piece == entt::null)
+					selected_piece = GetCollidingPiece(mouse_pos);
 
 				Vector2 mouse_delta;
 				mouse_delta.x = mouse_pos.x - previous_mouse_pos.x;
 				mouse_delta.y = mouse_pos.y - previous_mouse_pos.y;
-				if (selected_piece > -1)
+				if (selected_piece != entt::null)
 				{
-					pieces[selected_piece].first_piece_pos.x += mouse_delta.x;
-					pieces[selected_piece].first_piece_pos.y += mouse_delta.y;
+					Vector2& position = pieces.get<PiecePosition>(selected_piece).value;
+					if (dragged_piece != selected_piece)
+					{
+						dragged_piece = selected_piece;
+						drag_start_position = position;
+					}
+					position.x += mouse_delta.x;
+					position.y += mouse_delta.y;
+					pieces_index.MovePiece(pieces, selected_piece);
+					pieces_renderer.MarkDirty(selected_piece);
 				}
 				else 
 				{
@@ -683,16 +1290,37 @@ namespace EditorScreen
 			}
 		}
 
+		// A whole drag is a single step in the history
+		if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT) && dragged_piece != entt::null)
+		{
+			if (PieceEntity::Exists(pieces, dragged_piece))
+			{
+				Vector2 delta = Vector2Subtract(pieces.get<PiecePosition>(dragged_piece).value, drag_start_position);
+				if (delta.x != 0.0f || delta.y != 0.0f)
+					history.PushMove(pieces, dragged_piece, delta);
+			}
+			dragged_piece = entt::null;
+		}
+
 		// Dialogs ---------------------------------------------------------
 		if (ask_combine)
 		{
-			Vector2 offset = BindPieces(pieces[combine_pieces.first], pieces[combine_pieces.second]);
+			Vector2 offset = BindPieces(combine_pieces.first, combine_pieces.second);
+			pieces_index.MovePiece(pieces, combine_pieces.second);
 			if (ask_confirm_layer.Update(dt))
 			{
 				ask_combine = false;
 				if (Variables::ask_confirm_dialog_result)
 					CombinePieces(combine_pieces.first, combine_pieces.second, offset);
-				combine_pieces = {-1, -1};
+				else
+				{
+					// The second piece stays where it was bound
+					Vector2 delta = Vector2Subtract(pieces.get<PiecePosition>(combine_pieces.second).value, combine_start_position);
+					if (delta.x != 0.0f || delta.y != 0.0f)
+						history.PushMove(pieces, combine_pieces.second, delta);
+				}
+				pieces_renderer.Invalidate();
+				combine_pieces = {entt::null, entt::null};
 			}
 		}
 
@@ -712,11 +1340,11 @@ namespace EditorScreen
 					else
 					{
 						if (CropPiece(crop_piece, Variables::ask_crop_dialog_result.x, Variables::ask_crop_dialog_result.y))
-							pieces.erase(pieces.begin() + crop_piece);
+							pieces_renderer.Invalidate();
 					}
 					Variables::ask_crop_dialog_result = {1, 1};
 				}
-				crop_piece = -1;
+				crop_piece = entt::null;
 			}
 		}
 
@@ -778,37 +1406,55 @@ namespace EditorScreen
 		BeginMode2D(camera_component.camera);
 
 		DrawRectanglePro({window_size.x / 2.0f, window_size.y / 2.0f, 10.0f, 10.0f}, {5.0f, 5.0f}, 0.0f, RED);
-		if (IsTextureReady(image))
+		if (!images.empty())
 		{
 			if (ask_combine)
 			{
-				DrawPiece(pieces[combine_pieces.first], false);
-				DrawPiece(pieces[combine_pieces.second], false);
+				DrawPiece(combine_pieces.first, false);
+				DrawPiece(combine_pieces.second, false);
 			}
 			else if (ask_crop)
 			{
-				DrawPiece(pieces[crop_piece], false);
+				DrawPiece(crop_piece, false);
 
-				Rectangle piece_bounds = GetBounds(pieces[crop_piece]);
+				Rectangle piece_bounds = PieceEntity::GetWorldBounds(pieces, crop_piece);
 				if (Variables::ask_crop_dialog_result.x > 0)
 				{
 					int x_step = piece_bounds.width / Variables::ask_crop_dialog_result.x;
 					for (int x = 0; x < (int)Variables::ask_crop_dialog_result.x + 1; x++)
-						DrawLine(piece_bounds.x + pieces[crop_piece].first_piece_pos.x + x * x_step, piece_bounds.y + pieces[crop_piece].first_piece_pos.y, piece_bounds.x + pieces[crop_piece].first_piece_pos.x + x * x_step, piece_bounds.y + pieces[crop_piece].first_piece_pos.y + piece_bounds.height, RED);
+						DrawLine(piece_bounds.x + x * x_step, piece_bounds.y, piece_bounds.x + x * x_step, piece_bounds.y + piece_bounds.height, RED);
 				}
 				if (Variables::ask_crop_dialog_result.y > 0)
 				{
 					int y_step = piece_bounds.height / Variables::ask_crop_dialog_result.y;
 					for (int y = 0; y < (int)Variables::ask_crop_dialog_result.y + 1; y++)
-						DrawLine(piece_bounds.x + pieces[crop_piece].first_piece_pos.x, piece_bounds.y + pieces[crop_piece].first_piece_pos.y + y * y_step, piece_bounds.x + pieces[crop_piece].first_piece_pos.x + piece_bounds.width, piece_bounds.y + pieces[crop_piece].first_piece_pos.y + y * y_step, RED);
+						DrawLine(piece_bounds.x, piece_bounds.y + y * y_step, piece_bounds.x + piece_bounds.width, piece_bounds.y + y * y_step, RED);
 				}
 			}
+			else if (HasTiledImages())
+			{
+				// Tiles change with the view, so pieces go through DrawPiece which only draws visible rectangles
+				std::vector<PieceHandle> visible_pieces;
+				pieces_index.QueryPieces(pieces, GetVisibleArea(camera_component.camera), visible_pieces);
+				for (PieceHandle piece : visible_pieces)
+					DrawPiece(piece, piece == selected_piece);
+			}
 			else
-				for (int i = 0; i < (int)pieces.size(); i++)
-					DrawPiece(pieces[i], i == selected_piece);
+				pieces_renderer.Draw(pieces, pieces_index, GetVisibleArea(camera_component.camera), image_textures, selected_piece, camera_component.camera.zoom);
+
+			if (!ask_combine && !ask_crop)
+			{
+				for (PieceHandle piece : GetSimilarGroup())
+					DrawRectangleLinesEx(PieceEntity::GetWorldBounds(pieces, piece), 2.0f / camera_component.camera.zoom, Colors::MENU_HOVER);
+			}
 		}
 
 		EndMode2D();
+		for (SourceImage& source_image : images)
+		{
+			if (source_image.tiled.IsLoaded())
+				source_image.tiled.Update();
+		}
 
 		// Dialogs -------------------------------------------------------------
 		if (ask_crop)
@@ -827,7 +1473,7 @@ namespace EditorScreen
 		DrawRectangle(0, GetScreenHeight() - 20, GetScreenWidth(), 20, Colors::MENU_BACKGROUND);
 		DrawRectangle(0, GetScreenHeight() - 21, GetScreenWidth(), 1, Colors::MENU_OUTLINE);
 
-		std::string image_info = fmt::format("Size: {} x {}", image.width, image.height); 
+		std::string image_info = images.size() > 1 ? fmt::format("Images: {}", images.size()) : fmt::format("Size: {} x {}", images.empty() ? 0 : images[0].pixels.width, images.empty() ? 0 : images[0].pixels.height); 
 		int image_info_width = MeasureText(image_info.c_str(), 20);
 		DrawText(image_info.c_str(), GetScreenWidth() / 2.0f - image_info_width / 2.0f, GetScreenHeight() - 20, 20, Colors::MENU_TEXT);
 
@@ -837,7 +1483,42 @@ namespace EditorScreen
 
 		console_log.Render(false, true);
 
+		Texture2D preview = {};
+		float upload_progress = 0.0f;
+		for (const PendingLoad& load : pending_loads)
+		{
+			if (IsTextureReady(load.loader->GetPreview()))
+			{
+				preview = load.loader->GetPreview();
+				upload_progress = load.loader->GetUploadProgress();
+				break;
+			}
+		}
+		if (IsTextureReady(preview))
+		{
+			float scale = 128.0f / std::max(preview.width, preview.height);
+			Rectangle preview_dest = {window_size.x - preview.width * scale - 10.0f, window_size.y - 21.0f - 10.0f - preview.height * scale - 6.0f, preview.width * scale, preview.height * scale};
+			DrawTexturePro(preview, {0.0f, 0.0f, (float)preview.width, (float)preview.height}, preview_dest, {0.0f, 0.0f}, 0.0f, WHITE);
+			DrawRectangleLinesEx(preview_dest, 1.0f, Colors::MENU_OUTLINE);
+			DrawRectangle(preview_dest.x, preview_dest.y + preview_dest.height + 2.0f, preview_dest.width, 4.0f, Colors::MENU_BACKGROUND);
+			DrawRectangle(preview_dest.x, preview_dest.y + preview_dest.height + 2.0f, preview_dest.width * upload_progress, 4.0f, Colors::MENU_HOVER);
+		}
+
 		DrawFPS(5, GetScreenHeight() - 21 - 30);
+		std::string render_info = fmt::format("Draw calls: {}  Binds: {}  Vertices: {}  Pieces drawn: {}  Culled: {}", pieces_renderer.GetDrawCalls(), pieces_renderer.GetTextureBinds(), pieces_renderer.GetVertexCount(), pieces_renderer.GetDrawnPieces(), pieces_renderer.GetCulledPieces());
+		DrawText(render_info.c_str(), 100, GetScreenHeight() - 21 - 30, 20, LIME);
+		if (HasTiledImages())
+		{
+			int resident_tiles = 0;
+			size_t resident_bytes = 0;
+			for (const SourceImage& source_image : images)
+			{
+				resident_tiles += source_image.tiled.GetResidentTiles();
+				resident_bytes += source_image.tiled.GetResidentBytes();
+			}
+			std::string tiles_info = fmt::format("Tiles: {} ({} MB)", resident_tiles, resident_bytes / (1024 * 1024));
+			DrawText(tiles_info.c_str(), 5, GetScreenHeight() - 21 - 50, 20, LIME);
+		}
 
 	}
 
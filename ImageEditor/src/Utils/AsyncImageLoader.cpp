@@ -0,0 +1,223 @@
+#include "AsyncImageLoader.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <rlgl.h>
+
+#include "Utils/MappedImage.h"
+#include "Utils/MipChain.h"
+#include "Utils/PngDecoder.h"
+#include "Utils/TiledTexture.h"
+
+// The preview is the first mipmap level that fits in this size
+#define PREVIEW_SIZE 256
+
+#define GL_TEXTURE_2D 0x0DE1
+#define GL_RGBA 0x1908
+#define GL_RGBA8 0x8058
+#define GL_UNSIGNED_BYTE 0x1401
+
+// Part of the glad loader bundled in raylib, rlgl can only update the first level of a texture
+extern "C" void (*glad_glTexImage2D)(unsigned int target, int level, int internal_format, int width, int height, int border, unsigned int format, unsigned int type, const void* pixels);
+extern "C" void (*glad_glTexSubImage2D)(unsigned int target, int level, int x_offset, int y_offset, int width, int height, unsigned int format, unsigned int type, const void* pixels);
+
+static void DecodeJob(std::shared_ptr<AsyncLoadJob> job)
+{
+	Image pixels = job->is_streamed ? PngDecoder::LoadMapped(job->filepath) : LoadImage(job->filepath.c_str());
+	if (!job->is_streamed && IsImageReady(pixels))
+	{
+		ImageFormat(&pixels, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+		MipChain::Generate(&pixels);
+	}
+
+	// Nobody is waiting for a cancelled job anymore, so it cleans up after itself
+	std::lock_guard<std::mutex> lock(job->mutex);
+	if (job->cancelled)
+		MappedImage::Unload(pixels);
+	else
+		job->pixels = pixels;
+
+	job->done = true;
+}
+
+AsyncImageLoader::AsyncImageLoader()
+{
+}
+
+void AsyncImageLoader::Start(const std::string& _filepath)
+{
+	Cancel();
+
+	filepath = _filepath;
+	job = std::make_shared<AsyncLoadJob>();
+	job->filepath = filepath;
+
+	// A whole decoded image would not fit in memory once it is big enough to need tiles, so it is decoded a few rows at a time
+	// Tiles are decided here as the texture limit can only be read on the main thread
+	PngInfo info;
+	job->is_streamed = PngDecoder::ReadInfo(filepath, info) && !info.is_interlaced && TiledTexture::IsNeeded(info.width, info.height);
+
+	std::thread(DecodeJob, job).detach();
+	state = AsyncLoadState::DECODING;
+}
+
+void AsyncImageLoader::Cancel()
+{
+	if (job)
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->cancelled = true;
+		if (job->done)
+			MappedImage::Unload(job->pixels);
+	}
+	job.reset();
+
+	ReleaseUpload();
+	state = AsyncLoadState::IDLE;
+}
+
+void AsyncImageLoader::Unload()
+{
+	Cancel();
+}
+
+AsyncLoadState AsyncImageLoader::Update(size_t& upload_budget)
+{
+	if (state == AsyncLoadState::DECODING && job->done)
+	{
+		{
+			std::lock_guard<std::mutex> lock(job->mutex);
+			pixels = job->pixels;
+			job->pixels = {};
+		}
+		job.reset();
+
+		if (!IsImageReady(pixels))
+			state = AsyncLoadState::FAILED;
+		else if (TiledTexture::IsNeeded(pixels.width, pixels.height))
+			state = AsyncLoadState::READY; // Drawn from tiles, there is no single texture to upload
+		else
+			BeginUpload();
+	}
+
+	if (state != AsyncLoadState::UPLOADING || upload_budget == 0)
+		return state;
+
+	rlEnableTexture(texture.id);
+	size_t uploaded_this_frame = 0;
+	while (upload_level < pixels.mipmaps && uploaded_this_frame < upload_budget)
+	{
+		int level_width = std::max(pixels.width >> upload_level, 1);
+		int level_height = std::max(pixels.height >> upload_level, 1);
+		size_t row_size = (size_t)level_width * 4;
+
+		int rows = (int)std::clamp((upload_budget - uploaded_this_frame) / row_size, (size_t)1, (size_t)(level_height - upload_row));
+		const unsigned char* data = (const unsigned char*)pixels.data + MipChain::GetLevelOffset(pixels, upload_level) + upload_row * row_size;
+		glad_glTexSubImage2D(GL_TEXTURE_2D, upload_level, 0, upload_row, level_width, rows, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+		uploaded_this_frame += rows * row_size;
+		upload_row += rows;
+		if (upload_row >= level_height)
+		{
+			upload_level++;
+			upload_row = 0;
+		}
+	}
+	rlDisableTexture();
+	uploaded_bytes += uploaded_this_frame;
+	upload_budget -= std::min(upload_budget, uploaded_this_frame);
+
+	if (upload_level >= pixels.mipmaps)
+	{
+		SetTextureFilter(texture, TEXTURE_FILTER_TRILINEAR);
+		UnloadTexture(preview);
+		preview = {};
+		state = AsyncLoadState::READY;
+	}
+
+	return state;
+}
+
+AsyncLoadState AsyncImageLoader::GetState() const
+{
+	return state;
+}
+
+bool AsyncImageLoader::IsBusy() const
+{
+	return state == AsyncLoadState::DECODING || state == AsyncLoadState::UPLOADING;
+}
+
+float AsyncImageLoader::GetUploadProgress() const
+{
+	if (state == AsyncLoadState::READY)
+		return 1.0f;
+	if (state != AsyncLoadState::UPLOADING || total_bytes == 0)
+		return 0.0f;
+
+	return (float)uploaded_bytes / total_bytes;
+}
+
+const std::string& AsyncImageLoader::GetFilepath() const
+{
+	return filepath;
+}
+
+Texture2D AsyncImageLoader::GetPreview() const
+{
+	return preview;
+}
+
+void AsyncImageLoader::Take(Image& _pixels, Texture2D& _texture)
+{
+	_pixels = pixels;
+	_texture = texture;
+	pixels = {};
+	texture = {};
+	state = AsyncLoadState::IDLE;
+}
+
+void AsyncImageLoader::BeginUpload()
+{
+	int preview_level = 0;
+	while (preview_level < pixels.mipmaps - 1 && std::max(pixels.width >> preview_level, pixels.height >> preview_level) > PREVIEW_SIZE)
+		preview_level++;
+
+	Image preview_image = MipChain::GetLevel(pixels, preview_level);
+	preview = LoadTextureFromImage(preview_image);
+	SetTextureFilter(preview, TEXTURE_FILTER_BILINEAR);
+	UnloadImage(preview_image);
+
+	// Only allocates the levels, the pixels are sent a few rows at a time in Update
+	texture.id = rlLoadTexture(nullptr, pixels.width, pixels.height, pixels.format, 1);
+	texture.width = pixels.width;
+	texture.height = pixels.height;
+	texture.format = pixels.format;
+	texture.mipmaps = pixels.mipmaps;
+
+	rlEnableTexture(texture.id);
+	for (int level = 1; level < pixels.mipmaps; level++)
+		glad_glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, std::max(pixels.width >> level, 1), std::max(pixels.height >> level, 1), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	rlDisableTexture();
+
+	upload_level = 0;
+	upload_row = 0;
+	uploaded_bytes = 0;
+	total_bytes = MipChain::GetLevelOffset(pixels, pixels.mipmaps);
+	state = AsyncLoadState::UPLOADING;
+}
+
+void AsyncImageLoader::ReleaseUpload()
+{
+	if (texture.id != 0)
+		UnloadTexture(texture);
+	if (preview.id != 0)
+		UnloadTexture(preview);
+	if (pixels.data != nullptr)
+		MappedImage::Unload(pixels);
+
+	texture = {};
+	preview = {};
+	pixels = {};
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <raylib.h>
+
+enum class AsyncLoadState
+{
+	IDLE,
+	DECODING,
+	UPLOADING,
+	READY,
+	FAILED
+};
+
+struct AsyncLoadJob
+{
+	std::string filepath;
+	// Decoded straight into a MappedImage, for PNGs that will be drawn from tiles anyway
+	bool is_streamed = false;
+
+	std::mutex mutex; // Guards pixels and cancelled, so exactly one side frees a cancelled result
+	Image pixels = {};
+	bool cancelled = false;
+	std::atomic<bool> done = false;
+};
+
+// Decodes an image and builds its mip chain on a background thread, then uploads it to the GPU in bounded chunks
+class AsyncImageLoader
+{
+public:
+	AsyncImageLoader();
+
+	// Cancels any load in progress
+	void Start(const std::string& filepath);
+	void Cancel();
+	void Unload();
+
+	// Must be called once per frame on the main thread, uploads at most upload_budget bytes
+	// The uploaded bytes are taken off upload_budget so several loaders can share it
+	// @return the new state
+	AsyncLoadState Update(size_t& upload_budget);
+
+	AsyncLoadState GetState() const;
+	bool IsBusy() const;
+	// Fraction of the GPU upload done, between 0 and 1
+	float GetUploadProgress() const;
+	const std::string& GetFilepath() const;
+	// Low resolution version of the image, only valid while uploading
+	Texture2D GetPreview() const;
+
+	// Hands over the loaded image and texture once the state is READY, the loader goes back to IDLE
+	// The texture is empty when the image needs a TiledTexture
+	void Take(Image& pixels, Texture2D& texture);
+
+private:
+	void BeginUpload();
+	void ReleaseUpload();
+
+private:
+	AsyncLoadState state = AsyncLoadState::IDLE;
+	std::string filepath;
+	std::shared_ptr<AsyncLoadJob> job;
+
+	Image pixels = {};
+	Texture2D texture = {};
+	Texture2D preview = {};
+
+	// Next rows to upload
+	int upload_level = 0;
+	int upload_row = 0;
+	size_t uploaded_bytes = 0;
+	size_t total_bytes = 0;
+};
@@ -0,0 +1,497 @@
+#include "AtlasPacker.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#include <fmt/core.h>
+
+namespace AtlasPacker
+{
+	struct PackRect
+	{
+		int x, y, width, height;
+	};
+
+	// Free areas of a sheet may overlap, every one of them is as large as it can be
+	struct Bin
+	{
+		int width, height;
+		std::vector<PackRect> free_rects;
+	};
+
+	// Sizes are padded, so the padding of the pieces on the right and bottom edges may go past the sheet
+	struct PaddedSize
+	{
+		int width, height;
+	};
+
+	// Result of packing the pieces in one ordering
+	struct Packing
+	{
+		std::vector<AtlasPlacement> placements;
+		std::vector<Vector2> sheet_sizes;
+		size_t sheet_area = 0;
+	};
+
+	enum class Ordering
+	{
+		AREA,
+		PERIMETER,
+		LONGEST_SIDE,
+		WIDTH,
+		HEIGHT,
+		AS_GIVEN,
+		COUNT
+	};
+
+	static bool IsInside(const PackRect& a, const PackRect& b)
+	{
+		return a.x >= b.x && a.y >= b.y && a.x + a.width <= b.x + b.width && a.y + a.height <= b.y + b.height;
+	}
+
+	static bool Overlaps(const PackRect& a, const PackRect& b)
+	{
+		return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+	}
+
+	// Calls function(i) for every i in [0, count), the calling thread works as well
+	template <typename Function>
+	static void ForEachParallel(size_t count, unsigned int jobs, Function function)
+	{
+		std::atomic<size_t> next = 0;
+		auto worker = [&]()
+		{
+			for (size_t i = next++; i < count; i = next++)
+				function(i);
+		};
+
+		jobs = std::max(1u, std::min(jobs > 0 ? jobs : std::thread::hardware_concurrency(), (unsigned int)count));
+		std::vector<std::thread> threads;
+		for (unsigned int i = 1; i < jobs; i++)
+			threads.emplace_back(worker);
+		worker();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	// Best short side fit: the free area whose shortest leftover side is the smallest, then the longest one
+	static bool Insert(Bin& bin, int width, int height, PackRect& placed)
+	{
+		int best_short_side = INT_MAX;
+		int best_long_side = INT_MAX;
+		for (const PackRect& free_rect : bin.free_rects)
+		{
+			if (free_rect.width < width || free_rect.height < height)
+				continue;
+
+			int leftover_x = free_rect.width - width;
+			int leftover_y = free_rect.height - height;
+			int short_side = std::min(leftover_x, leftover_y);
+			int long_side = std::max(leftover_x, leftover_y);
+			if (short_side < best_short_side || (short_side == best_short_side && long_side < best_long_side))
+			{
+				placed = {free_rect.x, free_rect.y, width, height};
+				best_short_side = short_side;
+				best_long_side = long_side;
+			}
+		}
+
+		if (best_short_side == INT_MAX)
+			return false;
+
+		// Every free area under the new piece is replaced by the up to 4 largest areas around it
+		std::vector<PackRect>& free_rects = bin.free_rects;
+		size_t kept_count = 0;
+		std::vector<PackRect> split_rects;
+		for (size_t i = 0; i < free_rects.size(); i++)
+		{
+			const PackRect free_rect = free_rects[i];
+			if (!Overlaps(free_rect, placed))
+			{
+				free_rects[kept_count++] = free_rect;
+				continue;
+			}
+
+			if (placed.x > free_rect.x)
+				split_rects.push_back({free_rect.x, free_rect.y, placed.x - free_rect.x, free_rect.height});
+			if (placed.x + placed.width < free_rect.x + free_rect.width)
+				split_rects.push_back({placed.x + placed.width, free_rect.y, free_rect.x + free_rect.width - placed.x - placed.width, free_rect.height});
+			if (placed.y > free_rect.y)
+				split_rects.push_back({free_rect.x, free_rect.y, free_rect.width, placed.y - free_rect.y});
+			if (placed.y + placed.height < free_rect.y + free_rect.height)
+				split_rects.push_back({free_rect.x, placed.y + placed.height, free_rect.width, free_rect.y + free_rect.height - placed.y - placed.height});
+		}
+		free_rects.resize(kept_count);
+
+		// Areas inside of another one are redundant, the kept areas were already checked against each other
+		std::vector<uint8_t> is_redundant(split_rects.size(), 0);
+		for (size_t i = 0; i < split_rects.size(); i++)
+		{
+			for (size_t j = 0; j < split_rects.size() && !is_redundant[i]; j++)
+			{
+				// Of two equal areas only the first one is kept
+				if (i != j && !is_redundant[j] && IsInside(split_rects[i], split_rects[j]))
+					is_redundant[i] = !IsInside(split_rects[j], split_rects[i]) || j < i;
+			}
+
+			for (size_t j = 0; j < kept_count && !is_redundant[i]; j++)
+				is_redundant[i] = IsInside(split_rects[i], free_rects[j]);
+		}
+
+		// A split area can only contain kept areas that were next to the piece
+		size_t count = 0;
+		for (size_t j = 0; j < kept_count; j++)
+		{
+			bool is_inside_split = false;
+			for (size_t i = 0; i < split_rects.size() && !is_inside_split; i++)
+				is_inside_split = !is_redundant[i] && IsInside(free_rects[j], split_rects[i]);
+			if (!is_inside_split)
+				free_rects[count++] = free_rects[j];
+		}
+		free_rects.resize(count);
+
+		for (size_t i = 0; i < split_rects.size(); i++)
+		{
+			if (!is_redundant[i])
+				free_rects.push_back(split_rects[i]);
+		}
+
+		return true;
+	}
+
+	// @return false if one of the pieces does not fit, placements of the pieces are only valid on success
+	static bool PackSheet(const std::vector<uint32_t>& indices, const std::vector<PaddedSize>& sizes, int width, int height, int padding, uint32_t sheet, std::vector<AtlasPlacement>& placements)
+	{
+		Bin bin = {width + padding, height + padding, {{0, 0, width + padding, height + padding}}};
+		for (uint32_t index : indices)
+		{
+			PackRect placed;
+			if (!Insert(bin, sizes[index].width, sizes[index].height, placed))
+				return false;
+
+			placements[index].sheet = sheet;
+			placements[index].x = placed.x;
+			placements[index].y = placed.y;
+		}
+
+		return true;
+	}
+
+	// Tries the power of two sheets large enough to hold the area of the pieces, smallest and squarest first
+	// @return false if they do not fit in a single sheet of max_size
+	static bool PackSmallestSheet(const std::vector<uint32_t>& indices, const std::vector<PaddedSize>& sizes, int max_size, int padding, uint32_t sheet, std::vector<AtlasPlacement>& placements, Vector2& sheet_size)
+	{
+		size_t area = 0;
+		int widest = 0;
+		int tallest = 0;
+		for (uint32_t index : indices)
+		{
+			area += (size_t)sizes[index].width * sizes[index].height;
+			widest = std::max(widest, sizes[index].width);
+			tallest = std::max(tallest, sizes[index].height);
+		}
+
+		struct SheetSize
+		{
+			int width, height;
+		};
+
+		std::vector<SheetSize> candidates;
+		for (int width = 1; width <= max_size; width *= 2)
+		{
+			for (int height = 1; height <= max_size; height *= 2)
+			{
+				if (width + padding >= widest && height + padding >= tallest && (size_t)(width + padding) * (height + padding) >= area)
+					candidates.push_back({width, height});
+			}
+		}
+
+		std::sort(candidates.begin(), candidates.end(), [](const SheetSize& a, const SheetSize& b)
+		{
+			size_t a_area = (size_t)a.width * a.height;
+			size_t b_area = (size_t)b.width * b.height;
+			if (a_area != b_area)
+				return a_area < b_area;
+			int a_elongation = std::max(a.width, a.height) / std::min(a.width, a.height);
+			int b_elongation = std::max(b.width, b.height) / std::min(b.width, b.height);
+			if (a_elongation != b_elongation)
+				return a_elongation < b_elongation;
+			return a.width > b.width;
+		});
+
+		for (const SheetSize& candidate : candidates)
+		{
+			if (PackSheet(indices, sizes, candidate.width, candidate.height, padding, sheet, placements))
+			{
+				sheet_size = {(float)candidate.width, (float)candidate.height};
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	static Packing PackOrdering(std::vector<uint32_t> remaining, const std::vector<PaddedSize>& sizes, int max_size, int padding)
+	{
+		Packing result;
+		result.placements.resize(sizes.size());
+		while (!remaining.empty())
+		{
+			uint32_t sheet = result.sheet_sizes.size();
+			Vector2 sheet_size;
+			if (PackSmallestSheet(remaining, sizes, max_size, padding, sheet, result.placements, sheet_size))
+			{
+				result.sheet_sizes.push_back(sheet_size);
+				break;
+			}
+
+			// Fills a whole sheet with the pieces that still fit, in order, the others go to the next one
+			Bin bin = {max_size + padding, max_size + padding, {{0, 0, max_size + padding, max_size + padding}}};
+			std::vector<uint32_t> next_remaining;
+			for (uint32_t index : remaining)
+			{
+				PackRect placed;
+				if (Insert(bin, sizes[index].width, sizes[index].height, placed))
+				{
+					result.placements[index].sheet = sheet;
+					result.placements[index].x = placed.x;
+					result.placements[index].y = placed.y;
+				}
+				else
+					next_remaining.push_back(index);
+			}
+
+			result.sheet_sizes.push_back({(float)max_size, (float)max_size});
+			remaining.swap(next_remaining);
+		}
+
+		for (const Vector2& sheet_size : result.sheet_sizes)
+			result.sheet_area += (size_t)sheet_size.x * (size_t)sheet_size.y;
+
+		return result;
+	}
+
+	static std::vector<uint32_t> SortIndices(std::vector<uint32_t> indices, const std::vector<PaddedSize>& sizes, Ordering ordering)
+	{
+		auto key = [&](uint32_t index) -> size_t
+		{
+			const PaddedSize& size = sizes[index];
+			switch (ordering)
+			{
+				case Ordering::AREA: return (size_t)size.width * size.height;
+				case Ordering::PERIMETER: return (size_t)size.width + size.height;
+				case Ordering::LONGEST_SIDE: return (size_t)std::max(size.width, size.height);
+				case Ordering::WIDTH: return (size_t)size.width;
+				case Ordering::HEIGHT: return (size_t)size.height;
+				default: return 0;
+			}
+		};
+
+		if (ordering != Ordering::AS_GIVEN)
+			std::stable_sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) { return key(a) > key(b); });
+
+		return indices;
+	}
+
+	AtlasLayout Pack(const std::vector<Vector2>& sizes, const AtlasOptions& options)
+	{
+		AtlasLayout layout;
+		layout.placements.resize(sizes.size());
+
+		int border = options.extrude * 2 + options.padding;
+		std::vector<PaddedSize> padded_sizes(sizes.size());
+		std::vector<uint32_t> indices;
+		for (uint32_t i = 0; i < sizes.size(); i++)
+		{
+			padded_sizes[i] = {(int)sizes[i].x + border, (int)sizes[i].y + border};
+			layout.placements[i].width = (int)sizes[i].x;
+			layout.placements[i].height = (int)sizes[i].y;
+			if (padded_sizes[i].width - options.padding <= options.max_size && padded_sizes[i].height - options.padding <= options.max_size)
+				indices.push_back(i);
+		}
+
+		if (indices.empty())
+			return layout;
+
+		std::vector<Packing> packings((size_t)Ordering::COUNT);
+		ForEachParallel(packings.size(), options.jobs, [&](size_t i)
+		{
+			packings[i] = PackOrdering(SortIndices(indices, padded_sizes, (Ordering)i), padded_sizes, options.max_size, options.padding);
+		});
+
+		// Fewest sheets first, then the smallest total area
+		const Packing* best = &packings[0];
+		for (const Packing& packing : packings)
+		{
+			if (packing.sheet_sizes.size() < best->sheet_sizes.size() || (packing.sheet_sizes.size() == best->sheet_sizes.size() && packing.sheet_area < best->sheet_area))
+				best = &packing;
+		}
+
+		layout.sheet_sizes = best->sheet_sizes;
+		for (uint32_t index : indices)
+		{
+			layout.placements[index].sheet = best->placements[index].sheet;
+			layout.placements[index].x = best->placements[index].x + options.extrude;
+			layout.placements[index].y = best->placements[index].y + options.extrude;
+		}
+
+		return layout;
+	}
+
+	// Copies the piece into the sheet and repeats its edge pixels extrude times around it
+	static void Blit(const Image& piece, Image& sheet, int x, int y, int extrude)
+	{
+		const uint32_t* src = (const uint32_t*)piece.data;
+		uint32_t* dst = (uint32_t*)sheet.data;
+		for (int row = 0; row < piece.height; row++)
+		{
+			const uint32_t* src_row = src + (size_t)row * piece.width;
+			uint32_t* dst_row = dst + (size_t)(y + row) * sheet.width + x;
+			memcpy(dst_row, src_row, (size_t)piece.width * 4);
+			for (int i = 1; i <= extrude; i++)
+			{
+				dst_row[-i] = src_row[0];
+				dst_row[piece.width - 1 + i] = src_row[piece.width - 1];
+			}
+		}
+
+		// The extruded rows include the extruded corners of the first and last rows
+		size_t row_bytes = (size_t)(piece.width + extrude * 2) * 4;
+		uint32_t* first_row = dst + (size_t)y * sheet.width + x - extrude;
+		uint32_t* last_row = dst + (size_t)(y + piece.height - 1) * sheet.width + x - extrude;
+		for (int i = 1; i <= extrude; i++)
+		{
+			memcpy(first_row - (size_t)i * sheet.width, first_row, row_bytes);
+			memcpy(last_row + (size_t)i * sheet.width, last_row, row_bytes);
+		}
+	}
+
+	static bool WriteLayout(const std::string& path, const std::string& prefix, const std::vector<ImagePiece>& pieces, const AtlasLayout& layout, const AtlasOptions& options)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+			return false;
+
+		fmt::print(file, "{{\n\t\"padding\": {},\n\t\"extrude\": {},\n\t\"sheets\": [\n", options.padding, options.extrude);
+		for (size_t i = 0; i < layout.sheet_sizes.size(); i++)
+			fmt::print(file, "\t\t{{\"file\": \"{}_{}.{}\", \"width\": {}, \"height\": {}}}{}\n", prefix, i, PieceExporter::GetExtension(options.encoding.format), (int)layout.sheet_sizes[i].x, (int)layout.sheet_sizes[i].y, i + 1 < layout.sheet_sizes.size() ? "," : "");
+
+		// The position is where the piece is in the document, so the layout can be put back together
+		fmt::print(file, "\t],\n\t\"pieces\": [\n");
+		bool is_first = true;
+		for (size_t i = 0; i < pieces.size(); i++)
+		{
+			const AtlasPlacement& placement = layout.placements[i];
+			if (placement.sheet == UINT32_MAX)
+				continue;
+
+			Rectangle bounds = Piece::GetBounds(pieces[i]);
+			fmt::print(file, "{}\t\t{{\"index\": {}, \"sheet\": {}, \"x\": {}, \"y\": {}, \"width\": {}, \"height\": {}, \"position_x\": {}, \"position_y\": {}}}",
+				is_first ? "" : ",\n", i, placement.sheet, placement.x, placement.y, placement.width, placement.height, pieces[i].first_piece_pos.x + bounds.x, pieces[i].first_piece_pos.y + bounds.y);
+			is_first = false;
+		}
+		fmt::print(file, "\n\t]\n}}\n");
+
+		return fclose(file) == 0;
+	}
+
+	AtlasStats ExportAtlas(const std::vector<Image>& sources, const std::vector<ImagePiece>& pieces, const std::string& directory, const std::string& prefix, const AtlasOptions& options)
+	{
+		AtlasStats stats;
+		auto start = std::chrono::steady_clock::now();
+
+		std::vector<Vector2> sizes(pieces.size());
+		for (size_t i = 0; i < pieces.size(); i++)
+		{
+			Rectangle bounds = Piece::GetBounds(pieces[i]);
+			sizes[i] = {roundf(bounds.width), roundf(bounds.height)};
+		}
+
+		AtlasLayout layout = Pack(sizes, options);
+
+		std::vector<Image> sheets;
+		size_t sheet_pixels = 0;
+		for (const Vector2& sheet_size : layout.sheet_sizes)
+		{
+			sheets.push_back(GenImageColor((int)sheet_size.x, (int)sheet_size.y, BLANK));
+			sheet_pixels += (size_t)sheet_size.x * (size_t)sheet_size.y;
+		}
+
+		// Pieces and their extruded borders never overlap, so they are drawn into the sheets concurrently
+		std::atomic<size_t> pieces_packed = 0;
+		std::atomic<size_t> piece_pixels = 0;
+		ForEachParallel(pieces.size(), options.jobs, [&](size_t i)
+		{
+			const AtlasPlacement& placement = layout.placements[i];
+			if (placement.sheet == UINT32_MAX)
+				return;
+
+			Image composed = Piece::Compose(sources, pieces[i]);
+			if (composed.width > 0 && composed.height > 0)
+				Blit(composed, sheets[placement.sheet], placement.x, placement.y, options.extrude);
+			UnloadImage(composed);
+			pieces_packed++;
+			piece_pixels += (size_t)placement.width * placement.height;
+		});
+
+		// Fewer sheets than threads leave threads for each sheet, a single sheet gets all of them
+		unsigned int jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+		unsigned int sheet_jobs = std::max(1u, std::min(jobs, (unsigned int)sheets.size()));
+		ExportOptions encoding = options.encoding;
+		if (encoding.jobs == 0)
+			encoding.jobs = std::max(1u, jobs / sheet_jobs);
+
+		const char* extension = PieceExporter::GetExtension(encoding.format);
+		std::vector<uint8_t> is_written(sheets.size(), 0);
+		std::atomic<size_t> bytes_written = 0;
+		ForEachParallel(sheets.size(), sheet_jobs, [&](size_t i)
+		{
+			std::string path = (std::filesystem::path(directory) / fmt::format("{}_{}.{}", prefix, i, extension)).string();
+			int size = 0;
+			unsigned char* data = PieceExporter::Encode((const unsigned char*)sheets[i].data, (size_t)sheets[i].width * 4, sheets[i].width, sheets[i].height, encoding, &size);
+			FILE* file = data ? fopen(path.c_str(), "wb") : nullptr;
+			bool is_sheet_written = file && fwrite(data, 1, size, file) == (size_t)size;
+			if (file)
+				is_sheet_written = fclose(file) == 0 && is_sheet_written;
+			if (is_sheet_written)
+			{
+				is_written[i] = 1;
+				bytes_written += size;
+			}
+			free(data);
+			UnloadImage(sheets[i]);
+		});
+
+		for (size_t i = 0; i < sheets.size(); i++)
+		{
+			if (is_written[i])
+				stats.sheets_written++;
+			else
+				Logger::Error("Failed to write '{}'", (std::filesystem::path(directory) / fmt::format("{}_{}.{}", prefix, i, extension)).string());
+		}
+
+		size_t skipped = pieces.size() - pieces_packed;
+		if (skipped > 0)
+			Logger::Warn("{} pieces are larger than {}x{} and were left out of the atlas", skipped, options.max_size, options.max_size);
+
+		std::string path = (std::filesystem::path(directory) / fmt::format("{}.json", prefix)).string();
+		if (!WriteLayout(path, prefix, pieces, layout, options))
+			Logger::Error("Failed to write '{}'", path);
+
+		stats.pieces_packed = pieces_packed;
+		stats.bytes_written = bytes_written;
+		stats.fill_ratio = sheet_pixels > 0 ? (float)piece_pixels / sheet_pixels : 0.0f;
+		stats.seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		return stats;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <raylib.h>
+
+#include "Utils/ImagePiece.h"
+#include "Utils/PieceExporter.h"
+
+struct AtlasOptions
+{
+	int max_size = 4096; // Power of two, sheets never get larger
+	int padding = 2; // Transparent pixels between two pieces
+	int extrude = 1; // Edge pixels repeated around every piece, so filtering does not sample the neighbours
+	unsigned int jobs = 0; // Threads packing orderings and encoding sheets, 0 picks one per core
+	ExportOptions encoding; // Format and compression of the sheets, trimming and deduplication do not apply; jobs 0 shares the threads between the sheets
+};
+
+struct AtlasPlacement
+{
+	uint32_t sheet = UINT32_MAX; // UINT32_MAX when the piece does not fit in a sheet of max_size
+	int x = 0, y = 0; // Of the piece pixels, the extruded border is around them
+	int width = 0, height = 0;
+};
+
+struct AtlasLayout
+{
+	std::vector<AtlasPlacement> placements; // One per packed size, in the same order
+	std::vector<Vector2> sheet_sizes; // Powers of two
+};
+
+struct AtlasStats
+{
+	size_t sheets_written = 0;
+	size_t pieces_packed = 0;
+	size_t bytes_written = 0;
+	float fill_ratio = 0.0f; // Piece pixels over sheet pixels
+	float seconds = 0.0f;
+};
+
+namespace AtlasPacker
+{
+	// MaxRects with the best short side fit heuristic, sizes are taken in a few orderings packed on separate threads and the densest layout is kept
+	// Every ordering first looks for the smallest single sheet holding everything, and fills several sheets of max_size only when there is none
+	// @param sizes Width and height of every piece, without padding or extrusion
+	AtlasLayout Pack(const std::vector<Vector2>& sizes, const AtlasOptions& options);
+
+	// Packs the composed pieces and writes the sheets as <directory>/<prefix>_<sheet>.<png or qoi> and their layout as <directory>/<prefix>.json
+	// Pieces are sized like Piece::Compose, sources is the document image table
+	AtlasStats ExportAtlas(const std::vector<Image>& sources, const std::vector<ImagePiece>& pieces, const std::string& directory, const std::string& prefix, const AtlasOptions& options);
+}
@@ -0,0 +1,259 @@
+#include "AutoSlicer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Fewer rows are not worth a thread of their own
+#define MIN_ROWS_PER_BAND 64
+
+namespace AutoSlicer
+{
+	// Opaque pixels [x_start, x_end) of a row
+	struct PixelRun
+	{
+		int x_start, x_end;
+	};
+
+	struct Band
+	{
+		int first_row, last_row;
+		std::vector<PixelRun> runs;
+		std::vector<uint32_t> row_starts; // Index of the first run of every row, plus the end
+		std::vector<uint32_t> parents; // Union-find over the runs of the band
+	};
+
+	static void FindRuns(const unsigned char* row, int width, unsigned char alpha_threshold, std::vector<PixelRun>& runs)
+	{
+		int run_start = -1;
+		int x = 0;
+#ifdef __SSE2__
+		// 16 pixels per iteration: the alpha bytes are packed together and compared at once
+		if (alpha_threshold < 255)
+		{
+			const __m128i min_alpha = _mm_set1_epi8((char)(alpha_threshold + 1));
+			for (; x + 16 <= width; x += 16)
+			{
+				const __m128i* pixels = (const __m128i*)(row + x * 4);
+				__m128i alpha_0 = _mm_srli_epi32(_mm_loadu_si128(pixels), 24);
+				__m128i alpha_1 = _mm_srli_epi32(_mm_loadu_si128(pixels + 1), 24);
+				__m128i alpha_2 = _mm_srli_epi32(_mm_loadu_si128(pixels + 2), 24);
+				__m128i alpha_3 = _mm_srli_epi32(_mm_loadu_si128(pixels + 3), 24);
+				__m128i alpha = _mm_packus_epi16(_mm_packs_epi32(alpha_0, alpha_1), _mm_packs_epi32(alpha_2, alpha_3));
+				int opaque_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(alpha, min_alpha), alpha));
+
+				// Blocks fully inside or outside of a run do not change anything
+				if (opaque_mask == (run_start >= 0 ? 0xFFFF : 0))
+					continue;
+
+				for (int bit = 0; bit < 16; bit++)
+				{
+					bool is_opaque = opaque_mask & (1 << bit);
+					if (is_opaque && run_start < 0)
+						run_start = x + bit;
+					else if (!is_opaque && run_start >= 0)
+					{
+						runs.push_back({run_start, x + bit});
+						run_start = -1;
+					}
+				}
+			}
+		}
+#endif
+		for (; x < width; x++)
+		{
+			bool is_opaque = row[x * 4 + 3] > alpha_threshold;
+			if (is_opaque && run_start < 0)
+				run_start = x;
+			else if (!is_opaque && run_start >= 0)
+			{
+				runs.push_back({run_start, x});
+				run_start = -1;
+			}
+		}
+
+		if (run_start >= 0)
+			runs.push_back({run_start, width});
+	}
+
+	static uint32_t FindRoot(std::vector<uint32_t>& parents, uint32_t run)
+	{
+		while (parents[run] != run)
+		{
+			parents[run] = parents[parents[run]];
+			run = parents[run];
+		}
+
+		return run;
+	}
+
+	// The root is always the first run of the region in scan order
+	static void Join(std::vector<uint32_t>& parents, uint32_t a, uint32_t b)
+	{
+		a = FindRoot(parents, a);
+		b = FindRoot(parents, b);
+		if (a < b)
+			parents[b] = a;
+		else if (b < a)
+			parents[a] = b;
+	}
+
+	// Joins the runs of a row with the ones of the row above, touching diagonally is enough
+	static void JoinRows(const std::vector<PixelRun>& runs, std::vector<uint32_t>& parents, uint32_t above_start, uint32_t above_end, uint32_t row_start, uint32_t row_end)
+	{
+		uint32_t above = above_start;
+		uint32_t current = row_start;
+		while (above < above_end && current < row_end)
+		{
+			if (runs[above].x_end < runs[current].x_start)
+				above++;
+			else if (runs[current].x_end < runs[above].x_start)
+				current++;
+			else
+			{
+				Join(parents, above, current);
+				if (runs[above].x_end < runs[current].x_end)
+					above++;
+				else
+					current++;
+			}
+		}
+	}
+
+	static void LabelBand(const unsigned char* pixels, int width, size_t stride, unsigned char alpha_threshold, Band& band)
+	{
+		for (int y = band.first_row; y < band.last_row; y++)
+		{
+			band.row_starts.push_back(band.runs.size());
+			FindRuns(pixels + (size_t)y * stride, width, alpha_threshold, band.runs);
+		}
+		band.row_starts.push_back(band.runs.size());
+
+		band.parents.resize(band.runs.size());
+		for (uint32_t i = 0; i < band.parents.size(); i++)
+			band.parents[i] = i;
+
+		for (size_t row = 1; row + 1 < band.row_starts.size(); row++)
+			JoinRows(band.runs, band.parents, band.row_starts[row - 1], band.row_starts[row], band.row_starts[row], band.row_starts[row + 1]);
+	}
+
+	std::vector<Rectangle> FindRegions(const unsigned char* pixels, int width, int height, size_t stride, unsigned char alpha_threshold)
+	{
+		std::vector<Rectangle> result;
+		if (!pixels || width <= 0 || height <= 0)
+			return result;
+
+		unsigned int band_count = std::max(1u, std::min(std::thread::hardware_concurrency(), (unsigned int)(height / MIN_ROWS_PER_BAND)));
+		std::vector<Band> bands(band_count);
+		for (unsigned int i = 0; i < band_count; i++)
+		{
+			bands[i].first_row = (int)((int64_t)height * i / band_count);
+			bands[i].last_row = (int)((int64_t)height * (i + 1) / band_count);
+		}
+
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < band_count; i++)
+			workers.emplace_back(LabelBand, pixels, width, stride, alpha_threshold, std::ref(bands[i]));
+		LabelBand(pixels, width, stride, alpha_threshold, bands[0]);
+		for (std::thread& worker : workers)
+			worker.join();
+
+		// The bands are put one after the other, then the first row of every band is joined with the last row of the previous one
+		std::vector<PixelRun> runs;
+		std::vector<uint32_t> parents;
+		std::vector<uint32_t> band_offsets;
+		for (const Band& band : bands)
+		{
+			uint32_t offset = runs.size();
+			band_offsets.push_back(offset);
+			runs.insert(runs.end(), band.runs.begin(), band.runs.end());
+			for (uint32_t parent : band.parents)
+				parents.push_back(parent + offset);
+		}
+
+		for (size_t i = 1; i < bands.size(); i++)
+		{
+			const Band& above = bands[i - 1];
+			const Band& below = bands[i];
+			uint32_t above_rows = above.row_starts.size() - 1;
+			JoinRows(runs, parents, band_offsets[i - 1] + above.row_starts[above_rows - 1], band_offsets[i - 1] + above.row_starts[above_rows], band_offsets[i] + below.row_starts[0], band_offsets[i] + below.row_starts[1]);
+		}
+
+		// Roots come first in scan order, so the regions are sorted by their topmost then leftmost run
+		std::vector<uint32_t> region_of_root(runs.size(), UINT32_MAX);
+		std::vector<int> boxes; // left, top, right, bottom of every region
+		for (size_t i = 0; i < bands.size(); i++)
+		{
+			const Band& band = bands[i];
+			for (int y = band.first_row; y < band.last_row; y++)
+			{
+				uint32_t row = y - band.first_row;
+				for (uint32_t run = band_offsets[i] + band.row_starts[row]; run < band_offsets[i] + band.row_starts[row + 1]; run++)
+				{
+					uint32_t root = FindRoot(parents, run);
+					if (region_of_root[root] == UINT32_MAX)
+					{
+						region_of_root[root] = boxes.size() / 4;
+						boxes.insert(boxes.end(), {runs[run].x_start, y, runs[run].x_end, y + 1});
+						continue;
+					}
+
+					int* box = &boxes[region_of_root[root] * 4];
+					box[0] = std::min(box[0], runs[run].x_start);
+					box[2] = std::max(box[2], runs[run].x_end);
+					box[3] = y + 1;
+				}
+			}
+		}
+
+		result.reserve(boxes.size() / 4);
+		for (size_t i = 0; i < boxes.size(); i += 4)
+			result.push_back({(float)boxes[i], (float)boxes[i + 1], (float)(boxes[i + 2] - boxes[i]), (float)(boxes[i + 3] - boxes[i + 1])});
+
+		return result;
+	}
+
+	std::vector<Rectangle> FindRegions(const std::vector<Image>& sources, const ImagePiece& piece, unsigned char alpha_threshold)
+	{
+		std::vector<Rectangle> result;
+		Rectangle bounds = Piece::GetBounds(piece);
+
+		// A whole source or an integer part of it shown at its size is scanned without copying
+		bool is_scanned_in_place = false;
+		if (piece.sources_dests.size() == 1)
+		{
+			const auto& [source, dest, image] = piece.sources_dests[0];
+			bool is_integer = source.x == floorf(source.x) && source.y == floorf(source.y) && source.width == floorf(source.width) && source.height == floorf(source.height);
+			is_scanned_in_place = image < sources.size() && IsImageReady(sources[image]) && is_integer && source.width == dest.width && source.height == dest.height &&
+				source.x >= 0.0f && source.y >= 0.0f && source.x + source.width <= sources[image].width && source.y + source.height <= sources[image].height;
+			if (is_scanned_in_place)
+			{
+				const Image& source_image = sources[image];
+				size_t stride = (size_t)source_image.width * 4;
+				const unsigned char* pixels = (const unsigned char*)source_image.data + (size_t)source.y * stride + (size_t)source.x * 4;
+				result = FindRegions(pixels, (int)source.width, (int)source.height, stride, alpha_threshold);
+			}
+		}
+
+		if (!is_scanned_in_place)
+		{
+			Image composed = Piece::Compose(sources, piece);
+			result = FindRegions((const unsigned char*)composed.data, composed.width, composed.height, (size_t)composed.width * 4, alpha_threshold);
+			UnloadImage(composed);
+		}
+
+		for (Rectangle& region : result)
+		{
+			region.x += bounds.x;
+			region.y += bounds.y;
+		}
+
+		return result;
+	}
+}
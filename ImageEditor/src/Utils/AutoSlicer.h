@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include <raylib.h>
+
+#include "Utils/ImagePiece.h"
+
+namespace AutoSlicer
+{
+	// Bounding boxes of the 8-connected regions of pixels with an alpha above alpha_threshold
+	// Rows are split in bands labelled on separate threads, then the regions crossing two bands are joined
+	// @param pixels R8G8B8A8 rows of width pixels, stride bytes apart
+	std::vector<Rectangle> FindRegions(const unsigned char* pixels, int width, int height, size_t stride, unsigned char alpha_threshold = 0);
+
+	// Same for the pixels of a piece, the boxes are relative to the piece position like its destination rectangles
+	// A piece made of a single unscaled rectangle is scanned in place, others are composed first
+	std::vector<Rectangle> FindRegions(const std::vector<Image>& sources, const ImagePiece& piece, unsigned char alpha_threshold = 0);
+}
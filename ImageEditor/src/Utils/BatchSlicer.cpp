@@ -0,0 +1,278 @@
+#include "BatchSlicer.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+#include <raylib.h>
+
+#include "Utils/ImagePiece.h"
+#include "Utils/AtlasPacker.h"
+#include "Utils/PieceExporter.h"
+
+namespace BatchSlicer
+{
+	struct SliceOptions
+	{
+		std::vector<std::string> inputs;
+		std::string output_dir;
+		int x_times = 0;
+		int y_times = 0;
+		unsigned int jobs = 0;
+		bool is_atlas = false;
+		AtlasOptions atlas;
+		ExportOptions encoding; // Of the pieces and the atlas sheets
+	};
+
+	static std::mutex log_mutex;
+
+	bool IsRequested(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--slice") == 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	static bool ParseOptions(int argc, char** argv, SliceOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--slice")
+			{
+				while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+					options.inputs.emplace_back(argv[++i]);
+			}
+			else if (arg == "--grid" && i + 1 < argc)
+			{
+				if (sscanf(argv[++i], "%dx%d", &options.x_times, &options.y_times) != 2)
+				{
+					Logger::Error("Invalid grid '{}', expected <columns>x<rows>", argv[i]);
+					return false;
+				}
+			}
+			else if (arg == "--out" && i + 1 < argc)
+				options.output_dir = argv[++i];
+			else if (arg == "--jobs" && i + 1 < argc)
+				options.jobs = (unsigned int)atoi(argv[++i]);
+			else if (arg == "--format" && i + 1 < argc)
+			{
+				std::string format = argv[++i];
+				if (format == "png")
+					options.encoding.format = ExportFormat::PNG;
+				else if (format == "qoi")
+					options.encoding.format = ExportFormat::QOI;
+				else
+				{
+					Logger::Error("Unknown format '{}', expected png or qoi", format);
+					return false;
+				}
+			}
+			else if (arg == "--level" && i + 1 < argc)
+				options.encoding.png_compression_level = atoi(argv[++i]);
+			else if (arg == "--atlas")
+				options.is_atlas = true;
+			else if (arg == "--padding" && i + 1 < argc)
+				options.atlas.padding = atoi(argv[++i]);
+			else if (arg == "--extrude" && i + 1 < argc)
+				options.atlas.extrude = atoi(argv[++i]);
+			else if (arg == "--max-size" && i + 1 < argc)
+				options.atlas.max_size = atoi(argv[++i]);
+			else
+			{
+				Logger::Error("Unknown or incomplete argument '{}'", arg);
+				return false;
+			}
+		}
+
+		if (options.inputs.empty())
+		{
+			Logger::Error("No input files given after --slice");
+			return false;
+		}
+
+		if (options.x_times < 1 || options.y_times < 1)
+		{
+			Logger::Error("Grid values must be both greater than 0: x = {}, y = {}", options.x_times, options.y_times);
+			return false;
+		}
+
+		if (options.output_dir.empty())
+		{
+			Logger::Error("No output directory given, use --out <dir>");
+			return false;
+		}
+
+		if (options.encoding.png_compression_level < 0 || options.encoding.png_compression_level > 9)
+		{
+			Logger::Error("The PNG compression level must be between 0 and 9: {}", options.encoding.png_compression_level);
+			return false;
+		}
+
+		if (options.atlas.padding < 0 || options.atlas.extrude < 0)
+		{
+			Logger::Error("Padding and extrusion can not be negative: padding = {}, extrude = {}", options.atlas.padding, options.atlas.extrude);
+			return false;
+		}
+
+		if (options.atlas.max_size < 1 || (options.atlas.max_size & (options.atlas.max_size - 1)) != 0)
+		{
+			Logger::Error("The atlas size must be a power of two: {}", options.atlas.max_size);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Names the outputs of every input after its file stem, inputs with the same stem in different directories
+	// get their parent directory in front, then their index if that is not enough, so no input overwrites the tiles of another
+	static std::vector<std::string> GetOutputNames(const std::vector<std::string>& inputs)
+	{
+		auto count_names = [](const std::vector<std::string>& names, const std::string& name)
+		{
+			return std::count(names.begin(), names.end(), name);
+		};
+
+		std::vector<std::string> stems;
+		for (const std::string& input : inputs)
+			stems.push_back(std::filesystem::path(input).stem().string());
+
+		std::vector<std::string> names = stems;
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			if (count_names(stems, stems[i]) > 1)
+				names[i] = std::filesystem::absolute(inputs[i]).parent_path().filename().string() + "_" + stems[i];
+		}
+
+		std::vector<std::string> unique_names = names;
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			if (count_names(names, names[i]) > 1)
+				unique_names[i] = fmt::format("{}_{}", names[i], i);
+		}
+
+		return unique_names;
+	}
+
+	// @param name Prefix of the output files
+	// @return number of pieces written, -1 if the input could not be loaded
+	static int SliceFile(const std::string& input, const std::string& name, const SliceOptions& options)
+	{
+		Image image = LoadImage(input.c_str());
+		if (!IsImageReady(image))
+			return -1;
+		ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+		ImagePiece image_piece;
+		Piece::AddRectangle(image_piece, {{0.0f, 0.0f, (float)image.width, (float)image.height}, {0.0f, 0.0f, (float)image.width, (float)image.height}});
+		image_piece.first_piece_pos = {0.0f, 0.0f};
+
+		// Files are already sliced in parallel when there are several
+		unsigned int crop_jobs = options.inputs.size() > 1 ? 1 : 0;
+		std::vector<ImagePiece> pieces = Piece::Crop(image_piece, options.x_times, options.y_times, crop_jobs);
+		std::vector<Image> sources = {image};
+		ExportOptions encoding = options.encoding;
+		encoding.jobs = crop_jobs;
+		int written = 0;
+		if (options.is_atlas)
+		{
+			AtlasOptions atlas = options.atlas;
+			atlas.jobs = crop_jobs;
+			atlas.encoding = encoding;
+			AtlasStats stats = AtlasPacker::ExportAtlas(sources, pieces, options.output_dir, name + "_atlas", atlas);
+			UnloadImage(image);
+			return (int)stats.pieces_packed;
+		}
+
+		for (size_t i = 0; i < pieces.size(); i++)
+		{
+			Image out_image = Piece::Compose(sources, pieces[i]);
+			std::string path = (std::filesystem::path(options.output_dir) / fmt::format("{}_{}.{}", name, i, PieceExporter::GetExtension(encoding.format))).string();
+			if (PieceExporter::SaveImage(out_image, path, encoding))
+				written++;
+			else
+			{
+				std::lock_guard<std::mutex> lock(log_mutex);
+				Logger::Error("Failed to write '{}'", path);
+			}
+			UnloadImage(out_image);
+		}
+
+		UnloadImage(image);
+		return written;
+	}
+
+	int Run(int argc, char** argv)
+	{
+		SliceOptions options;
+		if (!ParseOptions(argc, argv, options))
+			return 1;
+
+		std::error_code error;
+		std::filesystem::create_directories(options.output_dir, error);
+		if (error)
+		{
+			Logger::Error("Could not create output directory '{}': {}", options.output_dir, error.message());
+			return 1;
+		}
+
+		SetTraceLogLevel(LOG_WARNING);
+
+		unsigned int jobs = options.jobs > 0 ? options.jobs : std::thread::hardware_concurrency();
+		jobs = std::max(1u, std::min(jobs, (unsigned int)options.inputs.size()));
+
+		std::vector<std::string> output_names = GetOutputNames(options.inputs);
+		std::atomic<size_t> next_input = 0;
+		std::atomic<int> total_pieces = 0;
+		std::atomic<int> failed_inputs = 0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		// Each worker takes the next unprocessed file, so slow files do not stall the others
+		auto worker = [&]()
+		{
+			for (size_t i = next_input++; i < options.inputs.size(); i = next_input++)
+			{
+				int written = SliceFile(options.inputs[i], output_names[i], options);
+				std::lock_guard<std::mutex> lock(log_mutex);
+				if (written < 0)
+				{
+					failed_inputs++;
+					Logger::Error("Could not load '{}'", options.inputs[i]);
+				}
+				else
+				{
+					total_pieces += written;
+					Logger::Info("Sliced '{}' into {} pieces", options.inputs[i], written);
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned int i = 1; i < jobs; i++)
+			threads.emplace_back(worker);
+		worker();
+		for (auto& thread : threads)
+			thread.join();
+
+		float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		Logger::Info("Sliced {} files into {} pieces in {:.2f}s using {} threads", options.inputs.size() - failed_inputs, total_pieces.load(), seconds, jobs);
+
+		return failed_inputs > 0 ? 1 : 0;
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+namespace BatchSlicer
+{
+	// True when the command line asks for the headless slicing mode (--slice)
+	bool IsRequested(int argc, char** argv);
+
+	// Slices every input in a grid and writes the pieces to disk without opening a window
+	// Usage: --slice in.png [in2.png ...] --grid 16x8 --out dir/ [--jobs N] [--format png|qoi] [--level 0-9] [--atlas [--padding N] [--extrude N] [--max-size N]]
+	// --format and --level pick the encoder of the pieces, PNGs are compressed at level 6 by default
+	// With --atlas the pieces of every input are packed in <stem>_atlas_<sheet>.<png or qoi> sheets described by <stem>_atlas.json
+	// @return process exit code
+	int Run(int argc, char** argv);
+}
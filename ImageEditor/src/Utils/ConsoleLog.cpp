@@ -25,6 +25,17 @@ void ConsoleLog::Print(const std::string &value, Color text_color)
 	content.emplace_back(to_add);
 }
 
+void ConsoleLog::SetStatus(const std::string &value, Color text_color)
+{
+	status.message = value;
+	status.text_color = text_color;
+}
+
+void ConsoleLog::ClearStatus()
+{
+	status.message.clear();
+}
+
 void ConsoleLog::Update(float dt)
 {
 	if (content.size() > 0)
@@ -40,7 +51,7 @@ void ConsoleLog::Update(float dt)
 
 void ConsoleLog::Render(bool bottom_is_latest, bool stick_left)
 {
-	if (content.size() < 1)
+	if (content.size() < 1 && status.message.empty())
 		return;
 
 	int beginY = 0;
@@ -63,6 +74,16 @@ void ConsoleLog::Render(bool bottom_is_latest, bool stick_left)
 		}
 		DrawText(content[i].message.c_str(), x_pos, beginY + increment * i, 20, content[i].text_color);	
 	}
+	if (!status.message.empty())
+	{
+		int x_pos = 0;
+		if (stick_left)
+		{
+			int text_lenght = MeasureText(status.message.c_str(), 20);
+			x_pos = destination.width - text_lenght;
+		}
+		DrawText(status.message.c_str(), x_pos, beginY + increment * content.size(), 20, status.text_color);
+	}
 	EndTextureMode();
 
 	DrawTexturePro(output_texture.texture, {0.0f, 0.0f, destination.width, -destination.height}, destination, {0.0f, 0.0f}, 0.0f, WHITE);
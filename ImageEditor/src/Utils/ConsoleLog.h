@@ -20,6 +20,9 @@ public:
 	void Unload();
 
 	void Print(const std::string& value, Color text_color);
+	// Shown after the messages until cleared, used for progress that changes every frame
+	void SetStatus(const std::string& value, Color text_color);
+	void ClearStatus();
 
 	void Update(float dt);
 	void Render(bool bottom_is_latest = false, bool stick_right = false);
@@ -30,6 +33,7 @@ public:
 
 private:
 	std::vector<ConsoleLogMessage> content;
+	ConsoleLogMessage status;
 	float message_lifetime = 5.0f;
 	Rectangle destination = {0.0f, 0.0f, 100.0f, 100.0f};
 	RenderTexture2D output_texture;
@@ -0,0 +1,246 @@
+#include "CropBenchmark.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <raylib.h>
+
+#include "Utils/EditHistory.h"
+#include "Utils/ImagePiece.h"
+#include "Utils/PieceIndex.h"
+
+#define BENCHMARK_IMAGE_SIZE 4096.0f
+#define BENCHMARK_RUNS 3
+// Most pieces Pick may test after the crop, a few cells worth of neighbours
+#define MAX_PICK_CANDIDATES 32
+
+namespace CropBenchmark
+{
+	struct BenchmarkOptions
+	{
+		int x_times = 200;
+		int y_times = 200;
+		int rectangle_count = 4096;
+		unsigned int jobs = 0;
+	};
+
+	bool IsRequested(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--bench-crop") == 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	static bool ParseOptions(int argc, char** argv, BenchmarkOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--bench-crop")
+				continue;
+			else if (arg == "--grid" && i + 1 < argc)
+			{
+				if (sscanf(argv[++i], "%dx%d", &options.x_times, &options.y_times) != 2)
+				{
+					Logger::Error("Invalid grid '{}', expected <columns>x<rows>", argv[i]);
+					return false;
+				}
+			}
+			else if (arg == "--rects" && i + 1 < argc)
+				options.rectangle_count = atoi(argv[++i]);
+			else if (arg == "--jobs" && i + 1 < argc)
+				options.jobs = (unsigned int)atoi(argv[++i]);
+			else
+			{
+				Logger::Error("Unknown or incomplete argument '{}'", arg);
+				return false;
+			}
+		}
+
+		if (options.x_times < 1 || options.y_times < 1 || options.rectangle_count < 1)
+		{
+			Logger::Error("Grid and rectangle count must be greater than 0");
+			return false;
+		}
+
+		return true;
+	}
+
+	// A square image cut in a mosaic whose tiles were shuffled and combined back, so none of them can be coalesced
+	static ImagePiece MakeCombinedPiece(int rectangle_count)
+	{
+		int columns = (int)ceilf(sqrtf((float)rectangle_count));
+		int rows = (rectangle_count + columns - 1) / columns;
+		float tile_width = BENCHMARK_IMAGE_SIZE / columns;
+		float tile_height = BENCHMARK_IMAGE_SIZE / rows;
+
+		std::vector<int> tiles(rectangle_count);
+		for (int i = 0; i < rectangle_count; i++)
+			tiles[i] = i;
+		std::shuffle(tiles.begin(), tiles.end(), std::mt19937(42));
+
+		ImagePiece piece;
+		piece.first_piece_pos = {0.0f, 0.0f};
+		for (int i = 0; i < rectangle_count; i++)
+		{
+			Rectangle source = {(tiles[i] % columns) * tile_width, (tiles[i] / columns) * tile_height, tile_width, tile_height};
+			Rectangle dest = {(i % columns) * tile_width, (i / columns) * tile_height, tile_width, tile_height};
+			Piece::AddRectangle(piece, {source, dest, 0});
+		}
+
+		return piece;
+	}
+
+	// Piece::Crop before the rectangles were bucketed: every cell tests every rectangle of the piece
+	static std::vector<ImagePiece> CropEveryCell(const ImagePiece& piece, int x_times, int y_times)
+	{
+		std::vector<ImagePiece> result;
+
+		Rectangle piece_bounds = Piece::GetBounds(piece);
+		piece_bounds.x += piece.first_piece_pos.x;
+		piece_bounds.y += piece.first_piece_pos.y;
+		Vector2 new_piece_size = {piece_bounds.width / x_times, piece_bounds.height / y_times};
+		for (int y = 0; y < y_times; y++)
+		{
+			for (int x = 0; x < x_times; x++)
+			{
+				Rectangle new_piece_bounds = {piece_bounds.x + x * new_piece_size.x, piece_bounds.y + y * new_piece_size.y, new_piece_size.x, new_piece_size.y};
+				ImagePiece new_piece;
+				new_piece.first_piece_pos.x = new_piece_bounds.x;
+				new_piece.first_piece_pos.y = new_piece_bounds.y;
+
+				for (auto [source, dest, image] : piece.sources_dests)
+				{
+					dest.x += piece.first_piece_pos.x;
+					dest.y += piece.first_piece_pos.y;
+					if (CheckCollisionRecs(dest, new_piece_bounds))
+					{
+						Rectangle collision_area = GetCollisionRec(dest, new_piece_bounds);
+						Rectangle new_source = {source.x + collision_area.x - dest.x, source.y + collision_area.y - dest.y, collision_area.width, collision_area.height};
+						Rectangle new_dest = {collision_area.x - new_piece_bounds.x, collision_area.y - new_piece_bounds.y, collision_area.width, collision_area.height};
+						Piece::AddRectangle(new_piece, {new_source, new_dest, image});
+					}
+				}
+				if (!new_piece.sources_dests.empty())
+				{
+					Piece::Coalesce(new_piece.sources_dests);
+					result.emplace_back(new_piece);
+				}
+			}
+		}
+
+		return result;
+	}
+
+	static bool IsSameCrop(const std::vector<ImagePiece>& a, const std::vector<ImagePiece>& b)
+	{
+		if (a.size() != b.size())
+			return false;
+
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (a[i].sources_dests.size() != b[i].sources_dests.size() ||
+				memcmp(&a[i].first_piece_pos, &b[i].first_piece_pos, sizeof(Vector2)) != 0 ||
+				memcmp(a[i].sources_dests.data(), b[i].sources_dests.data(), a[i].sources_dests.size() * sizeof(SourceDestinationPair)) != 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	// Crops the piece like the editor does, through the edit history and the piece index,
+	// then checks that picking a cropped piece only tests the few pieces around it
+	static bool CheckPickCandidates(const ImagePiece& piece, int x_times, int y_times)
+	{
+		entt::registry pieces;
+		PieceIndex index;
+		EditHistory history;
+		PieceHandle handle = PieceEntity::Create(pieces, piece);
+		index.Rebuild(pieces);
+		history.Crop(pieces, index, handle, x_times, y_times);
+
+		size_t piece_count = 0;
+		size_t max_candidates = 0;
+		size_t wrong_picks = 0;
+		for (PieceHandle cropped : pieces.view<PieceIndexEntry>())
+		{
+			Rectangle bounds = index.GetEntry(pieces, cropped).world_bounds;
+			Vector2 center = {bounds.x + bounds.width / 2.0f, bounds.y + bounds.height / 2.0f};
+			max_candidates = std::max(max_candidates, index.CountCandidates(center));
+			if (index.Pick(pieces, center) != cropped)
+				wrong_picks++;
+			piece_count++;
+		}
+
+		Logger::Info("Picking among {} cropped pieces tests at most {} of them, with cells of {:.0f}", piece_count, max_candidates, index.GetCellSize());
+		if (wrong_picks > 0 || max_candidates > MAX_PICK_CANDIDATES)
+		{
+			Logger::Error("The piece index does not fit the cropped pieces: {} wrong picks, up to {} candidates", wrong_picks, max_candidates);
+			return false;
+		}
+
+		return true;
+	}
+
+	// @return Best time of a few runs in milliseconds
+	template <typename CropFunction>
+	static float TimeCrop(CropFunction crop, std::vector<ImagePiece>& result)
+	{
+		float best = INFINITY;
+		for (int run = 0; run < BENCHMARK_RUNS; run++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			result = crop();
+			best = std::min(best, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		return best;
+	}
+
+	int Run(int argc, char** argv)
+	{
+		BenchmarkOptions options;
+		if (!ParseOptions(argc, argv, options))
+			return 1;
+
+		ImagePiece piece = MakeCombinedPiece(options.rectangle_count);
+		Logger::Info("Cropping a piece of {} rectangles in a {}x{} grid", piece.sources_dests.size(), options.x_times, options.y_times);
+
+		std::vector<ImagePiece> every_cell_pieces;
+		float every_cell_ms = TimeCrop([&]() { return CropEveryCell(piece, options.x_times, options.y_times); }, every_cell_pieces);
+
+		std::vector<ImagePiece> single_thread_pieces;
+		float single_thread_ms = TimeCrop([&]() { return Piece::Crop(piece, options.x_times, options.y_times, 1); }, single_thread_pieces);
+
+		unsigned int jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+		std::vector<ImagePiece> bucketed_pieces;
+		float bucketed_ms = TimeCrop([&]() { return Piece::Crop(piece, options.x_times, options.y_times, jobs); }, bucketed_pieces);
+
+		Logger::Info("Every cell against every rectangle: {:.1f} ms", every_cell_ms);
+		Logger::Info("Bucketed, 1 thread: {:.1f} ms ({:.1f}x)", single_thread_ms, every_cell_ms / std::max(single_thread_ms, 0.001f));
+		Logger::Info("Bucketed, {} threads: {:.1f} ms ({:.1f}x)", jobs, bucketed_ms, every_cell_ms / std::max(bucketed_ms, 0.001f));
+
+		if (!IsSameCrop(every_cell_pieces, single_thread_pieces) || !IsSameCrop(every_cell_pieces, bucketed_pieces))
+		{
+			Logger::Error("The crops differ: {} pieces against {} and {}", every_cell_pieces.size(), single_thread_pieces.size(), bucketed_pieces.size());
+			return 1;
+		}
+
+		Logger::Info("All crops gave the same {} pieces", every_cell_pieces.size());
+		return CheckPickCandidates(piece, options.x_times, options.y_times) ? 0 : 1;
+	}
+}
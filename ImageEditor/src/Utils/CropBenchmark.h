@@ -0,0 +1,13 @@
+#pragma once
+
+namespace CropBenchmark
+{
+	// True when the command line asks for the crop benchmark (--bench-crop)
+	bool IsRequested(int argc, char** argv);
+
+	// Crops a synthetic combined piece with the bucketed Piece::Crop and with the previous one that tested every cell against every rectangle
+	// Usage: --bench-crop [--grid 200x200] [--rects 4096] [--jobs N]
+	// Then crops it through the piece index and checks that picking a cropped piece only tests its neighbours
+	// @return process exit code, 1 if both crops do not give the same pieces or picking tests too many pieces
+	int Run(int argc, char** argv);
+}
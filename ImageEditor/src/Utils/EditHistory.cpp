@@ -0,0 +1,399 @@
+#include "EditHistory.h"
+
+#include <algorithm>
+#include <utility>
+
+// The oldest edits are forgotten past this size
+#define MAX_HISTORY_BYTES (8 * 1024 * 1024)
+
+static void ApplyMove(entt::registry& pieces, PieceIndex& index, const MoveEdit& edit, float direction)
+{
+	if (!PieceEntity::Exists(pieces, edit.piece))
+		return;
+
+	Vector2& position = pieces.get<PiecePosition>(edit.piece).value;
+	position.x += edit.delta.x * direction;
+	position.y += edit.delta.y * direction;
+	index.MovePiece(pieces, edit.piece);
+}
+
+static void ApplyCombine(entt::registry& pieces, PieceIndex& index, CombineEdit& edit)
+{
+	edit.first_bounds = pieces.get<PieceBounds>(edit.first).local;
+	edit.first_rectangle_count = pieces.get<PieceRectangles>(edit.first).sources_dests.size();
+	edit.second_depth = pieces.get<PieceDepth>(edit.second).value;
+
+	for (auto source_dest_pair : pieces.get<PieceRectangles>(edit.second).sources_dests)
+	{
+		source_dest_pair.destination.x += edit.offset.x;
+		source_dest_pair.destination.y += edit.offset.y;
+
+		PieceEntity::AddRectangle(pieces, edit.first, source_dest_pair);
+	}
+
+	// Coalescing does not change the bounds, only the rectangles
+	auto& first_sources_dests = pieces.get<PieceRectangles>(edit.first).sources_dests;
+	std::vector<SourceDestinationPair> uncoalesced = first_sources_dests;
+	if (Piece::Coalesce(first_sources_dests) > 0)
+		edit.uncoalesced = std::move(uncoalesced);
+	else
+		edit.uncoalesced.clear();
+	index.UpdatePiece(pieces, edit.first);
+
+	index.Erase(pieces, edit.second);
+	PieceEntity::Remove(pieces, edit.second);
+}
+
+static void RevertCombine(entt::registry& pieces, PieceIndex& index, const CombineEdit& edit)
+{
+	auto& first_sources_dests = pieces.get<PieceRectangles>(edit.first).sources_dests;
+	if (!edit.uncoalesced.empty())
+		first_sources_dests = edit.uncoalesced;
+
+	ImagePiece second;
+	second.first_piece_pos = edit.second_position;
+	for (size_t i = edit.first_rectangle_count; i < first_sources_dests.size(); i++)
+	{
+		SourceDestinationPair source_dest_pair = first_sources_dests[i];
+		source_dest_pair.destination.x -= edit.offset.x;
+		source_dest_pair.destination.y -= edit.offset.y;
+
+		Piece::AddRectangle(second, source_dest_pair);
+	}
+
+	first_sources_dests.resize(edit.first_rectangle_count);
+	pieces.get<PieceBounds>(edit.first).local = edit.first_bounds;
+	index.UpdatePiece(pieces, edit.first);
+
+	PieceEntity::Restore(pieces, edit.second, std::move(second), edit.second_depth);
+	index.Insert(pieces, edit.second);
+}
+
+// @param skip_uniform_sources Only used the first time, redo drops the same pieces again
+static void ApplyCrop(entt::registry& pieces, PieceIndex& index, CropEdit& edit, const std::vector<Image>* skip_uniform_sources = nullptr)
+{
+	ImagePiece piece = PieceEntity::ToImagePiece(pieces, edit.piece);
+	std::vector<ImagePiece> new_pieces = edit.regions.empty() ? Piece::Crop(piece, edit.x_times, edit.y_times) : Piece::CropRegions(piece, edit.regions);
+
+	if (skip_uniform_sources)
+		edit.skipped_pieces = Piece::FindUniformPieces(*skip_uniform_sources, new_pieces);
+	if (!edit.skipped_pieces.empty())
+	{
+		size_t kept = 0;
+		size_t skipped = 0;
+		for (size_t i = 0; i < new_pieces.size(); i++)
+		{
+			if (skipped < edit.skipped_pieces.size() && edit.skipped_pieces[skipped] == i)
+				skipped++;
+			else
+				new_pieces[kept++] = std::move(new_pieces[i]);
+		}
+		new_pieces.resize(kept);
+	}
+
+	if (edit.new_pieces.empty())
+	{
+		edit.position = piece.first_piece_pos;
+		edit.depth = pieces.get<PieceDepth>(edit.piece).value;
+		edit.sources_dests = std::move(piece.sources_dests);
+		for (ImagePiece& new_piece : new_pieces)
+		{
+			PieceHandle new_handle = PieceEntity::Create(pieces, std::move(new_piece));
+			if (edit.new_pieces.empty())
+				edit.first_new_depth = pieces.get<PieceDepth>(new_handle).value;
+
+			edit.new_pieces.push_back(new_handle);
+			index.Insert(pieces, new_handle);
+		}
+	}
+	else
+	{
+		// Redo, the pieces get back the handles later edits know them by
+		for (size_t i = 0; i < std::min(new_pieces.size(), edit.new_pieces.size()); i++)
+		{
+			PieceEntity::Restore(pieces, edit.new_pieces[i], std::move(new_pieces[i]), edit.first_new_depth + i);
+			index.Insert(pieces, edit.new_pieces[i]);
+		}
+	}
+
+	index.Erase(pieces, edit.piece);
+	PieceEntity::Remove(pieces, edit.piece);
+}
+
+static void RevertCrop(entt::registry& pieces, PieceIndex& index, const CropEdit& edit)
+{
+	for (PieceHandle new_piece : edit.new_pieces)
+	{
+		index.Erase(pieces, new_piece);
+		PieceEntity::Remove(pieces, new_piece);
+	}
+
+	ImagePiece piece;
+	piece.first_piece_pos = edit.position;
+	for (const SourceDestinationPair& source_dest_pair : edit.sources_dests)
+		Piece::AddRectangle(piece, source_dest_pair);
+
+	PieceEntity::Restore(pieces, edit.piece, std::move(piece), edit.depth);
+	index.Insert(pieces, edit.piece);
+}
+
+// @param record Gets the pieces that changed with their rectangles from before, null on redo
+static size_t ApplyCoalesce(entt::registry& pieces, PieceIndex& index, const std::vector<PieceHandle>& targets, CoalesceEdit* record)
+{
+	size_t merged = 0;
+	std::vector<SourceDestinationPair> uncoalesced;
+	for (PieceHandle piece : targets)
+	{
+		auto& sources_dests = pieces.get<PieceRectangles>(piece).sources_dests;
+		if (record)
+			uncoalesced = sources_dests;
+
+		size_t piece_merged = Piece::Coalesce(sources_dests);
+		if (piece_merged == 0)
+			continue;
+
+		if (record)
+		{
+			record->pieces.push_back(piece);
+			record->rectangle_counts.push_back(uncoalesced.size());
+			record->sources_dests.insert(record->sources_dests.end(), uncoalesced.begin(), uncoalesced.end());
+		}
+		merged += piece_merged;
+		index.UpdatePiece(pieces, piece);
+	}
+
+	return merged;
+}
+
+static void RevertCoalesce(entt::registry& pieces, PieceIndex& index, const CoalesceEdit& edit)
+{
+	size_t offset = 0;
+	for (size_t i = 0; i < edit.pieces.size(); i++)
+	{
+		auto first = edit.sources_dests.begin() + offset;
+		pieces.get<PieceRectangles>(edit.pieces[i]).sources_dests.assign(first, first + edit.rectangle_counts[i]);
+		index.UpdatePiece(pieces, edit.pieces[i]);
+		offset += edit.rectangle_counts[i];
+	}
+}
+
+static void ApplyRemove(entt::registry& pieces, PieceIndex& index, const RemoveEdit& edit)
+{
+	for (PieceHandle piece : edit.pieces)
+	{
+		index.Erase(pieces, piece);
+		PieceEntity::Remove(pieces, piece);
+	}
+}
+
+static void RevertRemove(entt::registry& pieces, PieceIndex& index, const RemoveEdit& edit)
+{
+	size_t offset = 0;
+	for (size_t i = 0; i < edit.pieces.size(); i++)
+	{
+		ImagePiece piece;
+		piece.first_piece_pos = edit.positions[i];
+		for (size_t j = offset; j < offset + edit.rectangle_counts[i]; j++)
+			Piece::AddRectangle(piece, edit.sources_dests[j]);
+		offset += edit.rectangle_counts[i];
+
+		PieceEntity::Restore(pieces, edit.pieces[i], std::move(piece), edit.depths[i]);
+		index.Insert(pieces, edit.pieces[i]);
+	}
+}
+
+EditHistory::EditHistory()
+{
+}
+
+void EditHistory::Clear()
+{
+	undo_stack.clear();
+	redo_stack.clear();
+	memory_usage = 0;
+}
+
+void EditHistory::PushMove(entt::registry& pieces, PieceHandle piece, Vector2 delta)
+{
+	Push(pieces, MoveEdit{piece, delta});
+}
+
+void EditHistory::Combine(entt::registry& pieces, PieceIndex& index, PieceHandle first, PieceHandle second, Vector2 offset, Vector2 second_position)
+{
+	CombineEdit edit;
+	edit.first = first;
+	edit.second = second;
+	edit.offset = offset;
+	edit.second_position = second_position;
+	ApplyCombine(pieces, index, edit);
+	Push(pieces, std::move(edit));
+}
+
+size_t EditHistory::Crop(entt::registry& pieces, PieceIndex& index, PieceHandle piece, int x_times, int y_times, const std::vector<Image>* skip_uniform_sources)
+{
+	CropEdit edit;
+	edit.piece = piece;
+	edit.x_times = x_times;
+	edit.y_times = y_times;
+	ApplyCrop(pieces, index, edit, skip_uniform_sources);
+	size_t skipped = edit.skipped_pieces.size();
+	Push(pieces, std::move(edit));
+	return skipped;
+}
+
+size_t EditHistory::Coalesce(entt::registry& pieces, PieceIndex& index, const std::vector<PieceHandle>& targets)
+{
+	std::vector<PieceHandle> existing_targets;
+	for (PieceHandle piece : targets)
+	{
+		if (PieceEntity::Exists(pieces, piece))
+			existing_targets.push_back(piece);
+	}
+
+	CoalesceEdit edit;
+	size_t merged = ApplyCoalesce(pieces, index, existing_targets, &edit);
+	if (merged > 0)
+		Push(pieces, std::move(edit));
+
+	return merged;
+}
+
+void EditHistory::CropRegions(entt::registry& pieces, PieceIndex& index, PieceHandle piece, std::vector<Rectangle> regions)
+{
+	CropEdit edit;
+	edit.piece = piece;
+	edit.x_times = 0;
+	edit.y_times = 0;
+	edit.regions = std::move(regions);
+	ApplyCrop(pieces, index, edit);
+	Push(pieces, std::move(edit));
+}
+
+size_t EditHistory::Remove(entt::registry& pieces, PieceIndex& index, const std::vector<PieceHandle>& targets)
+{
+	RemoveEdit edit;
+	for (PieceHandle piece : targets)
+	{
+		if (!PieceEntity::Exists(pieces, piece))
+			continue;
+
+		const auto& sources_dests = pieces.get<PieceRectangles>(piece).sources_dests;
+		edit.pieces.push_back(piece);
+		edit.positions.push_back(pieces.get<PiecePosition>(piece).value);
+		edit.depths.push_back(pieces.get<PieceDepth>(piece).value);
+		edit.rectangle_counts.push_back(sources_dests.size());
+		edit.sources_dests.insert(edit.sources_dests.end(), sources_dests.begin(), sources_dests.end());
+	}
+
+	if (edit.pieces.empty())
+		return 0;
+
+	ApplyRemove(pieces, index, edit);
+	size_t removed = edit.pieces.size();
+	Push(pieces, std::move(edit));
+	return removed;
+}
+
+bool EditHistory::Undo(entt::registry& pieces, PieceIndex& index)
+{
+	if (undo_stack.empty())
+		return false;
+
+	Edit& edit = undo_stack.back();
+	if (MoveEdit* move = std::get_if<MoveEdit>(&edit))
+		ApplyMove(pieces, index, *move, -1.0f);
+	else if (CombineEdit* combine = std::get_if<CombineEdit>(&edit))
+		RevertCombine(pieces, index, *combine);
+	else if (CropEdit* crop = std::get_if<CropEdit>(&edit))
+		RevertCrop(pieces, index, *crop);
+	else if (CoalesceEdit* coalesce = std::get_if<CoalesceEdit>(&edit))
+		RevertCoalesce(pieces, index, *coalesce);
+	else if (RemoveEdit* remove = std::get_if<RemoveEdit>(&edit))
+		RevertRemove(pieces, index, *remove);
+
+	redo_stack.emplace_back(std::move(edit));
+	undo_stack.pop_back();
+	return true;
+}
+
+bool EditHistory::Redo(entt::registry& pieces, PieceIndex& index)
+{
+	if (redo_stack.empty())
+		return false;
+
+	Edit& edit = redo_stack.back();
+	if (MoveEdit* move = std::get_if<MoveEdit>(&edit))
+		ApplyMove(pieces, index, *move, 1.0f);
+	else if (CombineEdit* combine = std::get_if<CombineEdit>(&edit))
+		ApplyCombine(pieces, index, *combine);
+	else if (CropEdit* crop = std::get_if<CropEdit>(&edit))
+		ApplyCrop(pieces, index, *crop);
+	else if (CoalesceEdit* coalesce = std::get_if<CoalesceEdit>(&edit))
+		ApplyCoalesce(pieces, index, coalesce->pieces, nullptr);
+	else if (RemoveEdit* remove = std::get_if<RemoveEdit>(&edit))
+		ApplyRemove(pieces, index, *remove);
+
+	undo_stack.emplace_back(std::move(edit));
+	redo_stack.pop_back();
+	return true;
+}
+
+size_t EditHistory::GetUndoCount() const
+{
+	return undo_stack.size();
+}
+
+size_t EditHistory::GetRedoCount() const
+{
+	return redo_stack.size();
+}
+
+size_t EditHistory::GetMemoryUsage() const
+{
+	return memory_usage;
+}
+
+void EditHistory::Push(entt::registry& pieces, Edit&& edit)
+{
+	// The pieces of an undone crop can not come back anymore
+	for (const Edit& redo_edit : redo_stack)
+	{
+		memory_usage -= GetEditSize(redo_edit);
+		if (const CropEdit* crop = std::get_if<CropEdit>(&redo_edit))
+			pieces.destroy(crop->new_pieces.begin(), crop->new_pieces.end());
+	}
+	redo_stack.clear();
+
+	undo_stack.emplace_back(std::move(edit));
+	memory_usage += GetEditSize(undo_stack.back());
+
+	while (memory_usage > MAX_HISTORY_BYTES && undo_stack.size() > 1)
+	{
+		// Neither can the pieces removed by the oldest edit
+		const Edit& oldest = undo_stack.front();
+		if (const CombineEdit* combine = std::get_if<CombineEdit>(&oldest))
+			pieces.destroy(combine->second);
+		else if (const CropEdit* crop = std::get_if<CropEdit>(&oldest))
+			pieces.destroy(crop->piece);
+		else if (const RemoveEdit* remove = std::get_if<RemoveEdit>(&oldest))
+			pieces.destroy(remove->pieces.begin(), remove->pieces.end());
+
+		memory_usage -= GetEditSize(oldest);
+		undo_stack.pop_front();
+	}
+}
+
+size_t EditHistory::GetEditSize(const Edit& edit)
+{
+	size_t size = sizeof(Edit);
+	if (const CombineEdit* combine = std::get_if<CombineEdit>(&edit))
+		size += combine->uncoalesced.capacity() * sizeof(SourceDestinationPair);
+	else if (const CropEdit* crop = std::get_if<CropEdit>(&edit))
+		size += crop->sources_dests.capacity() * sizeof(SourceDestinationPair) + crop->new_pieces.capacity() * sizeof(PieceHandle) + crop->regions.capacity() * sizeof(Rectangle) + crop->skipped_pieces.capacity() * sizeof(uint32_t);
+	else if (const CoalesceEdit* coalesce = std::get_if<CoalesceEdit>(&edit))
+		size += coalesce->pieces.capacity() * sizeof(PieceHandle) + coalesce->rectangle_counts.capacity() * sizeof(uint32_t) + coalesce->sources_dests.capacity() * sizeof(SourceDestinationPair);
+	else if (const RemoveEdit* remove = std::get_if<RemoveEdit>(&edit))
+		size += remove->pieces.capacity() * sizeof(PieceHandle) + remove->positions.capacity() * sizeof(Vector2) + remove->depths.capacity() * sizeof(uint64_t) + remove->rectangle_counts.capacity() * sizeof(uint32_t) + remove->sources_dests.capacity() * sizeof(SourceDestinationPair);
+
+	return size;
+}
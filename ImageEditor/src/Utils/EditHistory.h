@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <variant>
+#include <vector>
+#include <raylib.h>
+
+#include "Utils/PieceEntity.h"
+#include "Utils/PieceIndex.h"
+
+struct MoveEdit
+{
+	PieceHandle piece;
+	Vector2 delta;
+};
+
+// The rectangles of second are not stored, they are the last ones of first once uncoalesced is put back
+struct CombineEdit
+{
+	PieceHandle first;
+	PieceHandle second;
+	Vector2 offset; // Position of second relative to first
+	Vector2 second_position; // Before second was bound to first
+	uint64_t second_depth = 0;
+	Rectangle first_bounds = {0.0f, 0.0f, 0.0f, 0.0f}; // Local bounds of first before the combine
+	uint32_t first_rectangle_count = 0;
+	std::vector<SourceDestinationPair> uncoalesced; // Rectangles of first right after the combine, empty when coalescing merged none
+};
+
+// The new pieces are not stored, cropping is deterministic so redo crops again
+struct CropEdit
+{
+	PieceHandle piece;
+	int x_times, y_times;
+	std::vector<Rectangle> regions; // Cut out instead of a grid when not empty, relative to the piece position
+	std::vector<uint32_t> skipped_pieces; // Uniform pieces of the crop that were dropped, by index in the crop
+	Vector2 position = {0.0f, 0.0f};
+	uint64_t depth = 0;
+	std::vector<SourceDestinationPair> sources_dests;
+	std::vector<PieceHandle> new_pieces;
+	uint64_t first_new_depth = 0;
+};
+
+// Coalescing is deterministic so redo coalesces again, undo needs the rectangles from before
+struct CoalesceEdit
+{
+	std::vector<PieceHandle> pieces;
+	std::vector<uint32_t> rectangle_counts; // Of every piece before it was coalesced
+	std::vector<SourceDestinationPair> sources_dests; // Of every piece one after the other
+};
+
+// The pieces keep their handles while removed, undo gives them back their rectangles
+struct RemoveEdit
+{
+	std::vector<PieceHandle> pieces;
+	std::vector<Vector2> positions;
+	std::vector<uint64_t> depths;
+	std::vector<uint32_t> rectangle_counts;
+	std::vector<SourceDestinationPair> sources_dests; // Of every piece one after the other
+};
+
+using Edit = std::variant<MoveEdit, CombineEdit, CropEdit, CoalesceEdit, RemoveEdit>;
+
+// Undo and redo stacks of the edits done to the pieces
+// Edits only store what changed, so undo and redo are O(size of the edit)
+// Pieces removed by an edit keep their handle until no edit can bring them back, so later edits stay valid
+class EditHistory
+{
+public:
+	EditHistory();
+
+	// Forgets every edit, only call it after the pieces have been cleared
+	void Clear();
+
+	// Records a move that has already been done
+	void PushMove(entt::registry& pieces, PieceHandle piece, Vector2 delta);
+	// Appends the rectangles of second to first, coalesces them, then removes second
+	// @param second_position Position of second before it was bound to first, restored by undo
+	void Combine(entt::registry& pieces, PieceIndex& index, PieceHandle first, PieceHandle second, Vector2 offset, Vector2 second_position);
+	// Replaces the piece with the pieces of a x_times * y_times grid
+	// @param skip_uniform_sources When given, the cells that are fully transparent or of a single colour in these images are dropped
+	// @return How many cells were dropped
+	size_t Crop(entt::registry& pieces, PieceIndex& index, PieceHandle piece, int x_times, int y_times, const std::vector<Image>* skip_uniform_sources = nullptr);
+	// Replaces the piece with one piece per region, see Piece::CropRegions
+	void CropRegions(entt::registry& pieces, PieceIndex& index, PieceHandle piece, std::vector<Rectangle> regions);
+	// Coalesces the rectangles of the pieces, only recorded when some were merged
+	// @return How many rectangles were removed
+	size_t Coalesce(entt::registry& pieces, PieceIndex& index, const std::vector<PieceHandle>& targets);
+	// Removes the pieces, the ones that do not exist are ignored
+	// @return How many pieces were removed
+	size_t Remove(entt::registry& pieces, PieceIndex& index, const std::vector<PieceHandle>& targets);
+
+	// @return false when there is nothing to undo
+	bool Undo(entt::registry& pieces, PieceIndex& index);
+	// @return false when there is nothing to redo
+	bool Redo(entt::registry& pieces, PieceIndex& index);
+
+	size_t GetUndoCount() const;
+	size_t GetRedoCount() const;
+	// Bytes used by both stacks
+	size_t GetMemoryUsage() const;
+
+private:
+	void Push(entt::registry& pieces, Edit&& edit);
+	static size_t GetEditSize(const Edit& edit);
+
+private:
+	std::deque<Edit> undo_stack;
+	std::vector<Edit> redo_stack;
+	size_t memory_usage = 0;
+};
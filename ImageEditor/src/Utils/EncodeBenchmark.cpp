@@ -0,0 +1,212 @@
+#include "EncodeBenchmark.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+#include <raylib.h>
+
+#include "Utils/PieceExporter.h"
+
+// Part of the stb_image_write bundled in raylib, ExportImage writes PNGs with it, the result is allocated with malloc
+extern "C" unsigned char* stbi_write_png_to_mem(const unsigned char* pixels, int stride_bytes, int x, int y, int n, int* out_len);
+
+// Sprites of the synthetic sheet are this many pixels apart, a quarter of the cells are left transparent
+#define SPRITE_CELL_SIZE 64
+
+namespace EncodeBenchmark
+{
+	struct BenchmarkOptions
+	{
+		std::string image_path;
+		int size = 1024;
+		int runs = 3;
+	};
+
+	struct EncoderCase
+	{
+		std::string name;
+		ExportOptions options;
+		bool is_stb = false; // Baseline, options are ignored
+	};
+
+	bool IsRequested(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--bench-encode") == 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	static bool ParseOptions(int argc, char** argv, BenchmarkOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--bench-encode")
+				continue;
+			else if (arg == "--image" && i + 1 < argc)
+				options.image_path = argv[++i];
+			else if (arg == "--size" && i + 1 < argc)
+				options.size = atoi(argv[++i]);
+			else if (arg == "--runs" && i + 1 < argc)
+				options.runs = atoi(argv[++i]);
+			else
+			{
+				Logger::Error("Unknown or incomplete argument '{}'", arg);
+				return false;
+			}
+		}
+
+		if (options.size < 1 || options.runs < 1)
+		{
+			Logger::Error("Size and run count must be greater than 0");
+			return false;
+		}
+
+		return true;
+	}
+
+	// Noise for the texture of the sprites, with round holes and empty cells so runs of transparent pixels are as common as in real sheets
+	static Image MakeSpriteSheet(int size)
+	{
+		Image image = GenImagePerlinNoise(size, size, 0, 0, 8.0f);
+		ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+		unsigned char* pixels = (unsigned char*)image.data;
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				unsigned char* pixel = pixels + ((size_t)y * size + x) * 4;
+				int cell = (y / SPRITE_CELL_SIZE) * (size / SPRITE_CELL_SIZE + 1) + x / SPRITE_CELL_SIZE;
+				float dx = (float)(x % SPRITE_CELL_SIZE) - SPRITE_CELL_SIZE / 2;
+				float dy = (float)(y % SPRITE_CELL_SIZE) - SPRITE_CELL_SIZE / 2;
+				bool is_sprite = cell % 4 != 3 && sqrtf(dx * dx + dy * dy) < SPRITE_CELL_SIZE * 0.45f;
+				if (is_sprite)
+				{
+					// Tinted by cell so the colours are not all grey
+					pixel[0] = (unsigned char)(pixel[0] * ((cell * 37) % 256) / 255);
+					pixel[2] = (unsigned char)(pixel[2] * ((cell * 91) % 256) / 255);
+				}
+				else
+					memset(pixel, 0, 4);
+			}
+		}
+
+		return image;
+	}
+
+	static std::vector<EncoderCase> GetEncoderCases()
+	{
+		static const char* FILTER_NAMES[] = {"adaptive", "none", "sub", "up", "average", "paeth"};
+
+		std::vector<EncoderCase> cases;
+		EncoderCase stb = {"stb_image_write", ExportOptions(), true};
+		cases.push_back(stb);
+
+		EncoderCase qoi = {"QOI", ExportOptions()};
+		qoi.options.format = ExportFormat::QOI;
+		cases.push_back(qoi);
+
+		// Same settings on one thread then on every core, shows how the encoding scales
+		EncoderCase single_thread = {"PNG level 6 adaptive, 1 thread", ExportOptions()};
+		single_thread.options.jobs = 1;
+		cases.push_back(single_thread);
+
+		for (int level : {0, 1, 6, 9})
+		{
+			for (int filter = -1; filter <= 4; filter++)
+			{
+				// Filters are compared at the default level only
+				if (level != 6 && filter >= 0)
+					continue;
+
+				EncoderCase png = {fmt::format("PNG level {} {}", level, FILTER_NAMES[filter + 1]), ExportOptions()};
+				png.options.png_compression_level = level;
+				png.options.png_filter = filter;
+				cases.push_back(png);
+			}
+		}
+
+		return cases;
+	}
+
+	static bool IsRoundTrip(const Image& image, const unsigned char* data, int size, ExportFormat format)
+	{
+		Image decoded = LoadImageFromMemory(format == ExportFormat::QOI ? ".qoi" : ".png", data, size);
+		bool is_same = IsImageReady(decoded) && decoded.width == image.width && decoded.height == image.height && decoded.format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 &&
+			memcmp(decoded.data, image.data, (size_t)image.width * image.height * 4) == 0;
+		UnloadImage(decoded);
+
+		return is_same;
+	}
+
+	int Run(int argc, char** argv)
+	{
+		BenchmarkOptions options;
+		if (!ParseOptions(argc, argv, options))
+			return 1;
+
+		SetTraceLogLevel(LOG_WARNING);
+
+		Image image;
+		if (options.image_path.empty())
+			image = MakeSpriteSheet(options.size);
+		else
+		{
+			image = LoadImage(options.image_path.c_str());
+			if (!IsImageReady(image))
+			{
+				Logger::Error("Could not load '{}'", options.image_path);
+				return 1;
+			}
+			ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+		}
+
+		size_t raw_size = (size_t)image.width * image.height * 4;
+		Logger::Info("Encoding a {}x{} image, best of {} runs, PNGs use {} threads unless told otherwise", image.width, image.height, options.runs, std::max(1u, std::thread::hardware_concurrency()));
+
+		int exit_code = 0;
+		for (const EncoderCase& encoder : GetEncoderCases())
+		{
+			float best = INFINITY;
+			int size = 0;
+			unsigned char* data = nullptr;
+			for (int run = 0; run < options.runs; run++)
+			{
+				free(data);
+				auto start = std::chrono::steady_clock::now();
+				if (encoder.is_stb)
+					data = stbi_write_png_to_mem((const unsigned char*)image.data, image.width * 4, image.width, image.height, 4, &size);
+				else
+					data = PieceExporter::Encode((const unsigned char*)image.data, (size_t)image.width * 4, image.width, image.height, encoder.options, &size);
+				best = std::min(best, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+			}
+
+			if (!data || !IsRoundTrip(image, data, size, encoder.options.format))
+			{
+				Logger::Error("{}: the encoded image does not decode to the same pixels", encoder.name);
+				exit_code = 1;
+			}
+			else
+				Logger::Info("{:<36} {:8.1f} ms {:8.1f} MB/s {:10} bytes {:5.1f}%", encoder.name, best, raw_size / (1024.0f * 1024.0f) / (std::max(best, 0.001f) / 1000.0f), size, size * 100.0f / raw_size);
+			free(data);
+		}
+
+		UnloadImage(image);
+		return exit_code;
+	}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+namespace EncodeBenchmark
+{
+	// True when the command line asks for the encoder benchmark (--bench-encode)
+	bool IsRequested(int argc, char** argv);
+
+	// Encodes an image with stb_image_write, QOI and the parallel PNG encoder at a few levels and filters, then prints the time and size of each
+	// Without --image a synthetic sheet of noisy sprites on a transparent background is used
+	// Usage: --bench-encode [--image in.png] [--size 1024] [--runs 3]
+	// @return process exit code, 1 if an encoded image does not decode back to the same pixels
+	int Run(int argc, char** argv);
+}
@@ -0,0 +1,678 @@
+#include "ImagePiece.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <tuple>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Edges closer than this are considered touching, crops leave some float drift on the cell edges
+#define COALESCE_EPSILON 0.01f
+// Smaller grids are cropped on the calling thread, starting workers would cost more than the crop
+#define CROP_PARALLEL_CELLS 1024
+
+namespace Piece
+{
+	static bool IsNear(float a, float b)
+	{
+		return fabsf(a - b) < COALESCE_EPSILON;
+	}
+
+	// Groups values that are near each other when sorting, values right between two steps only miss a merge
+	static long Quantize(float value)
+	{
+		return lroundf(value * 16.0f);
+	}
+
+	// Position and size along the axis rectangles are merged on, and across it
+	static float Start(const Rectangle& rect, bool vertical) { return vertical ? rect.y : rect.x; }
+	static float Length(const Rectangle& rect, bool vertical) { return vertical ? rect.height : rect.width; }
+	static float CrossStart(const Rectangle& rect, bool vertical) { return vertical ? rect.x : rect.y; }
+	static float CrossLength(const Rectangle& rect, bool vertical) { return vertical ? rect.width : rect.height; }
+
+	static bool Overlaps(const Rectangle& a, const Rectangle& b)
+	{
+		float overlap_x = std::min(a.x + a.width, b.x + b.width) - std::max(a.x, b.x);
+		float overlap_y = std::min(a.y + a.height, b.y + b.height) - std::max(a.y, b.y);
+		return overlap_x > COALESCE_EPSILON && overlap_y > COALESCE_EPSILON;
+	}
+
+	static Rectangle Union(const Rectangle& a, const Rectangle& b)
+	{
+		float left = std::min(a.x, b.x);
+		float top = std::min(a.y, b.y);
+		float right = std::max(a.x + a.width, b.x + b.width);
+		float bottom = std::max(a.y + a.height, b.y + b.height);
+		return {left, top, right - left, bottom - top};
+	}
+
+	// True when b continues a along the axis with the same scale, a being the one on the left or top
+	static bool CanMerge(const SourceDestinationPair& a, const SourceDestinationPair& b, bool vertical)
+	{
+		if (a.image != b.image)
+			return false;
+
+		float a_length = Length(a.destination, vertical);
+		float b_length = Length(b.destination, vertical);
+		if (a_length <= 0.0f || b_length <= 0.0f || Length(a.source, vertical) <= 0.0f || Length(b.source, vertical) <= 0.0f)
+			return false;
+
+		return IsNear(CrossStart(a.destination, vertical), CrossStart(b.destination, vertical)) &&
+			IsNear(CrossLength(a.destination, vertical), CrossLength(b.destination, vertical)) &&
+			IsNear(CrossStart(a.source, vertical), CrossStart(b.source, vertical)) &&
+			IsNear(CrossLength(a.source, vertical), CrossLength(b.source, vertical)) &&
+			IsNear(Start(a.destination, vertical) + a_length, Start(b.destination, vertical)) &&
+			IsNear(Start(a.source, vertical) + Length(a.source, vertical), Start(b.source, vertical)) &&
+			fabsf(Length(a.source, vertical) / a_length - Length(b.source, vertical) / b_length) < 0.0001f;
+	}
+
+	// Sweep over the rectangles sorted by left edge, most pieces have none and skip the draw order checks
+	static bool HasOverlaps(const std::vector<SourceDestinationPair>& sources_dests)
+	{
+		std::vector<uint32_t> order(sources_dests.size());
+		for (uint32_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sources_dests[a].destination.x < sources_dests[b].destination.x; });
+
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			const Rectangle& rect = sources_dests[order[i]].destination;
+			for (size_t j = i + 1; j < order.size() && sources_dests[order[j]].destination.x < rect.x + rect.width - COALESCE_EPSILON; j++)
+			{
+				if (Overlaps(rect, sources_dests[order[j]].destination))
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	// First and last grid cells a span may touch, widened by one so that the exact test decides on the edges
+	static void GetCellRange(float start, float length, float origin, float cell_size, int cell_count, int& first, int& last)
+	{
+		first = 0;
+		last = cell_count - 1;
+		if (!(cell_size > 0.0f))
+			return;
+
+		float first_cell = floorf((start - origin) / cell_size) - 1.0f;
+		float last_cell = floorf((start + length - origin) / cell_size) + 1.0f;
+		if (first_cell > 0.0f)
+			first = first_cell < (float)cell_count ? (int)first_cell : cell_count - 1;
+		if (last_cell < (float)(cell_count - 1))
+			last = last_cell > 0.0f ? (int)last_cell : 0;
+	}
+
+	// Uniform grid over the destinations of a piece that has overlaps, about one rectangle per cell,
+	// so the draw order checks only look at the rectangles around a merge
+	// It is only built once a merge needs it, a merged rectangle is then added to the cells of the one it absorbed
+	struct OverlapGrid
+	{
+		bool is_built = false;
+		Rectangle bounds = {0.0f, 0.0f, 0.0f, 0.0f};
+		Vector2 cell_size = {0.0f, 0.0f};
+		int columns = 1, rows = 1;
+		std::vector<std::vector<uint32_t>> cells;
+
+		OverlapGrid(size_t rectangle_count)
+		{
+			columns = rows = std::max((int)ceilf(sqrtf((float)rectangle_count)), 1);
+		}
+
+		void Build(const std::vector<SourceDestinationPair>& sources_dests, const std::vector<bool>& removed)
+		{
+			bounds = sources_dests[0].destination;
+			for (const SourceDestinationPair& source_dest : sources_dests)
+				bounds = Union(bounds, source_dest.destination);
+
+			cell_size = {bounds.width / columns, bounds.height / rows};
+			cells.assign((size_t)columns * rows, {});
+			is_built = true;
+			for (uint32_t i = 0; i < sources_dests.size(); i++)
+			{
+				if (!removed[i])
+					Add(i, sources_dests[i].destination);
+			}
+		}
+
+		void GetRange(const Rectangle& rect, int range[4]) const
+		{
+			GetCellRange(rect.x, rect.width, bounds.x, cell_size.x, columns, range[0], range[1]);
+			GetCellRange(rect.y, rect.height, bounds.y, cell_size.y, rows, range[2], range[3]);
+		}
+
+		void Add(uint32_t index, const Rectangle& rect)
+		{
+			if (!is_built)
+				return;
+
+			int range[4];
+			GetRange(rect, range);
+			for (int y = range[2]; y <= range[3]; y++)
+			{
+				for (int x = range[0]; x <= range[1]; x++)
+					cells[(size_t)y * columns + x].push_back(index);
+			}
+		}
+	};
+
+	// Moving the later of the two rectangles to the place of the first must not draw it under a rectangle it was covering
+	static bool KeepsDrawOrder(const std::vector<SourceDestinationPair>& sources_dests, const std::vector<bool>& removed, OverlapGrid& grid, uint32_t a, uint32_t b)
+	{
+		uint32_t first = std::min(a, b);
+		uint32_t second = std::max(a, b);
+		const Rectangle& moved = sources_dests[second].destination;
+
+		// Rectangles close to each other in the piece are quicker to check directly than through the cells they span
+		size_t cell_count = (size_t)grid.columns;
+		int range[4];
+		if (second - first > cell_count)
+		{
+			if (!grid.is_built)
+				grid.Build(sources_dests, removed);
+			grid.GetRange(moved, range);
+			cell_count = (size_t)(range[1] - range[0] + 1) * (range[3] - range[2] + 1);
+		}
+
+		if (second - first <= cell_count)
+		{
+			for (uint32_t i = first + 1; i < second; i++)
+			{
+				if (!removed[i] && Overlaps(sources_dests[i].destination, moved))
+					return false;
+			}
+			return true;
+		}
+
+		for (int y = range[2]; y <= range[3]; y++)
+		{
+			for (int x = range[0]; x <= range[1]; x++)
+			{
+				for (uint32_t i : grid.cells[(size_t)y * grid.columns + x])
+				{
+					if (i > first && i < second && !removed[i] && Overlaps(sources_dests[i].destination, moved))
+						return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// Merges the runs of rectangles that follow each other along one axis
+	// @param draw_order_grid nullptr when no rectangles overlap, so the draw order can not change
+	static size_t CoalesceAxis(std::vector<SourceDestinationPair>& sources_dests, std::vector<bool>& removed, bool vertical, OverlapGrid* draw_order_grid)
+	{
+		std::vector<uint32_t> order;
+		for (uint32_t i = 0; i < sources_dests.size(); i++)
+		{
+			if (!removed[i])
+				order.push_back(i);
+		}
+
+		// Rectangles that can merge end up next to each other, sorted along the axis
+		auto sort_key = [&](uint32_t i)
+		{
+			const SourceDestinationPair& source_dest = sources_dests[i];
+			return std::make_tuple(source_dest.image,
+				Quantize(CrossStart(source_dest.destination, vertical)), Quantize(CrossLength(source_dest.destination, vertical)),
+				Quantize(CrossStart(source_dest.source, vertical)), Quantize(CrossLength(source_dest.source, vertical)),
+				Start(source_dest.destination, vertical), i);
+		};
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sort_key(a) < sort_key(b); });
+
+		size_t merged = 0;
+		for (size_t run = 0; run < order.size();)
+		{
+			uint32_t target = order[run];
+			size_t next = run + 1;
+			for (; next < order.size(); next++)
+			{
+				uint32_t candidate = order[next];
+				if (!CanMerge(sources_dests[target], sources_dests[candidate], vertical))
+					break;
+				if (draw_order_grid && !KeepsDrawOrder(sources_dests, removed, *draw_order_grid, target, candidate))
+					break;
+
+				// The merged rectangle takes the place of the one drawn first
+				uint32_t first = std::min(target, candidate);
+				uint32_t second = std::max(target, candidate);
+				sources_dests[first].source = Union(sources_dests[target].source, sources_dests[candidate].source);
+				sources_dests[first].destination = Union(sources_dests[target].destination, sources_dests[candidate].destination);
+				removed[second] = true;
+				if (draw_order_grid)
+					draw_order_grid->Add(first, sources_dests[second].destination);
+				target = first;
+				merged++;
+			}
+			run = next;
+		}
+
+		return merged;
+	}
+
+	Rectangle GetBounds(const ImagePiece& piece)
+	{
+#ifdef _DEBUG
+		static bool reported_mismatch = false;
+		Rectangle computed = ComputeBounds(piece);
+		bool matches = fabsf(computed.x - piece.bounds.x) < 0.01f && fabsf(computed.y - piece.bounds.y) < 0.01f && fabsf(computed.width - piece.bounds.width) < 0.01f && fabsf(computed.height - piece.bounds.height) < 0.01f;
+		if (!reported_mismatch && !piece.sources_dests.empty() && !matches)
+		{
+			reported_mismatch = true;
+			LOG_ERROR("Cached piece bounds {} {} {} {} differ from computed {} {} {} {}", piece.bounds.x, piece.bounds.y, piece.bounds.width, piece.bounds.height, computed.x, computed.y, computed.width, computed.height);
+		}
+#endif
+
+		return piece.bounds;
+	}
+
+	Rectangle ComputeBounds(const ImagePiece& piece)
+	{
+		float top = MAXFLOAT;
+		float bottom = -MAXFLOAT;
+		float left = MAXFLOAT;
+		float right = -MAXFLOAT;
+		for (auto& [source, dest, image]: piece.sources_dests)
+		{
+			if (dest.x < left)
+				left = dest.x;
+			if (dest.y < top)
+				top = dest.y;
+			if (dest.x + dest.width > right)
+				right = dest.x + dest.width;
+			if (dest.y + dest.height > bottom)
+				bottom = dest.y + dest.height;
+		}
+
+		return {left, top, right - left, bottom - top};
+	}
+
+	void AddRectangle(ImagePiece& piece, const SourceDestinationPair& source_dest)
+	{
+		const Rectangle& dest = source_dest.destination;
+		if (piece.sources_dests.empty())
+			piece.bounds = dest;
+		else
+		{
+			float left = std::min(piece.bounds.x, dest.x);
+			float top = std::min(piece.bounds.y, dest.y);
+			float right = std::max(piece.bounds.x + piece.bounds.width, dest.x + dest.width);
+			float bottom = std::max(piece.bounds.y + piece.bounds.height, dest.y + dest.height);
+			piece.bounds = {left, top, right - left, bottom - top};
+		}
+
+		piece.sources_dests.emplace_back(source_dest);
+	}
+
+	// @param candidates Indices of the rectangles that may overlap the cell, in the order of the piece
+	static void CropCell(const ImagePiece& piece, Rectangle new_piece_bounds, const uint32_t* candidates, size_t candidate_count, std::vector<ImagePiece>& result)
+	{
+		ImagePiece new_piece;
+		new_piece.first_piece_pos.x = new_piece_bounds.x;
+		new_piece.first_piece_pos.y = new_piece_bounds.y;
+
+		for (size_t i = 0; i < candidate_count; i++)
+		{
+			auto [source, dest, image] = piece.sources_dests[candidates[i]];
+			dest.x += piece.first_piece_pos.x;
+			dest.y += piece.first_piece_pos.y;
+			if (CheckCollisionRecs(dest, new_piece_bounds))
+			{
+				SourceDestinationPair new_source_dest_pair;
+				new_source_dest_pair.image = image;
+
+				Rectangle collision_area = GetCollisionRec(dest, new_piece_bounds);
+
+				new_source_dest_pair.source.x = source.x + collision_area.x - dest.x;
+				new_source_dest_pair.source.y = source.y + collision_area.y - dest.y;
+				new_source_dest_pair.source.width = collision_area.width;
+				new_source_dest_pair.source.height = collision_area.height;
+
+				new_source_dest_pair.destination.x = collision_area.x - new_piece_bounds.x;
+				new_source_dest_pair.destination.y = collision_area.y - new_piece_bounds.y;
+				new_source_dest_pair.destination.width= collision_area.width;
+				new_source_dest_pair.destination.height = collision_area.height;
+
+				AddRectangle(new_piece, new_source_dest_pair);
+			}
+		}
+
+		if (!new_piece.sources_dests.empty())
+		{
+			Coalesce(new_piece.sources_dests);
+			result.emplace_back(std::move(new_piece));
+		}
+	}
+
+	std::vector<ImagePiece> Crop(const ImagePiece& piece, int x_times, int y_times, unsigned int jobs)
+	{
+		std::vector<ImagePiece> result;
+		if (x_times < 1 || y_times < 1)
+			return result;
+
+		Rectangle piece_bounds = GetBounds(piece);
+		piece_bounds.x += piece.first_piece_pos.x;
+		piece_bounds.y += piece.first_piece_pos.y;
+		Vector2 new_piece_size = {piece_bounds.width / x_times, piece_bounds.height / y_times};
+
+		// Every rectangle is bucketed in the cells it may overlap (counted, then filled in place),
+		// so a cell only tests its own rectangles instead of every rectangle of the piece
+		size_t cell_count = (size_t)x_times * y_times;
+		std::vector<uint32_t> cell_starts(cell_count + 1, 0);
+		std::vector<int> ranges(piece.sources_dests.size() * 4);
+		for (size_t i = 0; i < piece.sources_dests.size(); i++)
+		{
+			const Rectangle& dest = piece.sources_dests[i].destination;
+			int* range = &ranges[i * 4];
+			GetCellRange(dest.x + piece.first_piece_pos.x, dest.width, piece_bounds.x, new_piece_size.x, x_times, range[0], range[1]);
+			GetCellRange(dest.y + piece.first_piece_pos.y, dest.height, piece_bounds.y, new_piece_size.y, y_times, range[2], range[3]);
+			for (int y = range[2]; y <= range[3]; y++)
+			{
+				for (int x = range[0]; x <= range[1]; x++)
+					cell_starts[(size_t)y * x_times + x + 1]++;
+			}
+		}
+		for (size_t cell = 0; cell < cell_count; cell++)
+			cell_starts[cell + 1] += cell_starts[cell];
+
+		std::vector<uint32_t> cell_rectangles(cell_starts[cell_count]);
+		std::vector<uint32_t> cell_fill(cell_starts.begin(), cell_starts.end() - 1);
+		for (uint32_t i = 0; i < piece.sources_dests.size(); i++)
+		{
+			const int* range = &ranges[i * 4];
+			for (int y = range[2]; y <= range[3]; y++)
+			{
+				for (int x = range[0]; x <= range[1]; x++)
+					cell_rectangles[cell_fill[(size_t)y * x_times + x]++] = i;
+			}
+		}
+
+		// Rows are cropped on a worker pool, each into its own list so that the pieces keep the row-major order once merged
+		std::vector<std::vector<ImagePiece>> row_pieces(y_times);
+		std::atomic<int> next_row = 0;
+		auto crop_rows = [&]()
+		{
+			for (int y = next_row++; y < y_times; y = next_row++)
+			{
+				for (int x = 0; x < x_times; x++)
+				{
+					size_t cell = (size_t)y * x_times + x;
+					Rectangle new_piece_bounds = {piece_bounds.x + x * new_piece_size.x, piece_bounds.y + y * new_piece_size.y, new_piece_size.x, new_piece_size.y};
+					CropCell(piece, new_piece_bounds, cell_rectangles.data() + cell_starts[cell], cell_starts[cell + 1] - cell_starts[cell], row_pieces[y]);
+				}
+			}
+		};
+
+		if (jobs == 0)
+			jobs = cell_count < CROP_PARALLEL_CELLS ? 1 : std::thread::hardware_concurrency();
+		jobs = std::max(1u, std::min(jobs, (unsigned int)y_times));
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < jobs; i++)
+			workers.emplace_back(crop_rows);
+		crop_rows();
+		for (std::thread& worker : workers)
+			worker.join();
+
+		size_t piece_count = 0;
+		for (const std::vector<ImagePiece>& pieces : row_pieces)
+			piece_count += pieces.size();
+		result.reserve(piece_count);
+		for (std::vector<ImagePiece>& pieces : row_pieces)
+			std::move(pieces.begin(), pieces.end(), std::back_inserter(result));
+
+		return result;
+	}
+
+	std::vector<ImagePiece> CropRegions(const ImagePiece& piece, const std::vector<Rectangle>& regions)
+	{
+		std::vector<ImagePiece> result;
+		std::vector<uint32_t> candidates;
+		for (const Rectangle& region : regions)
+		{
+			Rectangle new_piece_bounds = {region.x + piece.first_piece_pos.x, region.y + piece.first_piece_pos.y, region.width, region.height};
+
+			candidates.clear();
+			for (uint32_t i = 0; i < piece.sources_dests.size(); i++)
+			{
+				Rectangle dest = piece.sources_dests[i].destination;
+				dest.x += piece.first_piece_pos.x;
+				dest.y += piece.first_piece_pos.y;
+				if (CheckCollisionRecs(dest, new_piece_bounds))
+					candidates.push_back(i);
+			}
+
+			CropCell(piece, new_piece_bounds, candidates.data(), candidates.size(), result);
+		}
+
+		return result;
+	}
+
+	// Pixels of a source copied by one rectangle when composing a piece of width * height pixels
+	struct PixelCopy
+	{
+		int src_x, src_y;
+		int dst_x, dst_y;
+		int width, height;
+	};
+
+	// @return false when the rectangle does not copy any pixel
+	static bool GetPixelCopy(const Image& source, const Rectangle& src, const Rectangle& dest, const Rectangle& bounds, int width, int height, PixelCopy& copy)
+	{
+		// Rounding both edges keeps neighbouring rectangles from leaving gaps or overlapping
+		copy.src_x = (int)roundf(src.x);
+		copy.src_y = (int)roundf(src.y);
+		copy.dst_x = (int)roundf(dest.x - bounds.x);
+		copy.dst_y = (int)roundf(dest.y - bounds.y);
+		copy.width = (int)roundf(dest.x - bounds.x + dest.width) - copy.dst_x;
+		copy.height = (int)roundf(dest.y - bounds.y + dest.height) - copy.dst_y;
+
+		if (copy.src_x < 0) { copy.width += copy.src_x; copy.dst_x -= copy.src_x; copy.src_x = 0; }
+		if (copy.src_y < 0) { copy.height += copy.src_y; copy.dst_y -= copy.src_y; copy.src_y = 0; }
+		if (copy.dst_x < 0) { copy.width += copy.dst_x; copy.src_x -= copy.dst_x; copy.dst_x = 0; }
+		if (copy.dst_y < 0) { copy.height += copy.dst_y; copy.src_y -= copy.dst_y; copy.dst_y = 0; }
+		copy.width = std::min({copy.width, source.width - copy.src_x, width - copy.dst_x});
+		copy.height = std::min({copy.height, source.height - copy.src_y, height - copy.dst_y});
+		return copy.width > 0 && copy.height > 0;
+	}
+
+	// Clears is_transparent and is_single_colour as soon as a pixel of the row disproves them
+	static void ScanUniformRow(const uint32_t* row, int width, uint32_t colour, bool& is_transparent, bool& is_single_colour)
+	{
+		int x = 0;
+#ifdef __SSE2__
+		// 4 pixels per iteration, compared to the colour and masked to their alpha at once
+		const __m128i colours = _mm_set1_epi32((int)colour);
+		const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 4 <= width && (is_transparent || is_single_colour); x += 4)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)(row + x));
+			is_single_colour = is_single_colour && _mm_movemask_epi8(_mm_cmpeq_epi32(pixels, colours)) == 0xFFFF;
+			is_transparent = is_transparent && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(pixels, alpha_mask), zero)) == 0xFFFF;
+		}
+#endif
+		for (; x < width && (is_transparent || is_single_colour); x++)
+		{
+			is_single_colour = is_single_colour && row[x] == colour;
+			is_transparent = is_transparent && (row[x] & 0xFF000000) == 0;
+		}
+	}
+
+	// Area of the union of the copies in the composed image, the pixels of overlapping copies are counted once
+	static size_t GetCoveredArea(const std::vector<PixelCopy>& copies)
+	{
+		std::vector<int> edges;
+		for (const PixelCopy& copy : copies)
+		{
+			edges.push_back(copy.dst_y);
+			edges.push_back(copy.dst_y + copy.height);
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		// Between two consecutive edges every copy spans the whole band or none of it, so the band is covered by the union of their columns
+		size_t area = 0;
+		std::vector<std::pair<int, int>> spans;
+		for (size_t i = 0; i + 1 < edges.size(); i++)
+		{
+			spans.clear();
+			for (const PixelCopy& copy : copies)
+			{
+				if (copy.dst_y <= edges[i] && copy.dst_y + copy.height >= edges[i + 1])
+					spans.push_back({copy.dst_x, copy.dst_x + copy.width});
+			}
+			std::sort(spans.begin(), spans.end());
+
+			size_t covered_columns = 0;
+			int end = INT_MIN;
+			for (auto& [first, last] : spans)
+			{
+				if (last <= end)
+					continue;
+				covered_columns += last - std::max(first, end);
+				end = last;
+			}
+			area += covered_columns * (edges[i + 1] - edges[i]);
+		}
+
+		return area;
+	}
+
+	bool IsUniform(const std::vector<Image>& sources, const ImagePiece& piece)
+	{
+		Rectangle bounds = GetBounds(piece);
+		int width = (int)roundf(bounds.width);
+		int height = (int)roundf(bounds.height);
+
+		bool is_transparent = true;
+		bool is_single_colour = true;
+		bool has_colour = false;
+		uint32_t colour = 0;
+		std::vector<PixelCopy> copies;
+		for (auto& [src, dest, image] : piece.sources_dests)
+		{
+			if (image >= sources.size() || !IsImageReady(sources[image]))
+				continue;
+
+			const Image& source = sources[image];
+			PixelCopy copy;
+			if (!GetPixelCopy(source, src, dest, bounds, width, height, copy))
+				continue;
+
+			const uint32_t* pixels = (const uint32_t*)source.data;
+			if (!has_colour)
+			{
+				colour = pixels[(size_t)copy.src_y * source.width + copy.src_x];
+				has_colour = true;
+			}
+
+			for (int row = 0; row < copy.height && (is_transparent || is_single_colour); row++)
+				ScanUniformRow(pixels + (size_t)(copy.src_y + row) * source.width + copy.src_x, copy.width, colour, is_transparent, is_single_colour);
+			copies.push_back(copy);
+		}
+
+		// What the rectangles leave uncovered is transparent once composed, including the rectangles of missing images
+		if (is_single_colour && colour != 0 && GetCoveredArea(copies) < (size_t)width * height)
+			is_single_colour = false;
+
+		return is_transparent || is_single_colour;
+	}
+
+	std::vector<uint32_t> FindUniformPieces(const std::vector<Image>& sources, const std::vector<ImagePiece>& pieces)
+	{
+		std::vector<uint8_t> is_uniform(pieces.size(), 0);
+		std::atomic<size_t> next_piece = 0;
+		auto check_pieces = [&]()
+		{
+			for (size_t i = next_piece++; i < pieces.size(); i = next_piece++)
+				is_uniform[i] = IsUniform(sources, pieces[i]);
+		};
+
+		unsigned int jobs = std::max(1u, std::min(std::thread::hardware_concurrency(), (unsigned int)(pieces.size() / 64)));
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < jobs; i++)
+			workers.emplace_back(check_pieces);
+		check_pieces();
+		for (std::thread& worker : workers)
+			worker.join();
+
+		std::vector<uint32_t> result;
+		for (uint32_t i = 0; i < pieces.size(); i++)
+		{
+			if (is_uniform[i])
+				result.push_back(i);
+		}
+
+		return result;
+	}
+
+	Image Compose(const std::vector<Image>& sources, const ImagePiece& piece)
+	{
+		Rectangle bounds = GetBounds(piece);
+		int width = (int)roundf(bounds.width);
+		int height = (int)roundf(bounds.height);
+		Image result = GenImageColor(width, height, BLANK);
+
+		unsigned char* dst_pixels = (unsigned char*)result.data;
+		for (auto& [src, dest, image] : piece.sources_dests)
+		{
+			if (image >= sources.size() || !IsImageReady(sources[image]))
+				continue;
+
+			const Image& source = sources[image];
+			const unsigned char* src_pixels = (const unsigned char*)source.data;
+
+			PixelCopy copy;
+			if (!GetPixelCopy(source, src, dest, bounds, width, height, copy))
+				continue;
+
+			for (int row = 0; row < copy.height; row++)
+			{
+				const unsigned char* src_row = src_pixels + ((size_t)(copy.src_y + row) * source.width + copy.src_x) * 4;
+				unsigned char* dst_row = dst_pixels + ((size_t)(copy.dst_y + row) * width + copy.dst_x) * 4;
+				memcpy(dst_row, src_row, (size_t)copy.width * 4);
+			}
+		}
+
+		return result;
+	}
+
+	size_t Coalesce(std::vector<SourceDestinationPair>& sources_dests)
+	{
+		if (sources_dests.size() < 2)
+			return 0;
+
+		// Merges never make new overlaps, so this only has to be known once
+		OverlapGrid grid(sources_dests.size());
+		OverlapGrid* draw_order_grid = HasOverlaps(sources_dests) ? &grid : nullptr;
+		std::vector<bool> removed(sources_dests.size(), false);
+
+		// Rows merged horizontally can then merge vertically and the other way around
+		size_t total_merged = 0;
+		for (size_t merged = 1; merged > 0; total_merged += merged)
+			merged = CoalesceAxis(sources_dests, removed, false, draw_order_grid) + CoalesceAxis(sources_dests, removed, true, draw_order_grid);
+
+		if (total_merged > 0)
+		{
+			size_t kept = 0;
+			for (size_t i = 0; i < sources_dests.size(); i++)
+			{
+				if (!removed[i])
+					sources_dests[kept++] = sources_dests[i];
+			}
+			sources_dests.resize(kept);
+		}
+
+		return total_merged;
+	}
+}
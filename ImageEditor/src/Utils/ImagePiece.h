@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <raylib.h>
+
+struct SourceDestinationPair
+{
+	Rectangle source;
+	Rectangle destination;
+	uint32_t image = 0; // Index of the source in the document image table
+};
+
+struct ImagePiece
+{
+	std::vector<SourceDestinationPair> sources_dests;
+	Vector2 first_piece_pos;
+	Rectangle bounds = {0.0f, 0.0f, 0.0f, 0.0f}; // Cached, use Piece::AddRectangle so it stays valid
+};
+
+namespace Piece
+{
+	// Relative to first_piece_pos, O(1) as it returns the cached bounds
+	Rectangle GetBounds(const ImagePiece& piece);
+	// Recomputes the bounds from every rectangle
+	Rectangle ComputeBounds(const ImagePiece& piece);
+
+	// Appends a rectangle and grows the cached bounds
+	void AddRectangle(ImagePiece& piece, const SourceDestinationPair& source_dest);
+
+	// Splits the piece in a x_times * y_times grid, cells that do not cover any part of the piece are skipped
+	// The rectangles of every new piece are coalesced
+	// @param jobs Threads cropping the rows, 0 picks one per core for large grids
+	std::vector<ImagePiece> Crop(const ImagePiece& piece, int x_times, int y_times, unsigned int jobs = 0);
+	// Cuts the areas out of the piece, one new piece for every area that covers a part of it, coalesced as well
+	// @param regions Relative to the piece position like its destination rectangles
+	std::vector<ImagePiece> CropRegions(const ImagePiece& piece, const std::vector<Rectangle>& regions);
+
+	// Merges rectangles of the same image that touch along a whole edge both in the source and in the destination
+	// The drawn result and the bounds do not change, overlapping rectangles keep their draw order
+	// @return How many rectangles were removed
+	size_t Coalesce(std::vector<SourceDestinationPair>& sources_dests);
+
+	// True when the piece would compose to a fully transparent image or to a single colour, see Compose
+	bool IsUniform(const std::vector<Image>& sources, const ImagePiece& piece);
+	// Indices of the uniform pieces, checked on a worker pool
+	std::vector<uint32_t> FindUniformPieces(const std::vector<Image>& sources, const std::vector<ImagePiece>& pieces);
+
+	// Copies every rectangle of the piece from its R8G8B8A8 source image into a new image of the piece size
+	// @param sources Indexed by SourceDestinationPair::image
+	Image Compose(const std::vector<Image>& sources, const ImagePiece& piece);
+}
@@ -0,0 +1,233 @@
+#include "MappedImage.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+// Keeps the GDI and USER declarations that clash with raylib out
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#define NOUSER
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Utils/MipChain.h"
+
+namespace MappedImage
+{
+	struct Mapping
+	{
+		size_t size;
+#ifdef _WIN32
+		HANDLE file_handle;
+		HANDLE mapping_handle;
+#endif
+	};
+
+	// Mapped images by their data, Unload is called from the loader threads too
+	static std::mutex mappings_mutex;
+	static std::unordered_map<void*, Mapping> mappings;
+
+	// The user cache directory is on disk, the temporary one often lives in memory on Linux which would defeat the mapping
+	// @return the directories to try the cache files in, the first one that works is used
+	static const std::vector<std::string>& GetCacheDirectories()
+	{
+		static const std::vector<std::string> directories = []()
+		{
+			std::vector<std::string> directories;
+			std::filesystem::path cache_directory;
+#ifdef _WIN32
+			const char* local_app_data = getenv("LOCALAPPDATA");
+			if (local_app_data && *local_app_data)
+				cache_directory = local_app_data;
+#else
+			const char* cache_home = getenv("XDG_CACHE_HOME");
+			const char* home = getenv("HOME");
+			if (cache_home && *cache_home)
+				cache_directory = cache_home;
+			else if (home && *home)
+				cache_directory = std::filesystem::path(home) / ".cache";
+#endif
+
+			std::error_code error;
+			if (!cache_directory.empty())
+			{
+				cache_directory /= "ImageEditor";
+				std::filesystem::create_directories(cache_directory, error);
+				if (std::filesystem::is_directory(cache_directory, error))
+					directories.push_back(cache_directory.string());
+			}
+
+			std::filesystem::path temp_directory = std::filesystem::temp_directory_path(error);
+			if (!error)
+				directories.push_back(temp_directory.string());
+			return directories;
+		}();
+		return directories;
+	}
+
+	// @return the mapped cache file, nullptr if it could not be created in directory
+	static void* MapCacheFile(const std::string& directory, Mapping& mapping)
+	{
+		void* data = nullptr;
+#ifdef _WIN32
+		char filepath[MAX_PATH];
+		if (GetTempFileNameA(directory.c_str(), "img", 0, filepath) == 0)
+		{
+			Logger::Warn("Could not create an image cache file in '{}'", directory);
+			return nullptr;
+		}
+
+		// Deleted by the system once the last handle is closed, even if the program crashes
+		mapping.file_handle = CreateFileA(filepath, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (mapping.file_handle == INVALID_HANDLE_VALUE)
+		{
+			DeleteFileA(filepath);
+			Logger::Warn("Could not create an image cache file in '{}'", directory);
+			return nullptr;
+		}
+
+		LARGE_INTEGER file_size;
+		file_size.QuadPart = (LONGLONG)mapping.size;
+		mapping.mapping_handle = nullptr;
+		if (SetFilePointerEx(mapping.file_handle, file_size, nullptr, FILE_BEGIN) && SetEndOfFile(mapping.file_handle))
+			mapping.mapping_handle = CreateFileMappingA(mapping.file_handle, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+		data = mapping.mapping_handle ? MapViewOfFile(mapping.mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+		if (data == nullptr)
+		{
+			if (mapping.mapping_handle)
+				CloseHandle(mapping.mapping_handle);
+			CloseHandle(mapping.file_handle);
+			Logger::Warn("Could not map a {} MB image cache file in '{}'", mapping.size >> 20, directory);
+			return nullptr;
+		}
+#else
+		std::string filepath = directory + "/ImageEditor-XXXXXX";
+		int file_descriptor = mkstemp(filepath.data());
+		if (file_descriptor < 0)
+		{
+			Logger::Warn("Could not create an image cache file in '{}'", directory);
+			return nullptr;
+		}
+
+		// The mapping keeps the file alive, removing its name now means nothing is left behind after a crash
+		unlink(filepath.c_str());
+
+		// Reserves the disk space up front, running out of it while writing to the mapping would crash instead of failing here
+		if (posix_fallocate(file_descriptor, 0, (off_t)mapping.size) == 0)
+		{
+			data = mmap(nullptr, mapping.size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+			if (data == MAP_FAILED)
+				data = nullptr;
+		}
+		close(file_descriptor);
+
+		if (data == nullptr)
+		{
+			Logger::Warn("Could not map a {} MB image cache file in '{}'", mapping.size >> 20, directory);
+			return nullptr;
+		}
+#endif
+		return data;
+	}
+
+	Image Create(int width, int height)
+	{
+		Image image = {};
+		if (width <= 0 || height <= 0)
+			return image;
+
+		Mapping mapping = {};
+		mapping.size = MipChain::GetChainSize(width, height);
+		void* data = nullptr;
+		for (const std::string& directory : GetCacheDirectories())
+		{
+			data = MapCacheFile(directory, mapping);
+			if (data)
+				break;
+		}
+
+		if (data == nullptr)
+		{
+			Logger::Error("Could not create a {} MB image cache file", mapping.size >> 20);
+			return image;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mappings_mutex);
+			mappings[data] = mapping;
+		}
+
+		image.data = data;
+		image.width = width;
+		image.height = height;
+		image.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+		image.mipmaps = 1;
+		return image;
+	}
+
+	void Unload(Image image)
+	{
+		if (image.data == nullptr)
+			return;
+
+		Mapping mapping;
+		{
+			std::lock_guard<std::mutex> lock(mappings_mutex);
+			auto it = mappings.find(image.data);
+			if (it == mappings.end())
+			{
+				UnloadImage(image);
+				return;
+			}
+
+			mapping = it->second;
+			mappings.erase(it);
+		}
+
+#ifdef _WIN32
+		UnmapViewOfFile(image.data);
+		CloseHandle(mapping.mapping_handle);
+		CloseHandle(mapping.file_handle);
+#else
+		munmap(image.data, mapping.size);
+#endif
+	}
+
+	bool IsMapped(const Image& image)
+	{
+		std::lock_guard<std::mutex> lock(mappings_mutex);
+		return mappings.count(image.data) > 0;
+	}
+
+	void Release(const Image& image, size_t offset, size_t size)
+	{
+		if (!IsMapped(image))
+			return;
+
+#ifdef _WIN32
+		// Unlocking pages that were never locked takes them out of the working set
+		void* start = (unsigned char*)image.data + offset;
+		FlushViewOfFile(start, size);
+		VirtualUnlock(start, size);
+#else
+		// Only whole pages inside the range can be dropped, the ones it shares with its neighbours stay
+		size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+		size_t first_page = (offset + page_size - 1) / page_size * page_size;
+		size_t last_page = (offset + size) / page_size * page_size;
+		if (last_page > first_page)
+			madvise((unsigned char*)image.data + first_page, last_page - first_page, MADV_DONTNEED);
+#endif
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <raylib.h>
+
+// Images whose pixels live in a temporary cache file mapped in memory instead of the heap,
+// the system pages them in and out so an image bigger than the free memory can still be loaded
+// Cache files go to the user cache directory (XDG_CACHE_HOME, ~/.cache or LOCALAPPDATA), the temporary directory only when it fails
+// The cache file is deleted when the image is unloaded or the program exits
+namespace MappedImage
+{
+	// @return an R8G8B8A8 image with room for its whole mip chain, see MipChain::GenerateLevels, data is nullptr on failure
+	Image Create(int width, int height);
+	// Unloads mapped images and images allocated by raylib alike
+	void Unload(Image image);
+	bool IsMapped(const Image& image);
+
+	// Lets the system drop a range of the pixels from memory once they were written, they are read back from the cache file when used again
+	void Release(const Image& image, size_t offset, size_t size);
+}
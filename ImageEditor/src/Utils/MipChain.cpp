@@ -0,0 +1,208 @@
+#include "MipChain.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Smaller levels are not worth starting threads for
+#define MIN_PIXELS_PER_THREAD (256 * 256)
+// Levels that are released as they go are downsampled in bands of about this many source bytes
+#define RELEASE_BAND_SIZE (64 * 1024 * 1024)
+
+namespace MipChain
+{
+	// Averages 2x2 blocks of src rows [2 * first_row, 2 * last_row) into dst rows [first_row, last_row)
+	static void DownsampleRows(const unsigned char* src, int src_width, unsigned char* dst, int dst_width, int first_row, int last_row)
+	{
+		for (int y = first_row; y < last_row; y++)
+		{
+			const unsigned char* row_0 = src + (size_t)(2 * y) * src_width * 4;
+			const unsigned char* row_1 = row_0 + (size_t)src_width * 4;
+			unsigned char* out = dst + (size_t)y * dst_width * 4;
+
+			int x = 0;
+#ifdef __SSE2__
+			// 4 output pixels per iteration: sum the rows in 16 bit, then add neighbouring pixels together
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i rounding = _mm_set1_epi16(2);
+			for (; x + 4 <= dst_width; x += 4)
+			{
+				__m128i top_a = _mm_loadu_si128((const __m128i*)(row_0 + x * 8));
+				__m128i top_b = _mm_loadu_si128((const __m128i*)(row_0 + x * 8 + 16));
+				__m128i bottom_a = _mm_loadu_si128((const __m128i*)(row_1 + x * 8));
+				__m128i bottom_b = _mm_loadu_si128((const __m128i*)(row_1 + x * 8 + 16));
+
+				__m128i sum_0 = _mm_add_epi16(_mm_unpacklo_epi8(top_a, zero), _mm_unpacklo_epi8(bottom_a, zero));
+				__m128i sum_1 = _mm_add_epi16(_mm_unpackhi_epi8(top_a, zero), _mm_unpackhi_epi8(bottom_a, zero));
+				__m128i sum_2 = _mm_add_epi16(_mm_unpacklo_epi8(top_b, zero), _mm_unpacklo_epi8(bottom_b, zero));
+				__m128i sum_3 = _mm_add_epi16(_mm_unpackhi_epi8(top_b, zero), _mm_unpackhi_epi8(bottom_b, zero));
+
+				// Every register holds two source pixels, adding the high half to the low one merges them
+				__m128i pixel_0 = _mm_add_epi16(sum_0, _mm_srli_si128(sum_0, 8));
+				__m128i pixel_1 = _mm_add_epi16(sum_1, _mm_srli_si128(sum_1, 8));
+				__m128i pixel_2 = _mm_add_epi16(sum_2, _mm_srli_si128(sum_2, 8));
+				__m128i pixel_3 = _mm_add_epi16(sum_3, _mm_srli_si128(sum_3, 8));
+
+				__m128i pixels_01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(pixel_0, pixel_1), rounding), 2);
+				__m128i pixels_23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(pixel_2, pixel_3), rounding), 2);
+				_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(pixels_01, pixels_23));
+			}
+#endif
+			for (; x < dst_width; x++)
+			{
+				for (int channel = 0; channel < 4; channel++)
+				{
+					int sum = row_0[x * 8 + channel] + row_0[x * 8 + 4 + channel] + row_1[x * 8 + channel] + row_1[x * 8 + 4 + channel];
+					out[x * 4 + channel] = (unsigned char)((sum + 2) >> 2);
+				}
+			}
+		}
+	}
+
+	// Halves a level, a source side of 1 is repeated so the filter can still read 2x2 blocks
+	static void Downsample(const unsigned char* src, int src_width, int src_height, unsigned char* dst, int dst_width, int dst_height)
+	{
+		std::vector<unsigned char> padded;
+		if (src_width < 2 || src_height < 2)
+		{
+			int padded_width = std::max(src_width, 2);
+			int padded_height = std::max(src_height, 2);
+			padded.resize((size_t)padded_width * padded_height * 4);
+			for (int y = 0; y < padded_height; y++)
+				for (int x = 0; x < padded_width; x++)
+					memcpy(&padded[((size_t)y * padded_width + x) * 4], src + ((size_t)std::min(y, src_height - 1) * src_width + std::min(x, src_width - 1)) * 4, 4);
+
+			src = padded.data();
+			src_width = padded_width;
+		}
+
+		int pixels = dst_width * dst_height;
+		int thread_count = std::clamp(pixels / MIN_PIXELS_PER_THREAD, 1, (int)std::max(std::thread::hardware_concurrency(), 1u));
+		if (thread_count == 1)
+		{
+			DownsampleRows(src, src_width, dst, dst_width, 0, dst_height);
+			return;
+		}
+
+		std::vector<std::thread> threads;
+		int rows_per_thread = (dst_height + thread_count - 1) / thread_count;
+		for (int first_row = 0; first_row < dst_height; first_row += rows_per_thread)
+			threads.emplace_back(DownsampleRows, src, src_width, dst, dst_width, first_row, std::min(first_row + rows_per_thread, dst_height));
+
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	int GetLevelCount(int width, int height)
+	{
+		int level_count = 1;
+		for (int size = std::max(width, height); size > 1; size /= 2)
+			level_count++;
+
+		return level_count;
+	}
+
+	size_t GetChainSize(int width, int height)
+	{
+		// Same level sizes as rlLoadTexture expects
+		size_t total_size = 0;
+		int level_count = GetLevelCount(width, height);
+		for (int level = 0; level < level_count; level++)
+		{
+			total_size += (size_t)width * height * 4;
+			width = std::max(width / 2, 1);
+			height = std::max(height / 2, 1);
+		}
+
+		return total_size;
+	}
+
+	void Generate(Image* image)
+	{
+		if (image->data == nullptr || image->format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8)
+			return;
+
+		void* data = realloc(image->data, GetChainSize(image->width, image->height));
+		if (data == nullptr)
+			return;
+		image->data = data;
+
+		GenerateLevels(image);
+	}
+
+	void GenerateLevels(Image* image, const ReleaseFunction& release)
+	{
+		if (image->data == nullptr || image->format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8)
+			return;
+
+		int level_count = GetLevelCount(image->width, image->height);
+		int width = image->width;
+		int height = image->height;
+		unsigned char* level_data = (unsigned char*)image->data;
+		for (int level = 1; level < level_count; level++)
+		{
+			int next_width = std::max(width / 2, 1);
+			int next_height = std::max(height / 2, 1);
+			size_t row_size = (size_t)width * 4;
+			unsigned char* next_level_data = level_data + row_size * height;
+			if (!release || height < 2)
+				Downsample(level_data, width, height, next_level_data, next_width, next_height);
+			else
+			{
+				// Every band of source rows is read once, so it can go as soon as the rows below it are done
+				int band_rows = (int)std::max(RELEASE_BAND_SIZE / (row_size * 2), (size_t)1);
+				for (int first_row = 0; first_row < next_height; first_row += band_rows)
+				{
+					int rows = std::min(band_rows, next_height - first_row);
+					unsigned char* band_data = level_data + row_size * 2 * first_row;
+					Downsample(band_data, width, rows * 2, next_level_data + (size_t)first_row * next_width * 4, next_width, rows);
+					release(band_data - (unsigned char*)image->data, row_size * 2 * rows);
+				}
+			}
+
+			width = next_width;
+			height = next_height;
+			level_data = next_level_data;
+		}
+
+		image->mipmaps = level_count;
+	}
+
+	size_t GetLevelOffset(const Image& image, int level)
+	{
+		size_t offset = 0;
+		int width = image.width;
+		int height = image.height;
+		for (int i = 0; i < level; i++)
+		{
+			offset += (size_t)width * height * 4;
+			width = std::max(width / 2, 1);
+			height = std::max(height / 2, 1);
+		}
+
+		return offset;
+	}
+
+	Image GetLevel(const Image& image, int level)
+	{
+		level = std::clamp(level, 0, image.mipmaps - 1);
+
+		Image result = {};
+		result.width = std::max(image.width >> level, 1);
+		result.height = std::max(image.height >> level, 1);
+		result.format = image.format;
+		result.mipmaps = 1;
+
+		size_t size = (size_t)result.width * result.height * 4;
+		result.data = malloc(size);
+		memcpy(result.data, (unsigned char*)image.data + GetLevelOffset(image, level), size);
+
+		return result;
+	}
+}
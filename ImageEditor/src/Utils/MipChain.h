@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <raylib.h>
+
+namespace MipChain
+{
+	// Appends every mipmap level to an R8G8B8A8 image using a 2x2 box filter, rows are split between threads
+	// The levels follow the raylib layout so the image can be uploaded with LoadTextureFromImage
+	void Generate(Image* image);
+	// Receives the byte ranges of the chain that were read for the last time
+	using ReleaseFunction = std::function<void(size_t offset, size_t size)>;
+
+	// Same as Generate for an image whose data already has room for every level, see GetChainSize
+	// @param release When set, the levels are downsampled in bands so the source rows can be released as they go
+	void GenerateLevels(Image* image, const ReleaseFunction& release = nullptr);
+
+	// @return the number of levels down to 1x1
+	int GetLevelCount(int width, int height);
+	// @return the size in bytes of an image with all its levels
+	size_t GetChainSize(int width, int height);
+
+	// @return the size in bytes of all the levels before the given one
+	size_t GetLevelOffset(const Image& image, int level);
+	// @return a copy of a single level as its own image
+	Image GetLevel(const Image& image, int level);
+}
@@ -0,0 +1,619 @@
+#include "ParallelDeflate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <queue>
+#include <thread>
+
+// Input bytes compressed by one thread, each block costs a sync flush and the hashing of the 32 KB before it
+#define DEFLATE_BLOCK_SIZE (128 * 1024)
+#define WINDOW_SIZE 32768
+// Matches are found with a hash of 4 bytes, deflate would allow 3
+#define MIN_MATCH 4
+#define MAX_MATCH 258
+#define MIN_HASH_BITS 8
+#define MAX_HASH_BITS 15
+#define MAX_STORED_SIZE 65535
+#define ADLER_MODULO 65521
+// Most bytes summed before the adler sums could overflow 32 bits
+#define ADLER_MAX_RUN 5552
+
+#define LITERAL_LENGTH_SYMBOLS 286
+// The fixed code also has the two symbols that are never used, they change the codes of the symbols 144 to 255
+#define FIXED_LITERAL_LENGTH_SYMBOLS 288
+#define DISTANCE_SYMBOLS 30
+#define CODE_LENGTH_SYMBOLS 19
+#define END_OF_BLOCK 256
+#define MAX_CODE_BITS 15
+#define MAX_CODE_LENGTH_BITS 7
+
+namespace ParallelDeflate
+{
+	enum BlockType
+	{
+		BLOCK_STORED = 0,
+		BLOCK_FIXED = 1,
+		BLOCK_DYNAMIC = 2,
+	};
+
+	// Indexed by level, matches at least as long as the nice length stop the search
+	static const int MAX_CHAIN_LENGTHS[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+	static const int NICE_LENGTHS[10] = {0, 8, 16, 32, 64, 128, 258, 258, 258, 258};
+
+	static const uint16_t LENGTH_BASES[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+	static const uint8_t LENGTH_EXTRA_BITS[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+	static const uint16_t DISTANCE_BASES[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+	static const uint8_t DISTANCE_EXTRA_BITS[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+	static const uint8_t CODE_LENGTH_ORDER[CODE_LENGTH_SYMBOLS] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	struct SymbolTables
+	{
+		uint8_t length_symbols[MAX_MATCH + 1]; // Index in LENGTH_BASES of every match length
+		uint8_t distance_symbols[WINDOW_SIZE + 1]; // Index in DISTANCE_BASES of every distance
+		uint8_t fixed_literal_lengths[FIXED_LITERAL_LENGTH_SYMBOLS];
+		uint8_t fixed_distance_lengths[DISTANCE_SYMBOLS];
+	};
+
+	static SymbolTables BuildSymbolTables()
+	{
+		SymbolTables tables;
+		// 258 has a symbol of its own, written last so it wins over the range of the symbol before it
+		for (int symbol = 0; symbol < 29; symbol++)
+		{
+			for (int length = LENGTH_BASES[symbol]; length < LENGTH_BASES[symbol] + (1 << LENGTH_EXTRA_BITS[symbol]) && length <= MAX_MATCH; length++)
+				tables.length_symbols[length] = (uint8_t)symbol;
+		}
+		for (int symbol = 0; symbol < DISTANCE_SYMBOLS; symbol++)
+		{
+			for (int distance = DISTANCE_BASES[symbol]; distance < DISTANCE_BASES[symbol] + (1 << DISTANCE_EXTRA_BITS[symbol]) && distance <= WINDOW_SIZE; distance++)
+				tables.distance_symbols[distance] = (uint8_t)symbol;
+		}
+
+		for (int symbol = 0; symbol < FIXED_LITERAL_LENGTH_SYMBOLS; symbol++)
+			tables.fixed_literal_lengths[symbol] = symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8;
+		memset(tables.fixed_distance_lengths, 5, sizeof(tables.fixed_distance_lengths));
+
+		return tables;
+	}
+
+	static const SymbolTables& GetSymbolTables()
+	{
+		static const SymbolTables tables = BuildSymbolTables();
+		return tables;
+	}
+
+	// Deflate packs the bits from the least significant one, Huffman codes are reversed before being written
+	struct BitWriter
+	{
+		std::vector<unsigned char>& bytes;
+		uint64_t bits = 0;
+		int bit_count = 0;
+
+		void Write(uint32_t value, int length)
+		{
+			bits |= (uint64_t)value << bit_count;
+			bit_count += length;
+			if (bit_count >= 32)
+			{
+				for (int i = 0; i < 4; i++)
+					bytes.push_back((unsigned char)(bits >> (i * 8)));
+				bits >>= 32;
+				bit_count -= 32;
+			}
+		}
+
+		void Align()
+		{
+			for (; bit_count > 0; bit_count -= 8)
+			{
+				bytes.push_back((unsigned char)bits);
+				bits >>= 8;
+			}
+			bits = 0;
+			bit_count = 0;
+		}
+	};
+
+	// A token is a literal byte, or the length of a match shifted by 16 bits with its distance in the low bits
+	struct LiteralOrMatch
+	{
+		std::vector<uint32_t> tokens;
+		uint32_t literal_frequencies[LITERAL_LENGTH_SYMBOLS] = {};
+		uint32_t distance_frequencies[DISTANCE_SYMBOLS] = {};
+	};
+
+	struct HuffmanCode
+	{
+		uint8_t lengths[FIXED_LITERAL_LENGTH_SYMBOLS] = {};
+		uint16_t codes[FIXED_LITERAL_LENGTH_SYMBOLS] = {};
+	};
+
+	static uint32_t Adler32(const unsigned char* data, size_t size)
+	{
+		uint32_t a = 1, b = 0;
+		while (size > 0)
+		{
+			size_t run = std::min(size, (size_t)ADLER_MAX_RUN);
+			for (size_t i = 0; i < run; i++)
+			{
+				a += data[i];
+				b += a;
+			}
+			a %= ADLER_MODULO;
+			b %= ADLER_MODULO;
+			data += run;
+			size -= run;
+		}
+
+		return (b << 16) | a;
+	}
+
+	// Adler32 of two buffers put one after the other, from the adlers of both and the size of the second, as zlib does it
+	static uint32_t CombineAdler32(uint32_t first, uint32_t second, size_t second_size)
+	{
+		uint32_t remainder = (uint32_t)(second_size % ADLER_MODULO);
+		uint32_t a = first & 0xFFFF;
+		uint32_t b = (uint32_t)(((uint64_t)remainder * a) % ADLER_MODULO);
+		a += (second & 0xFFFF) + ADLER_MODULO - 1;
+		b += (first >> 16) + (second >> 16) + ADLER_MODULO - remainder;
+		a %= ADLER_MODULO;
+		b %= ADLER_MODULO;
+		return (b << 16) | a;
+	}
+
+	static int GetMatchLength(const unsigned char* a, const unsigned char* b, int max_length)
+	{
+		int length = 0;
+#if defined(__GNUC__)
+		// 8 bytes at a time, the first different byte is the lowest set bit of the difference on little endian targets
+		for (; length + 8 <= max_length; length += 8)
+		{
+			uint64_t a_word, b_word;
+			memcpy(&a_word, a + length, 8);
+			memcpy(&b_word, b + length, 8);
+			if (a_word != b_word)
+				return length + (__builtin_ctzll(a_word ^ b_word) >> 3);
+		}
+#endif
+		while (length < max_length && a[length] == b[length])
+			length++;
+
+		return length;
+	}
+
+	// Greedy parsing: the longest match found within the chain length is always taken
+	// Positions of the window before start are hashed first, so the block can refer to them like the previous blocks were part of it
+	static void FindMatches(const unsigned char* data, size_t size, size_t start, size_t end, int level, LiteralOrMatch& result)
+	{
+		const SymbolTables& tables = GetSymbolTables();
+		size_t window_start = start > WINDOW_SIZE ? start - WINDOW_SIZE : 0;
+		size_t range = end - window_start;
+		int hash_bits = MIN_HASH_BITS;
+		while (hash_bits < MAX_HASH_BITS && ((size_t)1 << hash_bits) < range)
+			hash_bits++;
+
+		// Positions are relative to window_start, previous chains every position to the last one with the same hash
+		std::vector<int32_t> heads((size_t)1 << hash_bits, -1);
+		std::vector<int32_t> previous(range);
+		auto insert = [&](size_t position)
+		{
+			uint32_t word;
+			memcpy(&word, data + position, 4);
+			uint32_t hash = (word * 2654435761u) >> (32 - hash_bits);
+			previous[position - window_start] = heads[hash];
+			heads[hash] = (int32_t)(position - window_start);
+		};
+
+		for (size_t position = window_start; position < start && position + MIN_MATCH <= size; position++)
+			insert(position);
+
+		int max_chain_length = MAX_CHAIN_LENGTHS[level];
+		int nice_length = NICE_LENGTHS[level];
+		result.tokens.reserve((end - start) / 2);
+		size_t position = start;
+		while (position < end)
+		{
+			int max_length = (int)std::min((size_t)MAX_MATCH, end - position);
+			int best_length = 0;
+			size_t best_distance = 0;
+			if (max_length >= MIN_MATCH)
+			{
+				size_t min_position = position > WINDOW_SIZE ? position - WINDOW_SIZE : 0;
+				const unsigned char* current = data + position;
+				insert(position);
+				int32_t candidate = previous[position - window_start];
+				for (int chain = 0; candidate >= 0 && window_start + candidate >= min_position && chain < max_chain_length; chain++)
+				{
+					const unsigned char* match = data + window_start + candidate;
+					if (match[best_length] == current[best_length])
+					{
+						int length = GetMatchLength(match, current, max_length);
+						if (length > best_length)
+						{
+							best_length = length;
+							best_distance = current - match;
+							if (length >= nice_length || length == max_length)
+								break;
+						}
+					}
+					candidate = previous[candidate];
+				}
+			}
+
+			if (best_length >= MIN_MATCH)
+			{
+				result.tokens.push_back(((uint32_t)best_length << 16) | (uint32_t)best_distance);
+				result.literal_frequencies[257 + tables.length_symbols[best_length]]++;
+				result.distance_frequencies[tables.distance_symbols[best_distance]]++;
+				for (size_t next = position + 1; next < position + best_length && next + MIN_MATCH <= size; next++)
+					insert(next);
+				position += best_length;
+			}
+			else
+			{
+				result.tokens.push_back(data[position]);
+				result.literal_frequencies[data[position]]++;
+				position++;
+			}
+		}
+		result.literal_frequencies[END_OF_BLOCK]++;
+	}
+
+	// Huffman code lengths of at most max_bits, frequencies are halved until the tree is shallow enough
+	// A single used symbol gets a sibling, decoders want a complete code
+	static void BuildLengths(const uint32_t* frequencies, int count, int max_bits, uint8_t* lengths)
+	{
+		memset(lengths, 0, count);
+		std::vector<int> symbols;
+		std::vector<uint64_t> weights;
+		for (int symbol = 0; symbol < count; symbol++)
+		{
+			if (frequencies[symbol] > 0)
+			{
+				symbols.push_back(symbol);
+				weights.push_back(frequencies[symbol]);
+			}
+		}
+
+		if (symbols.empty())
+			return;
+		if (symbols.size() == 1)
+		{
+			lengths[symbols[0]] = 1;
+			lengths[symbols[0] == 0 ? 1 : 0] = 1;
+			return;
+		}
+
+		size_t leaf_count = symbols.size();
+		std::vector<int> parents(leaf_count * 2 - 1);
+		std::vector<int> depths(leaf_count * 2 - 1);
+		while (true)
+		{
+			// Leaves first, then the inner nodes in the order they are made, so the root is the last node
+			using Node = std::pair<uint64_t, int>;
+			std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+			for (size_t i = 0; i < leaf_count; i++)
+				queue.push({weights[i], (int)i});
+
+			int next_node = (int)leaf_count;
+			while (queue.size() > 1)
+			{
+				Node a = queue.top();
+				queue.pop();
+				Node b = queue.top();
+				queue.pop();
+				parents[a.second] = next_node;
+				parents[b.second] = next_node;
+				queue.push({a.first + b.first, next_node++});
+			}
+
+			int max_depth = 0;
+			depths[next_node - 1] = 0;
+			for (int node = next_node - 2; node >= 0; node--)
+			{
+				depths[node] = depths[parents[node]] + 1;
+				max_depth = std::max(max_depth, depths[node]);
+			}
+
+			if (max_depth <= max_bits)
+				break;
+
+			for (uint64_t& weight : weights)
+				weight = (weight + 1) / 2;
+		}
+
+		for (size_t i = 0; i < leaf_count; i++)
+			lengths[symbols[i]] = (uint8_t)depths[i];
+	}
+
+	// Canonical codes of RFC 1951 3.2.2, bit reversed for the writer
+	static void BuildCodes(const uint8_t* lengths, int count, uint16_t* codes)
+	{
+		int length_counts[MAX_CODE_BITS + 1] = {};
+		for (int symbol = 0; symbol < count; symbol++)
+			length_counts[lengths[symbol]]++;
+		length_counts[0] = 0;
+
+		int next_codes[MAX_CODE_BITS + 1] = {};
+		int code = 0;
+		for (int bits = 1; bits <= MAX_CODE_BITS; bits++)
+		{
+			code = (code + length_counts[bits - 1]) << 1;
+			next_codes[bits] = code;
+		}
+
+		for (int symbol = 0; symbol < count; symbol++)
+		{
+			int length = lengths[symbol];
+			if (length == 0)
+				continue;
+
+			int value = next_codes[length]++;
+			int reversed = 0;
+			for (int bit = 0; bit < length; bit++)
+				reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+			codes[symbol] = (uint16_t)reversed;
+		}
+	}
+
+	// Code lengths of a dynamic block, run length encoded with the symbols 16 to 18 then Huffman coded themselves
+	struct DynamicHeader
+	{
+		int literal_count, distance_count, code_length_count;
+		std::vector<uint8_t> symbols;
+		std::vector<uint8_t> extras; // Repeat count of the symbols 16 to 18
+		uint8_t lengths[CODE_LENGTH_SYMBOLS];
+		uint16_t codes[CODE_LENGTH_SYMBOLS];
+	};
+
+	static const uint8_t REPEAT_EXTRA_BITS[3] = {2, 3, 7}; // Of the symbols 16, 17 and 18
+
+	static void BuildDynamicHeader(const uint8_t* literal_lengths, const uint8_t* distance_lengths, DynamicHeader& header)
+	{
+		header.literal_count = LITERAL_LENGTH_SYMBOLS;
+		while (header.literal_count > 257 && literal_lengths[header.literal_count - 1] == 0)
+			header.literal_count--;
+		header.distance_count = DISTANCE_SYMBOLS;
+		while (header.distance_count > 1 && distance_lengths[header.distance_count - 1] == 0)
+			header.distance_count--;
+
+		std::vector<uint8_t> lengths(literal_lengths, literal_lengths + header.literal_count);
+		lengths.insert(lengths.end(), distance_lengths, distance_lengths + header.distance_count);
+
+		auto emit = [&](uint8_t symbol, uint8_t extra)
+		{
+			header.symbols.push_back(symbol);
+			header.extras.push_back(extra);
+		};
+
+		for (size_t i = 0; i < lengths.size();)
+		{
+			uint8_t value = lengths[i];
+			size_t run = 1;
+			while (i + run < lengths.size() && lengths[i + run] == value)
+				run++;
+			i += run;
+
+			if (value == 0)
+			{
+				for (; run >= 11; run -= std::min(run, (size_t)138))
+					emit(18, (uint8_t)(std::min(run, (size_t)138) - 11));
+				if (run >= 3)
+				{
+					emit(17, (uint8_t)(run - 3));
+					run = 0;
+				}
+			}
+			else
+			{
+				emit(value, 0);
+				for (run--; run >= 3; run -= std::min(run, (size_t)6))
+					emit(16, (uint8_t)(std::min(run, (size_t)6) - 3));
+			}
+
+			for (; run > 0; run--)
+				emit(value, 0);
+		}
+
+		uint32_t frequencies[CODE_LENGTH_SYMBOLS] = {};
+		for (uint8_t symbol : header.symbols)
+			frequencies[symbol]++;
+		BuildLengths(frequencies, CODE_LENGTH_SYMBOLS, MAX_CODE_LENGTH_BITS, header.lengths);
+		BuildCodes(header.lengths, CODE_LENGTH_SYMBOLS, header.codes);
+
+		header.code_length_count = CODE_LENGTH_SYMBOLS;
+		while (header.code_length_count > 4 && header.lengths[CODE_LENGTH_ORDER[header.code_length_count - 1]] == 0)
+			header.code_length_count--;
+	}
+
+	static size_t GetHeaderBits(const DynamicHeader& header)
+	{
+		size_t bits = 5 + 5 + 4 + 3 * header.code_length_count;
+		for (uint8_t symbol : header.symbols)
+			bits += header.lengths[symbol] + (symbol >= 16 ? REPEAT_EXTRA_BITS[symbol - 16] : 0);
+
+		return bits;
+	}
+
+	static size_t GetDataBits(const LiteralOrMatch& parsed, const uint8_t* literal_lengths, const uint8_t* distance_lengths)
+	{
+		size_t bits = 0;
+		for (int symbol = 0; symbol < LITERAL_LENGTH_SYMBOLS; symbol++)
+			bits += (size_t)parsed.literal_frequencies[symbol] * (literal_lengths[symbol] + (symbol > END_OF_BLOCK ? LENGTH_EXTRA_BITS[symbol - 257] : 0));
+		for (int symbol = 0; symbol < DISTANCE_SYMBOLS; symbol++)
+			bits += (size_t)parsed.distance_frequencies[symbol] * (distance_lengths[symbol] + DISTANCE_EXTRA_BITS[symbol]);
+
+		return bits;
+	}
+
+	static void WriteTokens(BitWriter& writer, const std::vector<uint32_t>& tokens, const HuffmanCode& literals, const HuffmanCode& distances)
+	{
+		const SymbolTables& tables = GetSymbolTables();
+		for (uint32_t token : tokens)
+		{
+			if (token < 256)
+			{
+				writer.Write(literals.codes[token], literals.lengths[token]);
+				continue;
+			}
+
+			uint32_t length = token >> 16;
+			uint32_t distance = token & 0xFFFF;
+			int length_symbol = tables.length_symbols[length];
+			writer.Write(literals.codes[257 + length_symbol], literals.lengths[257 + length_symbol]);
+			writer.Write(length - LENGTH_BASES[length_symbol], LENGTH_EXTRA_BITS[length_symbol]);
+			int distance_symbol = tables.distance_symbols[distance];
+			writer.Write(distances.codes[distance_symbol], distances.lengths[distance_symbol]);
+			writer.Write(distance - DISTANCE_BASES[distance_symbol], DISTANCE_EXTRA_BITS[distance_symbol]);
+		}
+		writer.Write(literals.codes[END_OF_BLOCK], literals.lengths[END_OF_BLOCK]);
+	}
+
+	// Every block starts on a byte boundary, so does a stored block right away and its size is known exactly
+	static void WriteStored(std::vector<unsigned char>& bytes, const unsigned char* data, size_t size, bool is_last)
+	{
+		size_t offset = 0;
+		do
+		{
+			size_t length = std::min(size - offset, (size_t)MAX_STORED_SIZE);
+			bool is_final = is_last && offset + length == size;
+			bytes.push_back(is_final ? 1 : 0);
+			bytes.push_back((unsigned char)length);
+			bytes.push_back((unsigned char)(length >> 8));
+			bytes.push_back((unsigned char)~length);
+			bytes.push_back((unsigned char)(~length >> 8));
+			bytes.insert(bytes.end(), data + offset, data + offset + length);
+			offset += length;
+		}
+		while (offset < size);
+	}
+
+	// Deflate blocks of data [start, end), ending on a byte boundary so they can be put after the previous block as they are
+	static void CompressBlock(const unsigned char* data, size_t size, size_t start, size_t end, int level, std::vector<unsigned char>& bytes)
+	{
+		bool is_last = end == size;
+		size_t stored_bits = ((end - start + MAX_STORED_SIZE - 1) / MAX_STORED_SIZE) * 40 + (end - start) * 8;
+		if (level == 0 || start == end)
+		{
+			WriteStored(bytes, data + start, end - start, is_last);
+			return;
+		}
+
+		LiteralOrMatch parsed;
+		FindMatches(data, size, start, end, level, parsed);
+
+		const SymbolTables& tables = GetSymbolTables();
+		size_t fixed_bits = 3 + GetDataBits(parsed, tables.fixed_literal_lengths, tables.fixed_distance_lengths);
+
+		HuffmanCode literals, distances;
+		BuildLengths(parsed.literal_frequencies, LITERAL_LENGTH_SYMBOLS, MAX_CODE_BITS, literals.lengths);
+		BuildLengths(parsed.distance_frequencies, DISTANCE_SYMBOLS, MAX_CODE_BITS, distances.lengths);
+		// Blocks of literals only still declare two distance codes
+		if (std::all_of(distances.lengths, distances.lengths + DISTANCE_SYMBOLS, [](uint8_t length) { return length == 0; }))
+			distances.lengths[0] = distances.lengths[1] = 1;
+		DynamicHeader header;
+		BuildDynamicHeader(literals.lengths, distances.lengths, header);
+		size_t dynamic_bits = 3 + GetHeaderBits(header) + GetDataBits(parsed, literals.lengths, distances.lengths);
+
+		if (stored_bits <= std::min(fixed_bits, dynamic_bits))
+		{
+			WriteStored(bytes, data + start, end - start, is_last);
+			return;
+		}
+
+		bytes.reserve(bytes.size() + std::min(fixed_bits, dynamic_bits) / 8 + 16);
+		BitWriter writer = {bytes};
+		writer.Write(is_last ? 1 : 0, 1);
+		if (fixed_bits <= dynamic_bits)
+		{
+			memcpy(literals.lengths, tables.fixed_literal_lengths, sizeof(literals.lengths));
+			memcpy(distances.lengths, tables.fixed_distance_lengths, sizeof(tables.fixed_distance_lengths));
+			writer.Write(BLOCK_FIXED, 2);
+		}
+		else
+		{
+			writer.Write(BLOCK_DYNAMIC, 2);
+			writer.Write(header.literal_count - 257, 5);
+			writer.Write(header.distance_count - 1, 5);
+			writer.Write(header.code_length_count - 4, 4);
+			for (int i = 0; i < header.code_length_count; i++)
+				writer.Write(header.lengths[CODE_LENGTH_ORDER[i]], 3);
+			for (size_t i = 0; i < header.symbols.size(); i++)
+			{
+				uint8_t symbol = header.symbols[i];
+				writer.Write(header.codes[symbol], header.lengths[symbol]);
+				if (symbol >= 16)
+					writer.Write(header.extras[i], REPEAT_EXTRA_BITS[symbol - 16]);
+			}
+		}
+		BuildCodes(literals.lengths, FIXED_LITERAL_LENGTH_SYMBOLS, literals.codes);
+		BuildCodes(distances.lengths, DISTANCE_SYMBOLS, distances.codes);
+		WriteTokens(writer, parsed.tokens, literals, distances);
+
+		// An empty stored block byte aligns the stream like a zlib sync flush, the next block is then appended as it is
+		if (!is_last)
+			writer.Write(0, 3);
+		writer.Align();
+		if (!is_last)
+			bytes.insert(bytes.end(), {0x00, 0x00, 0xFF, 0xFF});
+	}
+
+	std::vector<unsigned char> Compress(const unsigned char* data, size_t size, int level, unsigned int jobs)
+	{
+		level = std::clamp(level, 0, 9);
+		size_t block_count = std::max((size_t)1, (size + DEFLATE_BLOCK_SIZE - 1) / DEFLATE_BLOCK_SIZE);
+		std::vector<std::vector<unsigned char>> blocks(block_count);
+		std::vector<uint32_t> adlers(block_count);
+
+		std::atomic<size_t> next_block = 0;
+		auto compressor = [&]()
+		{
+			for (size_t i = next_block++; i < block_count; i = next_block++)
+			{
+				size_t start = i * DEFLATE_BLOCK_SIZE;
+				size_t end = std::min(size, start + DEFLATE_BLOCK_SIZE);
+				CompressBlock(data, size, start, end, level, blocks[i]);
+				adlers[i] = Adler32(data + start, end - start);
+			}
+		};
+
+		jobs = std::max(1u, std::min(jobs > 0 ? jobs : std::thread::hardware_concurrency(), (unsigned int)block_count));
+		std::vector<std::thread> threads;
+		for (unsigned int i = 1; i < jobs; i++)
+			threads.emplace_back(compressor);
+		compressor();
+		for (auto& thread : threads)
+			thread.join();
+
+		size_t compressed_size = 2 + 4;
+		for (const auto& block : blocks)
+			compressed_size += block.size();
+
+		// 32 KB window with deflate, the level hint only tells decoders how the stream was made
+		std::vector<unsigned char> result;
+		result.reserve(compressed_size);
+		unsigned char method = 0x78;
+		unsigned char flags = (unsigned char)((level <= 1 ? 0 : level <= 5 ? 1 : level == 6 ? 2 : 3) << 6);
+		flags |= 31 - (method * 256 + flags) % 31;
+		result.push_back(method);
+		result.push_back(flags);
+
+		uint32_t adler = 1;
+		for (size_t i = 0; i < block_count; i++)
+		{
+			result.insert(result.end(), blocks[i].begin(), blocks[i].end());
+			std::vector<unsigned char>().swap(blocks[i]);
+			size_t start = i * DEFLATE_BLOCK_SIZE;
+			adler = CombineAdler32(adler, adlers[i], std::min(size, start + DEFLATE_BLOCK_SIZE) - start);
+		}
+
+		for (int shift = 24; shift >= 0; shift -= 8)
+			result.push_back((unsigned char)(adler >> shift));
+
+		return result;
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace ParallelDeflate
+{
+	// Compresses data into a zlib stream (RFC 1950) like pigz: the input is cut in blocks compressed on separate threads,
+	// every block may still refer to the 32 KB before it so the split only costs the few bytes that byte align each block
+	// Blocks are parsed greedily and written with whichever of the dynamic, fixed or stored encodings is the smallest for them
+	// @param level 0 only stores, 1 to 9 follow longer match chains like zlib
+	// @param jobs 0 picks one per core
+	std::vector<unsigned char> Compress(const unsigned char* data, size_t size, int level, unsigned int jobs = 0);
+}
@@ -0,0 +1,184 @@
+#include "PerceptualHash.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdlib>
+
+#define THUMBNAIL_WIDTH 9
+#define THUMBNAIL_HEIGHT 8
+// Neighbours closer than this many grey levels count as equal, otherwise the noise of flat areas sets random bits
+#define GRADIENT_DEAD_ZONE 4.0f
+
+namespace PerceptualHash
+{
+	// Metric tree over the Hamming distance: the children of a node are keyed by their distance to it,
+	// so by the triangle inequality a query only goes down the children within max_distance of its own distance
+	// Identical hashes share a node, flat or empty cells would otherwise make a chain of distance 0 children
+	struct BKNode
+	{
+		uint64_t gradient;
+		std::vector<uint32_t> items;
+		std::vector<std::pair<int, uint32_t>> children; // Distance to this node, index of the child node
+	};
+
+	PerceptualHashValue Compute(const Image& image)
+	{
+		PerceptualHashValue result = {0, BLANK};
+		if (!image.data || image.width <= 0 || image.height <= 0)
+			return result;
+
+		const unsigned char* pixels = (const unsigned char*)image.data;
+		float thumbnail[THUMBNAIL_HEIGHT][THUMBNAIL_WIDTH];
+		uint64_t sums[4] = {0, 0, 0, 0};
+		for (int cell_y = 0; cell_y < THUMBNAIL_HEIGHT; cell_y++)
+		{
+			// Every cell averages at least one pixel, cells of pieces smaller than the thumbnail share them
+			int first_row = cell_y * image.height / THUMBNAIL_HEIGHT;
+			int last_row = std::max((cell_y + 1) * image.height / THUMBNAIL_HEIGHT, first_row + 1);
+			for (int cell_x = 0; cell_x < THUMBNAIL_WIDTH; cell_x++)
+			{
+				int first_column = cell_x * image.width / THUMBNAIL_WIDTH;
+				int last_column = std::max((cell_x + 1) * image.width / THUMBNAIL_WIDTH, first_column + 1);
+
+				uint64_t grey = 0;
+				for (int y = first_row; y < last_row; y++)
+				{
+					const unsigned char* pixel = pixels + ((size_t)y * image.width + first_column) * 4;
+					for (int x = first_column; x < last_column; x++, pixel += 4)
+					{
+						// Integer luma (77, 150, 29) / 256, premultiplied so transparent pixels count as black
+						grey += (uint64_t)(pixel[0] * 77 + pixel[1] * 150 + pixel[2] * 29) * pixel[3];
+					}
+				}
+				thumbnail[cell_y][cell_x] = (float)grey / ((size_t)(last_row - first_row) * (last_column - first_column)) / (256.0f * 255.0f);
+			}
+		}
+
+		for (int y = 0; y < image.height; y++)
+		{
+			const unsigned char* pixel = pixels + (size_t)y * image.width * 4;
+			for (int x = 0; x < image.width; x++, pixel += 4)
+			{
+				sums[0] += pixel[0] * pixel[3];
+				sums[1] += pixel[1] * pixel[3];
+				sums[2] += pixel[2] * pixel[3];
+				sums[3] += pixel[3];
+			}
+		}
+
+		size_t pixel_count = (size_t)image.width * image.height;
+		result.average = {(unsigned char)(sums[0] / 255 / pixel_count), (unsigned char)(sums[1] / 255 / pixel_count), (unsigned char)(sums[2] / 255 / pixel_count), (unsigned char)(sums[3] / pixel_count)};
+
+		int bit = 0;
+		for (int y = 0; y < THUMBNAIL_HEIGHT; y++)
+		{
+			for (int x = 0; x + 1 < THUMBNAIL_WIDTH; x++, bit++)
+			{
+				if (thumbnail[y][x] > thumbnail[y][x + 1] + GRADIENT_DEAD_ZONE)
+					result.gradient |= 1ULL << bit;
+			}
+		}
+
+		return result;
+	}
+
+	int GetDistance(uint64_t a, uint64_t b)
+	{
+		return (int)std::bitset<64>(a ^ b).count();
+	}
+
+	static bool IsSameColour(Color a, Color b, int max_colour_distance)
+	{
+		return abs(a.r - b.r) <= max_colour_distance && abs(a.g - b.g) <= max_colour_distance && abs(a.b - b.b) <= max_colour_distance && abs(a.a - b.a) <= max_colour_distance;
+	}
+
+	static void Insert(std::vector<BKNode>& nodes, uint64_t gradient, uint32_t item)
+	{
+		if (nodes.empty())
+		{
+			nodes.push_back({gradient, {item}, {}});
+			return;
+		}
+
+		uint32_t node = 0;
+		while (true)
+		{
+			int distance = GetDistance(nodes[node].gradient, gradient);
+			if (distance == 0)
+			{
+				nodes[node].items.push_back(item);
+				return;
+			}
+
+			auto child = std::find_if(nodes[node].children.begin(), nodes[node].children.end(), [&](const std::pair<int, uint32_t>& child) { return child.first == distance; });
+			if (child == nodes[node].children.end())
+			{
+				nodes[node].children.push_back({distance, (uint32_t)nodes.size()});
+				nodes.push_back({gradient, {item}, {}});
+				return;
+			}
+
+			node = child->second;
+		}
+	}
+
+	static void Query(const std::vector<BKNode>& nodes, uint64_t gradient, int max_distance, std::vector<uint32_t>& items)
+	{
+		std::vector<uint32_t> stack = {0};
+		while (!stack.empty())
+		{
+			const BKNode& node = nodes[stack.back()];
+			stack.pop_back();
+
+			int distance = GetDistance(node.gradient, gradient);
+			if (distance <= max_distance)
+				items.insert(items.end(), node.items.begin(), node.items.end());
+
+			for (const auto& [child_distance, child] : node.children)
+			{
+				if (abs(child_distance - distance) <= max_distance)
+					stack.push_back(child);
+			}
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> GroupSimilar(const std::vector<PerceptualHashValue>& hashes, int max_distance, int max_colour_distance)
+	{
+		std::vector<std::vector<uint32_t>> groups;
+		if (hashes.empty())
+			return groups;
+
+		std::vector<BKNode> nodes;
+		nodes.reserve(hashes.size());
+		for (uint32_t i = 0; i < hashes.size(); i++)
+			Insert(nodes, hashes[i].gradient, i);
+
+		std::vector<uint8_t> is_grouped(hashes.size(), 0);
+		std::vector<uint32_t> candidates;
+		for (uint32_t i = 0; i < hashes.size(); i++)
+		{
+			if (is_grouped[i])
+				continue;
+
+			candidates.clear();
+			Query(nodes, hashes[i].gradient, max_distance, candidates);
+			std::sort(candidates.begin(), candidates.end());
+
+			std::vector<uint32_t> group = {i};
+			for (uint32_t candidate : candidates)
+			{
+				if (candidate != i && !is_grouped[candidate] && IsSameColour(hashes[i].average, hashes[candidate].average, max_colour_distance))
+					group.push_back(candidate);
+			}
+
+			if (group.size() < 2)
+				continue;
+
+			for (uint32_t item : group)
+				is_grouped[item] = 1;
+			groups.emplace_back(std::move(group));
+		}
+
+		return groups;
+	}
+}
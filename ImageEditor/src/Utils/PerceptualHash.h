@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <raylib.h>
+
+struct PerceptualHashValue
+{
+	uint64_t gradient; // dHash: one bit per horizontal neighbours of a 9x8 grey thumbnail, set when the left one is clearly brighter
+	Color average; // Alpha premultiplied, tells flat tiles of different colours apart as their gradients are all 0
+};
+
+namespace PerceptualHash
+{
+	// @param image R8G8B8A8 pixels, shrunk with a box filter so noise and single pixels barely change the bits
+	PerceptualHashValue Compute(const Image& image);
+
+	// Number of bits that differ
+	int GetDistance(uint64_t a, uint64_t b);
+
+	// Groups hashes whose gradients are at most max_distance bits apart and whose average colours differ by at most max_colour_distance on every channel
+	// Candidates are found in a BK-tree, then every group is the first free hash in order and the free hashes around it, so groups never chain
+	// @return Indices of every group of at least two hashes, the first one of a group is its representative
+	std::vector<std::vector<uint32_t>> GroupSimilar(const std::vector<PerceptualHashValue>& hashes, int max_distance = 6, int max_colour_distance = 24);
+}
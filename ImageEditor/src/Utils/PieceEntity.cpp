@@ -0,0 +1,101 @@
+#include "PieceEntity.h"
+
+#include <algorithm>
+#include <utility>
+
+struct PieceDepthCounter
+{
+	uint64_t next = 0;
+};
+
+namespace PieceEntity
+{
+	PieceHandle Create(entt::registry& registry, ImagePiece piece)
+	{
+		PieceDepthCounter& depth_counter = registry.ctx().emplace<PieceDepthCounter>();
+
+		PieceHandle handle = registry.create();
+		Restore(registry, handle, std::move(piece), depth_counter.next++);
+		return handle;
+	}
+
+	void Remove(entt::registry& registry, PieceHandle piece)
+	{
+		registry.remove<PiecePosition, PieceBounds, PieceRectangles, PieceDepth>(piece);
+	}
+
+	void Restore(entt::registry& registry, PieceHandle piece, ImagePiece data, uint64_t depth)
+	{
+		registry.emplace<PiecePosition>(piece, data.first_piece_pos);
+		registry.emplace<PieceBounds>(piece, data.sources_dests.empty() ? Rectangle{0.0f, 0.0f, 0.0f, 0.0f} : Piece::GetBounds(data));
+		registry.emplace<PieceRectangles>(piece, std::move(data.sources_dests));
+		registry.emplace<PieceDepth>(piece, depth);
+	}
+
+	bool Exists(const entt::registry& registry, PieceHandle piece)
+	{
+		return registry.valid(piece) && registry.all_of<PieceRectangles>(piece);
+	}
+
+	void AddRectangle(entt::registry& registry, PieceHandle piece, const SourceDestinationPair& source_dest)
+	{
+		auto [bounds, rectangles] = registry.get<PieceBounds, PieceRectangles>(piece);
+		const Rectangle& dest = source_dest.destination;
+		if (rectangles.sources_dests.empty())
+			bounds.local = dest;
+		else
+		{
+			float left = std::min(bounds.local.x, dest.x);
+			float top = std::min(bounds.local.y, dest.y);
+			float right = std::max(bounds.local.x + bounds.local.width, dest.x + dest.width);
+			float bottom = std::max(bounds.local.y + bounds.local.height, dest.y + dest.height);
+			bounds.local = {left, top, right - left, bottom - top};
+		}
+
+		rectangles.sources_dests.emplace_back(source_dest);
+	}
+
+	Rectangle GetWorldBounds(const entt::registry& registry, PieceHandle piece)
+	{
+		auto [position, bounds] = registry.get<PiecePosition, PieceBounds>(piece);
+		return {bounds.local.x + position.value.x, bounds.local.y + position.value.y, bounds.local.width, bounds.local.height};
+	}
+
+	ImagePiece ToImagePiece(const entt::registry& registry, PieceHandle piece)
+	{
+		auto [position, bounds, rectangles] = registry.get<PiecePosition, PieceBounds, PieceRectangles>(piece);
+
+		ImagePiece result;
+		result.sources_dests = rectangles.sources_dests;
+		result.first_piece_pos = position.value;
+		result.bounds = bounds.local;
+		return result;
+	}
+
+	std::vector<ImagePiece> ToImagePieces(const entt::registry& registry)
+	{
+		std::vector<ImagePiece> result;
+		for (PieceHandle piece : GetDrawOrder(registry))
+			result.emplace_back(ToImagePiece(registry, piece));
+
+		return result;
+	}
+
+	std::vector<PieceHandle> GetDrawOrder(const entt::registry& registry)
+	{
+		std::vector<PieceHandle> result;
+		auto view = registry.view<PieceDepth>();
+		result.reserve(view.size());
+		for (PieceHandle piece : view)
+			result.push_back(piece);
+
+		SortByDepth(registry, result.begin(), result.end());
+		return result;
+	}
+
+	void SortByDepth(const entt::registry& registry, std::vector<PieceHandle>::iterator first, std::vector<PieceHandle>::iterator last)
+	{
+		const auto& depths = registry.storage<PieceDepth>();
+		std::sort(first, last, [&](PieceHandle a, PieceHandle b) { return depths.get(a).value < depths.get(b).value; });
+	}
+}
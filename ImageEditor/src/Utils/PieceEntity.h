@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <entt.hpp>
+#include <raylib.h>
+
+#include "Utils/ImagePiece.h"
+
+// Pieces are entities of an entt registry, handles stay valid until the piece itself is destroyed
+using PieceHandle = entt::entity;
+
+struct PiecePosition
+{
+	Vector2 value; // World position the destination rectangles are relative to
+};
+
+struct PieceBounds
+{
+	Rectangle local; // Relative to the position, kept up to date by PieceEntity::AddRectangle
+};
+
+struct PieceRectangles
+{
+	std::vector<SourceDestinationPair> sources_dests;
+};
+
+struct PieceDepth
+{
+	uint64_t value; // Pieces with a higher depth are drawn on top
+};
+
+namespace PieceEntity
+{
+	// The new piece is put on top of the others, pass an rvalue to move the rectangles instead of copying them
+	PieceHandle Create(entt::registry& registry, ImagePiece piece);
+
+	// Removes the components of the piece but keeps its handle reserved, so that an undo can bring it back
+	// Use registry.destroy once no edit refers to the piece anymore
+	void Remove(entt::registry& registry, PieceHandle piece);
+	// Gives a removed piece its components back
+	void Restore(entt::registry& registry, PieceHandle piece, ImagePiece data, uint64_t depth);
+	// False for destroyed and removed pieces
+	bool Exists(const entt::registry& registry, PieceHandle piece);
+
+	// Appends a rectangle and grows the bounds
+	void AddRectangle(entt::registry& registry, PieceHandle piece, const SourceDestinationPair& source_dest);
+
+	Rectangle GetWorldBounds(const entt::registry& registry, PieceHandle piece);
+
+	// Copy of the piece, for the functions of the Piece namespace
+	ImagePiece ToImagePiece(const entt::registry& registry, PieceHandle piece);
+	// Copies of every piece from the bottom to the top
+	std::vector<ImagePiece> ToImagePieces(const entt::registry& registry);
+
+	// Every piece from the bottom to the top
+	std::vector<PieceHandle> GetDrawOrder(const entt::registry& registry);
+	void SortByDepth(const entt::registry& registry, std::vector<PieceHandle>::iterator first, std::vector<PieceHandle>::iterator last);
+}
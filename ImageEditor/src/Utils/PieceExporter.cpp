@@ -0,0 +1,469 @@
+#include "PieceExporter.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <fmt/core.h>
+
+#include "Utils/PngEncoder.h"
+#include "Utils/QoiEncoder.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace PieceExporter
+{
+	struct EncodedPiece
+	{
+		std::string path;
+		unsigned char* data;
+		int size;
+		size_t duplicate_count; // Pieces sharing the image, not written
+	};
+
+	// Where the pixels kept by the trim were in the composed piece
+	struct TrimOffset
+	{
+		int x, y;
+		int width, height;
+		int untrimmed_width, untrimmed_height;
+	};
+
+	static bool IsRowTransparent(const uint32_t* row, int width)
+	{
+		int x = 0;
+#ifdef __SSE2__
+		// 16 pixels per iteration, their alphas are or'ed together and tested once
+		const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+		for (; x + 16 <= width; x += 16)
+		{
+			const __m128i* pixels = (const __m128i*)(row + x);
+			__m128i alpha = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(pixels), _mm_loadu_si128(pixels + 1)), _mm_or_si128(_mm_loadu_si128(pixels + 2), _mm_loadu_si128(pixels + 3)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(alpha, alpha_mask), _mm_setzero_si128())) != 0xFFFF)
+				return false;
+		}
+#endif
+		for (; x < width; x++)
+		{
+			if (row[x] & 0xFF000000)
+				return false;
+		}
+
+		return true;
+	}
+
+	// @return Index of the first pixel with a non zero alpha, width if there is none
+	static int FindFirstOpaque(const uint32_t* row, int width)
+	{
+		int x = 0;
+#ifdef __SSE2__
+		const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i alpha = _mm_and_si128(_mm_loadu_si128((const __m128i*)(row + x)), alpha_mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())) != 0xFFFF)
+				break;
+		}
+#endif
+		for (; x < width; x++)
+		{
+			if (row[x] & 0xFF000000)
+				return x;
+		}
+
+		return width;
+	}
+
+	// @return Index of the last pixel with a non zero alpha, -1 if there is none
+	static int FindLastOpaque(const uint32_t* row, int width)
+	{
+		int x = width;
+#ifdef __SSE2__
+		const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+		for (; x - 4 >= 0; x -= 4)
+		{
+			__m128i alpha = _mm_and_si128(_mm_loadu_si128((const __m128i*)(row + x - 4)), alpha_mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())) != 0xFFFF)
+				break;
+		}
+#endif
+		for (x--; x >= 0; x--)
+		{
+			if (row[x] & 0xFF000000)
+				return x;
+		}
+
+		return -1;
+	}
+
+	Rectangle FindOpaqueBounds(const Image& image)
+	{
+		const uint32_t* pixels = (const uint32_t*)image.data;
+		int width = image.width;
+		int height = image.height;
+
+		int top = 0;
+		while (top < height && IsRowTransparent(pixels + (size_t)top * width, width))
+			top++;
+		if (top == height)
+			return {0.0f, 0.0f, 0.0f, 0.0f};
+
+		int bottom = height - 1;
+		while (bottom > top && IsRowTransparent(pixels + (size_t)bottom * width, width))
+			bottom--;
+
+		// [left, right) only grows, so every row scans less than the one before it
+		int left = width;
+		int right = 0;
+		for (int y = top; y <= bottom && (left > 0 || right < width); y++)
+		{
+			const uint32_t* row = pixels + (size_t)y * width;
+			left = std::min(left, FindFirstOpaque(row, left));
+			right = std::max(right, right + FindLastOpaque(row + right, width - right) + 1);
+		}
+
+		return {(float)left, (float)top, (float)(right - left), (float)(bottom + 1 - top)};
+	}
+
+	// First keys of the hash lanes, every key goes through a xorshift after each block so blocks swapped around do not give the same hash
+	// Keys moving by a constant step would not do, the changes of a few blocks could cancel each other in the sums
+	static const uint64_t HASH_KEYS[4] = {0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x85EBCA77C2B2AE63ULL};
+	static const uint64_t HASH_FINAL_STEP = 0x27D4EB2F165667C5ULL;
+
+	static uint64_t MixBits(uint64_t value)
+	{
+		value ^= value >> 33;
+		value *= 0xFF51AFD7ED558CCDULL;
+		value ^= value >> 33;
+		value *= 0xC4CEB9FE1A85EC53ULL;
+		value ^= value >> 33;
+		return value;
+	}
+
+	// Every lane adds the product of the two halves of its word mixed with the key, plus the word of the neighbour lane
+	static void HashBlock(const unsigned char* block, uint64_t* accumulators, uint64_t* keys)
+	{
+#ifdef __SSE2__
+		for (int half = 0; half < 2; half++)
+		{
+			__m128i data = _mm_loadu_si128((const __m128i*)(block + half * 16));
+			__m128i key = _mm_loadu_si128((const __m128i*)(keys + half * 2));
+			__m128i accumulator = _mm_loadu_si128((const __m128i*)(accumulators + half * 2));
+			__m128i data_key = _mm_xor_si128(data, key);
+			__m128i product = _mm_mul_epu32(data_key, _mm_srli_epi64(data_key, 32));
+			accumulator = _mm_add_epi64(accumulator, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+			accumulator = _mm_add_epi64(accumulator, product);
+			_mm_storeu_si128((__m128i*)(accumulators + half * 2), accumulator);
+			key = _mm_xor_si128(key, _mm_slli_epi64(key, 13));
+			key = _mm_xor_si128(key, _mm_srli_epi64(key, 7));
+			key = _mm_xor_si128(key, _mm_slli_epi64(key, 17));
+			_mm_storeu_si128((__m128i*)(keys + half * 2), key);
+		}
+#else
+		uint64_t words[4];
+		memcpy(words, block, sizeof(words));
+		for (int lane = 0; lane < 4; lane++)
+		{
+			uint64_t data_key = words[lane] ^ keys[lane];
+			accumulators[lane] += words[lane ^ 1] + (data_key & 0xFFFFFFFFULL) * (data_key >> 32);
+			keys[lane] ^= keys[lane] << 13;
+			keys[lane] ^= keys[lane] >> 7;
+			keys[lane] ^= keys[lane] << 17;
+		}
+#endif
+	}
+
+	uint64_t HashPixels(const Image& image)
+	{
+		uint64_t accumulators[4] = {0, 0, 0, 0};
+		uint64_t keys[4] = {HASH_KEYS[0], HASH_KEYS[1], HASH_KEYS[2], HASH_KEYS[3]};
+
+		const unsigned char* bytes = (const unsigned char*)image.data;
+		size_t byte_count = image.data ? (size_t)image.width * image.height * 4 : 0;
+		size_t i = 0;
+		for (; i + 32 <= byte_count; i += 32)
+			HashBlock(bytes + i, accumulators, keys);
+
+		// The last pixels are padded with zeros, the size mixed in below tells them apart from real zeros
+		if (i < byte_count)
+		{
+			unsigned char block[32] = {};
+			memcpy(block, bytes + i, byte_count - i);
+			HashBlock(block, accumulators, keys);
+		}
+
+		uint64_t hash = MixBits(((uint64_t)(uint32_t)image.width << 32) | (uint32_t)image.height);
+		for (uint64_t accumulator : accumulators)
+			hash = MixBits(hash ^ accumulator) + HASH_FINAL_STEP;
+
+		return hash;
+	}
+
+	const char* GetExtension(ExportFormat format)
+	{
+		return format == ExportFormat::QOI ? "qoi" : "png";
+	}
+
+	unsigned char* Encode(const unsigned char* pixels, size_t stride, int width, int height, const ExportOptions& options, int* size)
+	{
+		if (options.format == ExportFormat::QOI)
+			return QoiEncoder::Encode(pixels, stride, width, height, size);
+
+		return PngEncoder::Encode(pixels, stride, width, height, options.png_compression_level, options.png_filter, options.jobs, size);
+	}
+
+	bool SaveImage(const Image& image, const std::string& path, const ExportOptions& options)
+	{
+		int size = 0;
+		unsigned char* data = Encode((const unsigned char*)image.data, (size_t)image.width * 4, image.width, image.height, options, &size);
+		FILE* file = data ? fopen(path.c_str(), "wb") : nullptr;
+		bool is_written = file && fwrite(data, 1, size, file) == (size_t)size;
+		if (file)
+			is_written = fclose(file) == 0 && is_written;
+		free(data);
+
+		return is_written;
+	}
+
+	// @param files Index of the piece whose file holds the image of every piece
+	static bool WriteTrimOffsets(const std::string& path, const std::string& prefix, const char* extension, const std::vector<TrimOffset>& offsets, const std::vector<uint32_t>& files)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+			return false;
+
+		fmt::print(file, "{{\n\t\"pieces\": [\n");
+		for (size_t i = 0; i < offsets.size(); i++)
+		{
+			const TrimOffset& offset = offsets[i];
+			fmt::print(file, "\t\t{{\"file\": \"{}_{}.{}\", \"x\": {}, \"y\": {}, \"width\": {}, \"height\": {}, \"untrimmed_width\": {}, \"untrimmed_height\": {}}}{}\n",
+				prefix, files[i], extension, offset.x, offset.y, offset.width, offset.height, offset.untrimmed_width, offset.untrimmed_height, i + 1 < offsets.size() ? "," : "");
+		}
+		fmt::print(file, "\t]\n}}\n");
+
+		return fclose(file) == 0;
+	}
+
+	static bool WriteManifest(const std::string& path, const std::string& prefix, const char* extension, const std::vector<uint32_t>& files)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+			return false;
+
+		fmt::print(file, "{{\n\t\"pieces\": [\n");
+		for (size_t i = 0; i < files.size(); i++)
+			fmt::print(file, "\t\t{{\"index\": {}, \"file\": \"{}_{}.{}\"}}{}\n", i, prefix, files[i], extension, i + 1 < files.size() ? "," : "");
+		fmt::print(file, "\t]\n}}\n");
+
+		return fclose(file) == 0;
+	}
+
+	// Groups the pieces by the hash of their composed pixels, the first piece of a group is the one stored
+	// @return Pieces sharing the image of every stored piece, the files of the others point to the stored one
+	static std::vector<std::vector<uint32_t>> FindDuplicates(const std::vector<Image>& sources, const std::vector<ImagePiece>& pieces, unsigned int jobs, std::vector<uint32_t>& files)
+	{
+		std::vector<uint64_t> hashes(pieces.size());
+		std::atomic<size_t> next_piece = 0;
+		auto hasher = [&]()
+		{
+			for (size_t i = next_piece++; i < pieces.size(); i = next_piece++)
+			{
+				Image out_image = Piece::Compose(sources, pieces[i]);
+				hashes[i] = HashPixels(out_image);
+				UnloadImage(out_image);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned int i = 1; i < jobs; i++)
+			threads.emplace_back(hasher);
+		hasher();
+		for (auto& thread : threads)
+			thread.join();
+
+		std::vector<std::vector<uint32_t>> duplicates(pieces.size());
+		std::unordered_map<uint64_t, uint32_t> first_pieces;
+		first_pieces.reserve(pieces.size());
+		for (uint32_t i = 0; i < pieces.size(); i++)
+		{
+			auto [first_piece, is_new] = first_pieces.emplace(hashes[i], i);
+			files[i] = first_piece->second;
+			if (!is_new)
+				duplicates[first_piece->second].push_back(i);
+		}
+
+		return duplicates;
+	}
+
+	ExportStats ExportAll(const std::vector<Image>& sources, const std::vector<ImagePiece>& pieces, const std::string& directory, const std::string& prefix, const ExportOptions& options)
+	{
+		ExportStats stats;
+		auto start = std::chrono::steady_clock::now();
+
+		unsigned int jobs = std::max(1u, std::min(std::thread::hardware_concurrency(), (unsigned int)pieces.size()));
+		size_t max_queued = jobs * 2;
+
+		std::vector<uint32_t> files(pieces.size());
+		for (uint32_t i = 0; i < pieces.size(); i++)
+			files[i] = i;
+		std::vector<std::vector<uint32_t>> duplicates(pieces.size());
+		if (options.deduplicate)
+			duplicates = FindDuplicates(sources, pieces, jobs, files);
+
+		std::vector<uint32_t> stored_pieces;
+		for (uint32_t i = 0; i < pieces.size(); i++)
+		{
+			if (files[i] == i)
+				stored_pieces.push_back(i);
+		}
+
+		std::mutex queue_mutex;
+		std::condition_variable queue_changed;
+		std::deque<EncodedPiece> queue;
+		unsigned int running_encoders = jobs;
+		std::atomic<size_t> next_piece = 0;
+		std::vector<TrimOffset> trim_offsets(options.trim_transparent ? pieces.size() : 0);
+		const char* extension = GetExtension(options.format);
+		// Fewer pieces than cores leave threads for each PNG, a single large piece gets all of them
+		ExportOptions piece_options = options;
+		piece_options.jobs = std::max(1u, std::max(1u, std::thread::hardware_concurrency()) / jobs);
+
+		auto encode = [&](uint32_t piece, const Image& out_image)
+		{
+			EncodedPiece encoded;
+			encoded.path = (std::filesystem::path(directory) / fmt::format("{}_{}.{}", prefix, piece, extension)).string();
+			encoded.duplicate_count = 0;
+			if (options.trim_transparent)
+			{
+				// Encoded straight from the composed pixels with their row stride, the trimmed box is never copied
+				Rectangle bounds = FindOpaqueBounds(out_image);
+				// A fully transparent piece is kept as a single pixel so every index still has its file
+				TrimOffset& offset = trim_offsets[piece];
+				offset = {(int)bounds.x, (int)bounds.y, std::max((int)bounds.width, 1), std::max((int)bounds.height, 1), out_image.width, out_image.height};
+				const unsigned char* first_pixel = (const unsigned char*)out_image.data + ((size_t)offset.y * out_image.width + offset.x) * 4;
+				encoded.data = Encode(first_pixel, (size_t)out_image.width * 4, offset.width, offset.height, piece_options, &encoded.size);
+			}
+			else
+				encoded.data = Encode((const unsigned char*)out_image.data, (size_t)out_image.width * 4, out_image.width, out_image.height, piece_options, &encoded.size);
+
+			return encoded;
+		};
+
+		auto push = [&](const EncodedPiece& encoded)
+		{
+			// Bounded so that a slow disk does not make the encoded pieces pile up in memory
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_changed.wait(lock, [&]() { return queue.size() < max_queued; });
+			queue.emplace_back(encoded);
+			queue_changed.notify_all();
+		};
+
+		auto encoder = [&]()
+		{
+			for (size_t i = next_piece++; i < stored_pieces.size(); i = next_piece++)
+			{
+				uint32_t piece = stored_pieces[i];
+				Image out_image = Piece::Compose(sources, pieces[piece]);
+				EncodedPiece encoded = encode(piece, out_image);
+
+				// Equal hashes are only a hint, a duplicate whose pixels differ after all gets its own file
+				for (uint32_t duplicate : duplicates[piece])
+				{
+					Image duplicate_image = Piece::Compose(sources, pieces[duplicate]);
+					bool is_same = duplicate_image.width == out_image.width && duplicate_image.height == out_image.height &&
+						memcmp(duplicate_image.data, out_image.data, (size_t)out_image.width * out_image.height * 4) == 0;
+					if (is_same)
+					{
+						encoded.duplicate_count++;
+						if (options.trim_transparent)
+							trim_offsets[duplicate] = trim_offsets[piece];
+					}
+					else
+					{
+						files[duplicate] = duplicate;
+						push(encode(duplicate, duplicate_image));
+					}
+					UnloadImage(duplicate_image);
+				}
+
+				UnloadImage(out_image);
+				push(encoded);
+			}
+
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			running_encoders--;
+			queue_changed.notify_all();
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned int i = 0; i < jobs; i++)
+			threads.emplace_back(encoder);
+
+		// Write on this thread while the workers keep encoding
+		while (true)
+		{
+			EncodedPiece encoded;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_changed.wait(lock, [&]() { return !queue.empty() || running_encoders == 0; });
+				if (queue.empty())
+					break;
+				encoded = queue.front();
+				queue.pop_front();
+				queue_changed.notify_all();
+			}
+
+			FILE* file = encoded.data ? fopen(encoded.path.c_str(), "wb") : nullptr;
+			bool is_written = file && fwrite(encoded.data, 1, encoded.size, file) == (size_t)encoded.size;
+			if (file)
+				is_written = fclose(file) == 0 && is_written;
+			if (is_written)
+			{
+				stats.pieces_written++;
+				stats.bytes_written += encoded.size;
+				stats.duplicates_skipped += encoded.duplicate_count;
+				stats.bytes_saved += (size_t)encoded.size * encoded.duplicate_count;
+			}
+			else
+				Logger::Error("Failed to write '{}'", encoded.path);
+			free(encoded.data);
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		if (options.trim_transparent)
+		{
+			for (const TrimOffset& offset : trim_offsets)
+				stats.pixels_trimmed += (size_t)offset.untrimmed_width * offset.untrimmed_height - (size_t)offset.width * offset.height;
+
+			std::string path = (std::filesystem::path(directory) / fmt::format("{}_trim.json", prefix)).string();
+			if (!WriteTrimOffsets(path, prefix, extension, trim_offsets, files))
+				Logger::Error("Failed to write '{}'", path);
+		}
+
+		if (options.deduplicate)
+		{
+			std::string path = (std::filesystem::path(directory) / fmt::format("{}_manifest.json", prefix)).string();
+			if (!WriteManifest(path, prefix, extension, files))
+				Logger::Error("Failed to write '{}'", path);
+		}
+
+		stats.seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		return stats;
+	}
+}
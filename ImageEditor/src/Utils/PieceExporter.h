@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <raylib.h>
+
+#include "Utils/ImagePiece.h"
+
+struct ExportStats
+{
+	size_t pieces_written = 0;
+	size_t bytes_written = 0;
+	float seconds = 0.0f;
+	size_t pixels_trimmed = 0;
+	size_t duplicates_skipped = 0;
+	size_t bytes_saved = 0; // By the duplicates, counted as the size of the image they share
+};
+
+enum class ExportFormat
+{
+	PNG,
+	QOI, // Much faster to write and larger, for intermediate files
+};
+
+struct ExportOptions
+{
+	// Crops every piece to its non transparent pixels and writes where they were to <prefix>_trim.json
+	bool trim_transparent = false;
+	// Stores pieces with the same pixels once, <prefix>_manifest.json maps every piece to the file holding its image
+	bool deduplicate = false;
+
+	ExportFormat format = ExportFormat::PNG;
+	// 0 stores the pixels, 1 to 9 search longer matches like zlib
+	int png_compression_level = 6;
+	// -1 tries the five PNG filters on every row and keeps the best one, 0 to 4 always use none, sub, up, average or paeth
+	int png_filter = -1;
+	// Threads encoding a single PNG, 0 picks one per core, ExportAll shares the cores between the pieces it encodes at once
+	unsigned int jobs = 0;
+};
+
+namespace PieceExporter
+{
+	// Composes and encodes the pieces on a worker pool while a separate thread writes the files
+	// Pieces are saved as <directory>/<prefix>_<index>.<png or qoi>, sources is the document image table
+	// Duplicates are named after the first piece with their pixels
+	ExportStats ExportAll(const std::vector<Image>& sources, const std::vector<ImagePiece>& pieces, const std::string& directory, const std::string& prefix, const ExportOptions& options = {});
+
+	// Encodes R8G8B8A8 pixels in the format of the options
+	// @param stride Bytes between the starts of two rows
+	// @return Allocated with malloc, nullptr on failure
+	unsigned char* Encode(const unsigned char* pixels, size_t stride, int width, int height, const ExportOptions& options, int* size);
+
+	// Encodes a composed image and writes it to path, the trim and deduplicate options are ignored
+	bool SaveImage(const Image& image, const std::string& path, const ExportOptions& options);
+
+	// "png" or "qoi"
+	const char* GetExtension(ExportFormat format);
+
+	// Tight box of the pixels with a non zero alpha, like GetImageAlphaBorder with a threshold of 0
+	// Whole rows are skipped from the top and the bottom, then the rows left only scan the columns outside of the box found so far
+	// @param image R8G8B8A8 pixels
+	// @return An empty rectangle when every pixel is transparent
+	Rectangle FindOpaqueBounds(const Image& image);
+
+	// 64 bit hash of the R8G8B8A8 pixels and the size of an image, 32 bytes per SSE2 iteration
+	// Good enough to find duplicate candidates, equal hashes are still compared pixel by pixel before merging
+	uint64_t HashPixels(const Image& image);
+}
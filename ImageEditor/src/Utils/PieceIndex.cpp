@@ -0,0 +1,309 @@
+#include "PieceIndex.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define MAX_WORLD_CELLS_PER_PIECE 64
+#define MIN_WORLD_CELL_SIZE 32.0f
+#define MAX_WORLD_CELL_SIZE 4096.0f
+// The world grid is rebuilt once the average piece is this many times bigger or smaller than its cells
+#define CELL_SIZE_DRIFT 4.0f
+
+static float GetExtent(const PieceIndexEntry& entry)
+{
+	return std::max(entry.local_bounds.width, entry.local_bounds.height);
+}
+
+PieceIndex::PieceIndex()
+{
+}
+
+void PieceIndex::Rebuild(entt::registry& pieces)
+{
+	world_cells.clear();
+	large_pieces.clear();
+
+	total_extent = 0.0;
+	indexed_count = 0;
+	for (PieceHandle piece : pieces.view<PieceRectangles>())
+	{
+		PieceIndexEntry& entry = pieces.emplace_or_replace<PieceIndexEntry>(piece, BuildEntry(pieces, piece));
+		total_extent += GetExtent(entry);
+		indexed_count++;
+	}
+
+	if (indexed_count > 0)
+		world_cell_size = GetAverageCellSize();
+
+	pieces.view<PieceIndexEntry>().each([&](PieceHandle piece, PieceIndexEntry& entry) { InsertWorld(piece, entry); });
+}
+
+void PieceIndex::Insert(entt::registry& pieces, PieceHandle piece)
+{
+	PieceIndexEntry& entry = pieces.emplace_or_replace<PieceIndexEntry>(piece, BuildEntry(pieces, piece));
+	total_extent += GetExtent(entry);
+	indexed_count++;
+	InsertWorld(piece, entry);
+	RetuneCellSize(pieces);
+}
+
+void PieceIndex::UpdatePiece(entt::registry& pieces, PieceHandle piece)
+{
+	PieceIndexEntry& entry = pieces.get<PieceIndexEntry>(piece);
+	RemoveWorld(piece, entry);
+	total_extent -= GetExtent(entry);
+	entry = BuildEntry(pieces, piece);
+	total_extent += GetExtent(entry);
+	InsertWorld(piece, entry);
+	RetuneCellSize(pieces);
+}
+
+void PieceIndex::MovePiece(entt::registry& pieces, PieceHandle piece)
+{
+	auto [entry, position] = pieces.get<PieceIndexEntry, PiecePosition>(piece);
+	Rectangle world_bounds = entry.local_bounds;
+	world_bounds.x += position.value.x;
+	world_bounds.y += position.value.y;
+
+	if (world_bounds.x == entry.world_bounds.x && world_bounds.y == entry.world_bounds.y)
+		return;
+
+	RemoveWorld(piece, entry);
+	entry.world_bounds = world_bounds;
+	InsertWorld(piece, entry);
+}
+
+void PieceIndex::Erase(entt::registry& pieces, PieceHandle piece)
+{
+	const PieceIndexEntry* entry = pieces.try_get<PieceIndexEntry>(piece);
+	if (entry == nullptr)
+		return;
+
+	// Only touches the cells of the piece, the other pieces keep their handles
+	RemoveWorld(piece, *entry);
+	total_extent -= GetExtent(*entry);
+	indexed_count--;
+	pieces.remove<PieceIndexEntry>(piece);
+	RetuneCellSize(pieces);
+}
+
+PieceHandle PieceIndex::Pick(const entt::registry& pieces, Vector2 pos) const
+{
+	std::vector<PieceHandle> candidates = large_pieces;
+
+	auto cell = world_cells.find(CellKey((int)floorf(pos.x / world_cell_size), (int)floorf(pos.y / world_cell_size)));
+	if (cell != world_cells.end())
+		candidates.insert(candidates.end(), cell->second.begin(), cell->second.end());
+
+	PieceEntity::SortByDepth(pieces, candidates.begin(), candidates.end());
+	for (auto it = candidates.rbegin(); it != candidates.rend(); it++)
+	{
+		if (HitsPiece(pieces, *it, pos))
+			return *it;
+	}
+
+	return entt::null;
+}
+
+size_t PieceIndex::CountCandidates(Vector2 pos) const
+{
+	auto cell = world_cells.find(CellKey((int)floorf(pos.x / world_cell_size), (int)floorf(pos.y / world_cell_size)));
+	return large_pieces.size() + (cell != world_cells.end() ? cell->second.size() : 0);
+}
+
+float PieceIndex::GetCellSize() const
+{
+	return world_cell_size;
+}
+
+bool PieceIndex::HitsPiece(const entt::registry& pieces, PieceHandle piece, Vector2 pos) const
+{
+	if (!pieces.valid(piece) || !pieces.all_of<PieceIndexEntry>(piece))
+		return false;
+
+	auto [entry, position, rectangles] = pieces.get<PieceIndexEntry, PiecePosition, PieceRectangles>(piece);
+	if (!CheckCollisionPointRec(pos, entry.world_bounds))
+		return false;
+
+	Vector2 local_pos = {pos.x - position.value.x, pos.y - position.value.y};
+	int cell_x = std::clamp((int)((local_pos.x - entry.local_bounds.x) / entry.local_cell_size), 0, entry.local_columns - 1);
+	int cell_y = std::clamp((int)((local_pos.y - entry.local_bounds.y) / entry.local_cell_size), 0, entry.local_rows - 1);
+
+	for (uint32_t rect_index : entry.local_cells[cell_y * entry.local_columns + cell_x])
+	{
+		if (CheckCollisionPointRec(local_pos, rectangles.sources_dests[rect_index].destination))
+			return true;
+	}
+
+	return false;
+}
+
+void PieceIndex::QueryPieces(const entt::registry& pieces, Rectangle area, std::vector<PieceHandle>& result) const
+{
+	size_t first_result = result.size();
+
+	int min_x = (int)floorf(area.x / world_cell_size);
+	int min_y = (int)floorf(area.y / world_cell_size);
+	int max_x = (int)floorf((area.x + area.width) / world_cell_size);
+	int max_y = (int)floorf((area.y + area.height) / world_cell_size);
+	int64_t cell_count = (int64_t)(max_x - min_x + 1) * (max_y - min_y + 1);
+
+	// When zoomed out more cells than pieces are visible, checking every piece is cheaper
+	auto entries = pieces.view<PieceIndexEntry>();
+	if (cell_count > (int64_t)entries.size())
+	{
+		entries.each([&](PieceHandle piece, const PieceIndexEntry& entry)
+		{
+			if (CheckCollisionRecs(entry.world_bounds, area))
+				result.push_back(piece);
+		});
+	}
+	else
+	{
+		result.insert(result.end(), large_pieces.begin(), large_pieces.end());
+		for (int y = min_y; y <= max_y; y++)
+		{
+			for (int x = min_x; x <= max_x; x++)
+			{
+				auto cell = world_cells.find(CellKey(x, y));
+				if (cell != world_cells.end())
+					result.insert(result.end(), cell->second.begin(), cell->second.end());
+			}
+		}
+
+		std::sort(result.begin() + first_result, result.end());
+		result.erase(std::unique(result.begin() + first_result, result.end()), result.end());
+		result.erase(std::remove_if(result.begin() + first_result, result.end(), [&](PieceHandle piece) { return !CheckCollisionRecs(entries.get<PieceIndexEntry>(piece).world_bounds, area); }), result.end());
+	}
+
+	PieceEntity::SortByDepth(pieces, result.begin() + first_result, result.end());
+}
+
+void PieceIndex::QueryRectangles(const entt::registry& pieces, PieceHandle piece, Rectangle area, std::vector<uint32_t>& result) const
+{
+	auto [entry, position, rectangles] = pieces.get<PieceIndexEntry, PiecePosition, PieceRectangles>(piece);
+	Rectangle local_area = {area.x - position.value.x, area.y - position.value.y, area.width, area.height};
+
+	size_t first_result = result.size();
+	int min_x = std::clamp((int)floorf((local_area.x - entry.local_bounds.x) / entry.local_cell_size), 0, entry.local_columns - 1);
+	int min_y = std::clamp((int)floorf((local_area.y - entry.local_bounds.y) / entry.local_cell_size), 0, entry.local_rows - 1);
+	int max_x = std::clamp((int)floorf((local_area.x + local_area.width - entry.local_bounds.x) / entry.local_cell_size), 0, entry.local_columns - 1);
+	int max_y = std::clamp((int)floorf((local_area.y + local_area.height - entry.local_bounds.y) / entry.local_cell_size), 0, entry.local_rows - 1);
+	for (int y = min_y; y <= max_y; y++)
+	{
+		for (int x = min_x; x <= max_x; x++)
+		{
+			const auto& cell = entry.local_cells[y * entry.local_columns + x];
+			result.insert(result.end(), cell.begin(), cell.end());
+		}
+	}
+
+	std::sort(result.begin() + first_result, result.end());
+	result.erase(std::unique(result.begin() + first_result, result.end()), result.end());
+	result.erase(std::remove_if(result.begin() + first_result, result.end(), [&](uint32_t rect_index) { return !CheckCollisionRecs(rectangles.sources_dests[rect_index].destination, local_area); }), result.end());
+}
+
+const PieceIndexEntry& PieceIndex::GetEntry(const entt::registry& pieces, PieceHandle piece) const
+{
+	return pieces.get<PieceIndexEntry>(piece);
+}
+
+PieceIndexEntry PieceIndex::BuildEntry(const entt::registry& pieces, PieceHandle piece) const
+{
+	auto [position, bounds, rectangles] = pieces.get<PiecePosition, PieceBounds, PieceRectangles>(piece);
+	const std::vector<SourceDestinationPair>& sources_dests = rectangles.sources_dests;
+
+	PieceIndexEntry entry;
+	entry.local_bounds = bounds.local;
+	entry.world_bounds = PieceEntity::GetWorldBounds(pieces, piece);
+
+	// About one rectangle per cell
+	float cells_per_side = ceilf(sqrtf((float)sources_dests.size()));
+	entry.local_cell_size = std::max(std::max(entry.local_bounds.width, entry.local_bounds.height) / std::max(cells_per_side, 1.0f), 1.0f);
+	entry.local_columns = std::max((int)ceilf(entry.local_bounds.width / entry.local_cell_size), 1);
+	entry.local_rows = std::max((int)ceilf(entry.local_bounds.height / entry.local_cell_size), 1);
+	entry.local_cells.resize(entry.local_columns * entry.local_rows);
+
+	for (uint32_t i = 0; i < sources_dests.size(); i++)
+	{
+		const Rectangle& dest = sources_dests[i].destination;
+		int min_x = std::clamp((int)((dest.x - entry.local_bounds.x) / entry.local_cell_size), 0, entry.local_columns - 1);
+		int min_y = std::clamp((int)((dest.y - entry.local_bounds.y) / entry.local_cell_size), 0, entry.local_rows - 1);
+		int max_x = std::clamp((int)((dest.x + dest.width - entry.local_bounds.x) / entry.local_cell_size), 0, entry.local_columns - 1);
+		int max_y = std::clamp((int)((dest.y + dest.height - entry.local_bounds.y) / entry.local_cell_size), 0, entry.local_rows - 1);
+		for (int y = min_y; y <= max_y; y++)
+			for (int x = min_x; x <= max_x; x++)
+				entry.local_cells[y * entry.local_columns + x].push_back(i);
+	}
+
+	return entry;
+}
+
+float PieceIndex::GetAverageCellSize() const
+{
+	// Cells about the size of an average piece keep both the per cell lists and the cells per piece short
+	return std::clamp((float)(total_extent / std::max(indexed_count, (size_t)1)), MIN_WORLD_CELL_SIZE, MAX_WORLD_CELL_SIZE);
+}
+
+void PieceIndex::RetuneCellSize(entt::registry& pieces)
+{
+	// Crops and slices replace a few big pieces with many small ones, so the cell size picked by Rebuild stops fitting
+	// Only a large drift rebuilds the grid, so the cost stays amortized over the edits that caused it
+	float cell_size = GetAverageCellSize();
+	if (indexed_count == 0 || (cell_size * CELL_SIZE_DRIFT > world_cell_size && cell_size < world_cell_size * CELL_SIZE_DRIFT))
+		return;
+
+	world_cell_size = cell_size;
+	world_cells.clear();
+	large_pieces.clear();
+	pieces.view<PieceIndexEntry>().each([&](PieceHandle piece, PieceIndexEntry& entry) { InsertWorld(piece, entry); });
+}
+
+void PieceIndex::InsertWorld(PieceHandle piece, PieceIndexEntry& entry)
+{
+	entry.min_cell_x = (int)floorf(entry.world_bounds.x / world_cell_size);
+	entry.min_cell_y = (int)floorf(entry.world_bounds.y / world_cell_size);
+	entry.max_cell_x = (int)floorf((entry.world_bounds.x + entry.world_bounds.width) / world_cell_size);
+	entry.max_cell_y = (int)floorf((entry.world_bounds.y + entry.world_bounds.height) / world_cell_size);
+
+	int64_t cell_count = (int64_t)(entry.max_cell_x - entry.min_cell_x + 1) * (entry.max_cell_y - entry.min_cell_y + 1);
+	entry.is_large = cell_count > MAX_WORLD_CELLS_PER_PIECE;
+	if (entry.is_large)
+	{
+		large_pieces.push_back(piece);
+		return;
+	}
+
+	for (int y = entry.min_cell_y; y <= entry.max_cell_y; y++)
+		for (int x = entry.min_cell_x; x <= entry.max_cell_x; x++)
+			world_cells[CellKey(x, y)].push_back(piece);
+}
+
+void PieceIndex::RemoveWorld(PieceHandle piece, const PieceIndexEntry& entry)
+{
+	if (entry.is_large)
+	{
+		large_pieces.erase(std::remove(large_pieces.begin(), large_pieces.end(), piece), large_pieces.end());
+		return;
+	}
+
+	for (int y = entry.min_cell_y; y <= entry.max_cell_y; y++)
+	{
+		for (int x = entry.min_cell_x; x <= entry.max_cell_x; x++)
+		{
+			auto cell = world_cells.find(CellKey(x, y));
+			if (cell == world_cells.end())
+				continue;
+
+			auto& cell_pieces = cell->second;
+			cell_pieces.erase(std::remove(cell_pieces.begin(), cell_pieces.end(), piece), cell_pieces.end());
+			if (cell_pieces.empty())
+				world_cells.erase(cell);
+		}
+	}
+}
+
+int64_t PieceIndex::CellKey(int x, int y)
+{
+	return (int64_t)(((uint64_t)(uint32_t)x << 32) | (uint32_t)y);
+}
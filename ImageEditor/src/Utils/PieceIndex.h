@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <raylib.h>
+
+#include "Utils/PieceEntity.h"
+
+// Component added to every indexed piece
+struct PieceIndexEntry
+{
+	Rectangle local_bounds = {0.0f, 0.0f, 0.0f, 0.0f}; // Relative to the piece position
+	Rectangle world_bounds = {0.0f, 0.0f, 0.0f, 0.0f};
+
+	// Grid over the destination rectangles of the piece, in local space so it survives moves
+	float local_cell_size = 1.0f;
+	int local_columns = 1, local_rows = 1;
+	std::vector<std::vector<uint32_t>> local_cells;
+
+	bool is_large = false; // Covers too many world cells, kept in a separate list instead
+	int min_cell_x = 0, min_cell_y = 0, max_cell_x = -1, max_cell_y = -1;
+};
+
+// Uniform grid over the world space bounds of the pieces, with a grid over the rectangles of every piece
+// Results are sorted by PieceDepth, so the last ones are on top
+class PieceIndex
+{
+public:
+	PieceIndex();
+
+	void Rebuild(entt::registry& pieces);
+
+	// Must be called once a piece is created
+	void Insert(entt::registry& pieces, PieceHandle piece);
+	// Must be called when the rectangles of the piece change
+	void UpdatePiece(entt::registry& pieces, PieceHandle piece);
+	// Must be called when the position of the piece changes
+	void MovePiece(entt::registry& pieces, PieceHandle piece);
+	// Must be called before the piece is destroyed
+	void Erase(entt::registry& pieces, PieceHandle piece);
+
+	// @return the topmost piece at pos (world space) or entt::null
+	PieceHandle Pick(const entt::registry& pieces, Vector2 pos) const;
+	// @return how many pieces Pick tests at pos before it checks their rectangles
+	size_t CountCandidates(Vector2 pos) const;
+	float GetCellSize() const;
+	bool HitsPiece(const entt::registry& pieces, PieceHandle piece, Vector2 pos) const;
+
+	// Appends the pieces whose bounds overlap area (world space), from the bottom to the top
+	void QueryPieces(const entt::registry& pieces, Rectangle area, std::vector<PieceHandle>& result) const;
+	// Appends the rectangles of the piece whose destination overlaps area (world space), sorted by index
+	void QueryRectangles(const entt::registry& pieces, PieceHandle piece, Rectangle area, std::vector<uint32_t>& result) const;
+
+	const PieceIndexEntry& GetEntry(const entt::registry& pieces, PieceHandle piece) const;
+
+private:
+	PieceIndexEntry BuildEntry(const entt::registry& pieces, PieceHandle piece) const;
+	void InsertWorld(PieceHandle piece, PieceIndexEntry& entry);
+	void RemoveWorld(PieceHandle piece, const PieceIndexEntry& entry);
+	float GetAverageCellSize() const;
+	// Rebuilds the world grid when the pieces drifted far from the cell size
+	void RetuneCellSize(entt::registry& pieces);
+
+	static int64_t CellKey(int x, int y);
+
+private:
+	std::unordered_map<int64_t, std::vector<PieceHandle>> world_cells;
+	std::vector<PieceHandle> large_pieces;
+	float world_cell_size = 256.0f;
+	// Sum of the largest side of every indexed piece, to follow the average piece size between rebuilds
+	double total_extent = 0.0;
+	size_t indexed_count = 0;
+};
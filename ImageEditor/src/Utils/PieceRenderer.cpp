@@ -0,0 +1,386 @@
+#include "PieceRenderer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+
+#include <raymath.h>
+#include <rlgl.h>
+
+#include "Globals.hpp"
+
+#define VERTICES_PER_RECTANGLE 12
+// Offscreen quads between two visible ranges are drawn anyway when the gap is this small, it is cheaper than another call
+#define MAX_MERGED_GAP_VERTICES 256
+
+static const char* piece_vertex_shader = R"(
+#version 330
+in vec3 vertexPosition;
+in vec2 vertexTexCoord;
+in vec2 vertexNormal;
+in vec4 vertexColor;
+
+uniform mat4 mvp;
+uniform float outlineOffset;
+
+out vec2 fragTexCoord;
+out vec4 fragColor;
+
+void main()
+{
+	fragTexCoord = vertexTexCoord;
+	fragColor = vertexColor;
+	gl_Position = mvp * vec4(vertexPosition.xy + vertexNormal * outlineOffset, 0.0, 1.0);
+}
+)";
+
+static const char* piece_fragment_shader = R"(
+#version 330
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+
+out vec4 finalColor;
+
+void main()
+{
+	if (fragTexCoord.x < 0.0)
+		finalColor = fragColor;
+	else
+		finalColor = texture(texture0, fragTexCoord) * fragColor;
+}
+)";
+
+PieceRenderer::PieceRenderer()
+{
+}
+
+void PieceRenderer::Load()
+{
+	shader = LoadShaderFromMemory(piece_vertex_shader, piece_fragment_shader);
+	outline_offset_loc = GetShaderLocation(shader, "outlineOffset");
+	vao_id = rlLoadVertexArray();
+	needs_rebuild = true;
+}
+
+void PieceRenderer::Unload()
+{
+	UnloadShader(shader);
+	if (vbo_id != 0)
+		rlUnloadVertexBuffer(vbo_id);
+	if (vao_id != 0)
+		rlUnloadVertexArray(vao_id);
+	vbo_id = 0;
+	vao_id = 0;
+	vbo_capacity = 0;
+}
+
+void PieceRenderer::Invalidate()
+{
+	needs_rebuild = true;
+}
+
+void PieceRenderer::MarkDirty(PieceHandle piece)
+{
+	dirty_pieces.push_back(piece);
+}
+
+void PieceRenderer::Draw(const entt::registry& pieces, const PieceIndex& index, Rectangle view, const std::vector<Texture2D>& textures, PieceHandle selected_piece, float zoom)
+{
+	// Texture coordinates depend on the size of the textures
+	bool textures_changed = textures.size() != texture_sizes.size();
+	for (size_t i = 0; i < textures.size() && !textures_changed; i++)
+		textures_changed = textures[i].width != texture_sizes[i].first || textures[i].height != texture_sizes[i].second;
+	if (textures_changed || piece_offsets.size() != pieces.storage<PieceRectangles>().size() + 1)
+		needs_rebuild = true;
+
+	if (needs_rebuild)
+	{
+		texture_sizes.clear();
+		for (const Texture2D& texture : textures)
+			texture_sizes.emplace_back(texture.width, texture.height);
+		Rebuild(pieces, selected_piece);
+	}
+	else
+	{
+		if (selected_piece != last_selected_piece)
+		{
+			dirty_pieces.push_back(last_selected_piece);
+			dirty_pieces.push_back(selected_piece);
+		}
+
+		std::sort(dirty_pieces.begin(), dirty_pieces.end());
+		dirty_pieces.erase(std::unique(dirty_pieces.begin(), dirty_pieces.end()), dirty_pieces.end());
+		for (PieceHandle piece : dirty_pieces)
+		{
+			if (!PieceEntity::Exists(pieces, piece) || !draw_positions.contains(piece))
+				continue;
+
+			uint32_t order = draw_positions.get(piece);
+			WritePiece(pieces, piece, order, piece == selected_piece);
+			UploadRange(piece_offsets[order], piece_offsets[order + 1] - piece_offsets[order]);
+		}
+	}
+	dirty_pieces.clear();
+	last_selected_piece = selected_piece;
+
+	draw_calls = 0;
+	texture_binds = 0;
+	drawn_vertices = 0;
+
+	// Outlines stick out of the pieces by one pixel
+	float outline_offset = 1.0f / zoom;
+	view.x -= outline_offset;
+	view.y -= outline_offset;
+	view.width += 2.0f * outline_offset;
+	view.height += 2.0f * outline_offset;
+	CollectVisibleRanges(pieces, index, view);
+	drawn_pieces = (int)visible_pieces.size();
+	culled_pieces = (int)draw_positions.size() - drawn_pieces;
+	if (visible_ranges.empty())
+		return;
+
+	// Whatever raylib batched so far has to be drawn before, to keep the order
+	rlDrawRenderBatchActive();
+
+	rlEnableShader(shader.id);
+	rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+	rlSetUniform(outline_offset_loc, &outline_offset, RL_SHADER_UNIFORM_FLOAT, 1);
+	int texture_slot = 0;
+	rlSetUniform(shader.locs[SHADER_LOC_MAP_DIFFUSE], &texture_slot, RL_SHADER_UNIFORM_INT, 1);
+	rlActiveTextureSlot(0);
+
+	if (!rlEnableVertexArray(vao_id))
+	{
+		rlEnableVertexBuffer(vbo_id);
+		SetupAttributes();
+	}
+	uint32_t bound_image = std::numeric_limits<uint32_t>::max();
+	for (const DrawRange& range : visible_ranges)
+	{
+		uint32_t image = slot_images[range.run];
+		if (image != bound_image)
+		{
+			rlEnableTexture(image < textures.size() ? textures[image].id : rlGetTextureIdDefault());
+			bound_image = image;
+			texture_binds++;
+		}
+
+		rlDrawVertexArray((int)range.vertex_offset, (int)range.vertex_count);
+		drawn_vertices += range.vertex_count;
+		draw_calls++;
+	}
+	rlDisableVertexArray();
+	rlDisableVertexBuffer();
+
+	rlDisableTexture();
+	rlDisableShader();
+}
+
+int PieceRenderer::GetDrawCalls() const
+{
+	return draw_calls;
+}
+
+int PieceRenderer::GetTextureBinds() const
+{
+	return texture_binds;
+}
+
+int PieceRenderer::GetVertexCount() const
+{
+	return drawn_vertices;
+}
+
+int PieceRenderer::GetDrawnPieces() const
+{
+	return drawn_pieces;
+}
+
+int PieceRenderer::GetCulledPieces() const
+{
+	return culled_pieces;
+}
+
+void PieceRenderer::Rebuild(const entt::registry& pieces, PieceHandle selected_piece)
+{
+	std::vector<PieceHandle> draw_order = PieceEntity::GetDrawOrder(pieces);
+	const auto& rectangles = pieces.storage<PieceRectangles>();
+
+	draw_positions.clear();
+	piece_offsets.resize(draw_order.size() + 1);
+	uint32_t vertex_count = 0;
+	for (uint32_t i = 0; i < draw_order.size(); i++)
+	{
+		draw_positions.emplace(draw_order[i], i);
+		piece_offsets[i] = vertex_count;
+		vertex_count += rectangles.get(draw_order[i]).sources_dests.size() * VERTICES_PER_RECTANGLE;
+	}
+	piece_offsets[draw_order.size()] = vertex_count;
+
+	uint32_t slot_count = vertex_count / VERTICES_PER_RECTANGLE;
+	vertices.resize(vertex_count);
+	rectangle_slots.resize(slot_count);
+	slot_images.resize(slot_count);
+	slot_runs.resize(slot_count);
+	for (uint32_t i = 0; i < draw_order.size(); i++)
+		WritePiece(pieces, draw_order[i], i, draw_order[i] == selected_piece);
+
+	// Moving a piece does not change its images, so the runs only change here
+	for (uint32_t slot = 0; slot < slot_count; slot++)
+		slot_runs[slot] = slot > 0 && slot_images[slot] == slot_images[slot - 1] ? slot_runs[slot - 1] : slot;
+
+	if (vertex_count > vbo_capacity)
+	{
+		if (vbo_id != 0)
+			rlUnloadVertexBuffer(vbo_id);
+
+		vbo_capacity = vertex_count + vertex_count / 2;
+		vbo_id = rlLoadVertexBuffer(nullptr, vbo_capacity * sizeof(PieceVertex), true);
+
+		rlEnableVertexArray(vao_id);
+		rlEnableVertexBuffer(vbo_id);
+		SetupAttributes();
+		rlDisableVertexArray();
+	}
+
+	UploadRange(0, vertex_count);
+	needs_rebuild = false;
+}
+
+void PieceRenderer::WritePiece(const entt::registry& pieces, PieceHandle piece, uint32_t order, bool selected)
+{
+	auto [position, rectangles] = pieces.get<PiecePosition, PieceRectangles>(piece);
+	const std::vector<SourceDestinationPair>& sources_dests = rectangles.sources_dests;
+
+	Color outline_color = selected ? Colors::SELECTED_PIECE_OUTLINE : Colors::PIECE_OUTLINE;
+	PieceVertex* vertex = vertices.data() + piece_offsets[order];
+	uint32_t first_slot = piece_offsets[order] / VERTICES_PER_RECTANGLE;
+
+	auto write_quad = [&](Rectangle rect, Rectangle uv, float expand, Color color)
+	{
+		PieceVertex top_left = {rect.x, rect.y, uv.x, uv.y, -expand, -expand, color};
+		PieceVertex top_right = {rect.x + rect.width, rect.y, uv.x + uv.width, uv.y, expand, -expand, color};
+		PieceVertex bottom_left = {rect.x, rect.y + rect.height, uv.x, uv.y + uv.height, -expand, expand, color};
+		PieceVertex bottom_right = {rect.x + rect.width, rect.y + rect.height, uv.x + uv.width, uv.y + uv.height, expand, expand, color};
+
+		*vertex++ = top_left;
+		*vertex++ = bottom_left;
+		*vertex++ = top_right;
+		*vertex++ = top_right;
+		*vertex++ = bottom_left;
+		*vertex++ = bottom_right;
+	};
+
+	// Sorting by image then by index keeps the original order of the rectangles of a single image
+	piece_rectangle_order.clear();
+	for (uint32_t i = 0; i < sources_dests.size(); i++)
+		piece_rectangle_order.emplace_back(sources_dests[i].image, i);
+	std::sort(piece_rectangle_order.begin(), piece_rectangle_order.end());
+
+	for (uint32_t slot = 0; slot < piece_rectangle_order.size(); slot++)
+	{
+		auto [image, rect_index] = piece_rectangle_order[slot];
+		Rectangle source = sources_dests[rect_index].source;
+		Rectangle dest = sources_dests[rect_index].destination;
+		rectangle_slots[first_slot + rect_index] = first_slot + slot;
+		slot_images[first_slot + slot] = image;
+
+		dest.x += position.value.x;
+		dest.y += position.value.y;
+
+		float texture_width = 1.0f, texture_height = 1.0f;
+		if (image < texture_sizes.size())
+		{
+			texture_width = (float)std::max(texture_sizes[image].first, 1);
+			texture_height = (float)std::max(texture_sizes[image].second, 1);
+		}
+
+		Rectangle uv = {source.x / texture_width, source.y / texture_height, source.width / texture_width, source.height / texture_height};
+		write_quad(dest, {-1.0f, -1.0f, 0.0f, 0.0f}, 1.0f, outline_color);
+		write_quad(dest, uv, 0.0f, WHITE);
+	}
+}
+
+void PieceRenderer::CollectVisibleRanges(const entt::registry& pieces, const PieceIndex& index, Rectangle view)
+{
+	visible_pieces.clear();
+	visible_ranges.clear();
+	index.QueryPieces(pieces, view, visible_pieces);
+
+	// Sorted by depth, which is also the order of the buffer
+	for (PieceHandle piece : visible_pieces)
+	{
+		if (!draw_positions.contains(piece))
+			continue;
+
+		uint32_t order = draw_positions.get(piece);
+		uint32_t first_slot = piece_offsets[order] / VERTICES_PER_RECTANGLE;
+		uint32_t end_slot = piece_offsets[order + 1] / VERTICES_PER_RECTANGLE;
+		if (first_slot == end_slot)
+			continue;
+
+		const Rectangle& bounds = index.GetEntry(pieces, piece).world_bounds;
+		bool fully_visible = bounds.x >= view.x && bounds.y >= view.y && bounds.x + bounds.width <= view.x + view.width && bounds.y + bounds.height <= view.y + view.height;
+		if (fully_visible && slot_runs[first_slot] == slot_runs[end_slot - 1])
+		{
+			AddVisibleSlots(first_slot, end_slot - first_slot);
+			continue;
+		}
+		if (fully_visible)
+		{
+			for (uint32_t slot = first_slot; slot < end_slot; slot++)
+				AddVisibleSlots(slot, 1);
+			continue;
+		}
+
+		visible_rectangles.clear();
+		visible_slots.clear();
+		index.QueryRectangles(pieces, piece, view, visible_rectangles);
+		for (uint32_t rect_index : visible_rectangles)
+			visible_slots.push_back(rectangle_slots[first_slot + rect_index]);
+		std::sort(visible_slots.begin(), visible_slots.end());
+		for (uint32_t slot : visible_slots)
+			AddVisibleSlots(slot, 1);
+	}
+}
+
+void PieceRenderer::AddVisibleSlots(uint32_t first_slot, uint32_t slot_count)
+{
+	uint32_t vertex_offset = first_slot * VERTICES_PER_RECTANGLE;
+	uint32_t vertex_count = slot_count * VERTICES_PER_RECTANGLE;
+	uint32_t run = slot_runs[first_slot];
+	if (!visible_ranges.empty())
+	{
+		// Only slots of the same run can be merged, the gap between them has to use the same texture
+		DrawRange& last = visible_ranges.back();
+		if (last.run == run && vertex_offset <= last.vertex_offset + last.vertex_count + MAX_MERGED_GAP_VERTICES)
+		{
+			last.vertex_count = std::max(last.vertex_count, vertex_offset + vertex_count - last.vertex_offset);
+			return;
+		}
+	}
+
+	visible_ranges.push_back({vertex_offset, vertex_count, run});
+}
+
+void PieceRenderer::UploadRange(uint32_t vertex_offset, uint32_t vertex_count)
+{
+	if (vertex_count == 0)
+		return;
+
+	rlUpdateVertexBuffer(vbo_id, vertices.data() + vertex_offset, vertex_count * sizeof(PieceVertex), vertex_offset * sizeof(PieceVertex));
+}
+
+void PieceRenderer::SetupAttributes()
+{
+	rlSetVertexAttribute(shader.locs[SHADER_LOC_VERTEX_POSITION], 2, RL_FLOAT, false, sizeof(PieceVertex), (void*)offsetof(PieceVertex, x));
+	rlEnableVertexAttribute(shader.locs[SHADER_LOC_VERTEX_POSITION]);
+	rlSetVertexAttribute(shader.locs[SHADER_LOC_VERTEX_TEXCOORD01], 2, RL_FLOAT, false, sizeof(PieceVertex), (void*)offsetof(PieceVertex, u));
+	rlEnableVertexAttribute(shader.locs[SHADER_LOC_VERTEX_TEXCOORD01]);
+	rlSetVertexAttribute(shader.locs[SHADER_LOC_VERTEX_NORMAL], 2, RL_FLOAT, false, sizeof(PieceVertex), (void*)offsetof(PieceVertex, expand_x));
+	rlEnableVertexAttribute(shader.locs[SHADER_LOC_VERTEX_NORMAL]);
+	rlSetVertexAttribute(shader.locs[SHADER_LOC_VERTEX_COLOR], 4, RL_UNSIGNED_BYTE, true, sizeof(PieceVertex), (void*)offsetof(PieceVertex, color));
+	rlEnableVertexAttribute(shader.locs[SHADER_LOC_VERTEX_COLOR]);
+}
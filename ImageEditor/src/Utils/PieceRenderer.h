@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <raylib.h>
+
+#include "Utils/PieceEntity.h"
+#include "Utils/PieceIndex.h"
+
+struct PieceVertex
+{
+	float x, y;
+	float u, v; // Negative for outline quads, which only use the color
+	float expand_x, expand_y; // Direction in which outline corners are pushed by the outline width
+	Color color;
+};
+
+// Keeps the outline and texture quads of every piece in a single vertex buffer
+// Pieces are stored in the same order DrawPiece would draw them, so overlapping pieces look the same
+// Inside a piece the rectangles are grouped by source image, so a piece made of several images only switches texture once per image
+// Only the ranges of the buffer that are inside the view are drawn, merged in as few calls as possible
+class PieceRenderer
+{
+public:
+	PieceRenderer();
+
+	void Load();
+	void Unload();
+
+	// Must be called when pieces are added, removed or get new rectangles
+	void Invalidate();
+	// Must be called when the position of a single piece changes
+	void MarkDirty(PieceHandle piece);
+
+	// Has to be called inside BeginMode2D, view is the visible area in world space
+	// @param textures Indexed by SourceDestinationPair::image
+	void Draw(const entt::registry& pieces, const PieceIndex& index, Rectangle view, const std::vector<Texture2D>& textures, PieceHandle selected_piece, float zoom);
+
+	int GetDrawCalls() const;
+	int GetTextureBinds() const;
+	int GetVertexCount() const;
+	int GetDrawnPieces() const;
+	int GetCulledPieces() const;
+
+private:
+	void Rebuild(const entt::registry& pieces, PieceHandle selected_piece);
+	void WritePiece(const entt::registry& pieces, PieceHandle piece, uint32_t order, bool selected);
+	void UploadRange(uint32_t vertex_offset, uint32_t vertex_count);
+	void CollectVisibleRanges(const entt::registry& pieces, const PieceIndex& index, Rectangle view);
+	void AddVisibleSlots(uint32_t first_slot, uint32_t slot_count);
+	void SetupAttributes();
+
+private:
+	Shader shader;
+	int outline_offset_loc = -1;
+	unsigned int vao_id = 0;
+	unsigned int vbo_id = 0;
+	uint32_t vbo_capacity = 0;
+
+	std::vector<PieceVertex> vertices;
+	entt::storage<uint32_t> draw_positions; // Position of every piece in the draw order
+	std::vector<uint32_t> piece_offsets; // First vertex of every piece, in draw order
+
+	// A slot holds the quads of one rectangle, slot = vertex / VERTICES_PER_RECTANGLE
+	std::vector<uint32_t> rectangle_slots; // Slot of every rectangle, indexed by piece_offsets[order] / VERTICES_PER_RECTANGLE + rectangle
+	std::vector<uint32_t> slot_images;
+	std::vector<uint32_t> slot_runs; // First slot of the run of consecutive slots using the same image
+	std::vector<PieceHandle> dirty_pieces;
+
+	struct DrawRange
+	{
+		uint32_t vertex_offset;
+		uint32_t vertex_count;
+		uint32_t run;
+	};
+
+	// Reused every frame to avoid allocations
+	std::vector<PieceHandle> visible_pieces;
+	std::vector<uint32_t> visible_rectangles;
+	std::vector<uint32_t> visible_slots;
+	std::vector<DrawRange> visible_ranges;
+	std::vector<std::pair<uint32_t, uint32_t>> piece_rectangle_order; // Image and rectangle
+
+	bool needs_rebuild = true;
+	PieceHandle last_selected_piece = entt::null;
+	std::vector<std::pair<int, int>> texture_sizes;
+
+	int draw_calls = 0;
+	int texture_binds = 0;
+	int drawn_vertices = 0;
+	int drawn_pieces = 0;
+	int culled_pieces = 0;
+};
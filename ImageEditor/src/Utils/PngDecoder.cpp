@@ -0,0 +1,455 @@
+#include "PngDecoder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "Utils/MappedImage.h"
+#include "Utils/MipChain.h"
+#include "Utils/StreamingInflate.h"
+
+// Decoded rows are handed back to the system every time this many bytes were written
+#define RELEASE_SIZE (64 * 1024 * 1024)
+// Longest PLTE or tRNS chunk, 256 RGB entries
+#define MAX_PALETTE_CHUNK_SIZE (256 * 3)
+
+namespace PngDecoder
+{
+	enum ColorType
+	{
+		COLOR_GRAY = 0,
+		COLOR_RGB = 2,
+		COLOR_PALETTE = 3,
+		COLOR_GRAY_ALPHA = 4,
+		COLOR_RGBA = 6
+	};
+
+	enum RowFilter
+	{
+		FILTER_NONE,
+		FILTER_SUB,
+		FILTER_UP,
+		FILTER_AVERAGE,
+		FILTER_PAETH
+	};
+
+	static const unsigned char PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	// Colors of the palette and the transparent color of gray and RGB images
+	struct Transparency
+	{
+		unsigned char palette[256 * 4];
+		int palette_size = 0;
+		bool has_key = false;
+		uint16_t key[3] = {};
+	};
+
+	static uint32_t ReadBigEndian(const unsigned char* data)
+	{
+		return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+	}
+
+	static bool ReadChunkHeader(FILE* file, uint32_t& size, char type[4])
+	{
+		unsigned char header[8];
+		if (fread(header, 1, sizeof(header), file) != sizeof(header))
+			return false;
+
+		size = ReadBigEndian(header);
+		memcpy(type, header + 4, 4);
+		return size <= 0x7FFFFFFF;
+	}
+
+	// Skips the data and the CRC of a chunk
+	static bool SkipChunk(FILE* file, uint32_t size)
+	{
+		return fseek(file, (long)size, SEEK_CUR) == 0 && fseek(file, 4, SEEK_CUR) == 0;
+	}
+
+	static int GetChannelCount(int color_type)
+	{
+		switch (color_type)
+		{
+			case COLOR_GRAY:
+			case COLOR_PALETTE:
+				return 1;
+			case COLOR_GRAY_ALPHA:
+				return 2;
+			case COLOR_RGB:
+				return 3;
+			case COLOR_RGBA:
+				return 4;
+			default:
+				return 0;
+		}
+	}
+
+	static bool IsValidBitDepth(int color_type, int bit_depth)
+	{
+		switch (color_type)
+		{
+			case COLOR_GRAY:
+				return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+			case COLOR_PALETTE:
+				return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+			case COLOR_RGB:
+			case COLOR_GRAY_ALPHA:
+			case COLOR_RGBA:
+				return bit_depth == 8 || bit_depth == 16;
+			default:
+				return false;
+		}
+	}
+
+	// Opens the file and reads the IHDR chunk that has to come first, the file is left at the next chunk
+	// @return nullptr if the file is not a PNG
+	static FILE* OpenPng(const std::string& filepath, PngInfo& info)
+	{
+		FILE* file = fopen(filepath.c_str(), "rb");
+		if (file == nullptr)
+			return nullptr;
+
+		unsigned char header[8 + 8 + 13 + 4];
+		if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, PNG_SIGNATURE, 8) != 0 ||
+			ReadBigEndian(header + 8) != 13 || memcmp(header + 12, "IHDR", 4) != 0)
+		{
+			fclose(file);
+			return nullptr;
+		}
+
+		const unsigned char* fields = header + 16;
+		uint32_t width = ReadBigEndian(fields);
+		uint32_t height = ReadBigEndian(fields + 4);
+		info.bit_depth = fields[8];
+		info.color_type = fields[9];
+		info.is_interlaced = fields[12] == 1;
+		// Compression and filter methods only have one value
+		if (width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX || !IsValidBitDepth(info.color_type, info.bit_depth) ||
+			fields[10] != 0 || fields[11] != 0 || fields[12] > 1)
+		{
+			fclose(file);
+			return nullptr;
+		}
+
+		info.width = (int)width;
+		info.height = (int)height;
+		return file;
+	}
+
+	static int PaethPredictor(int left, int up, int up_left)
+	{
+		int estimate = left + up - up_left;
+		int distance_left = abs(estimate - left);
+		int distance_up = abs(estimate - up);
+		int distance_up_left = abs(estimate - up_left);
+		if (distance_left <= distance_up && distance_left <= distance_up_left)
+			return left;
+		return distance_up <= distance_up_left ? up : up_left;
+	}
+
+	// @param pixel_size Bytes per pixel, 1 for pixels smaller than a byte
+	// @return false for an unknown filter
+	static bool Unfilter(int filter, unsigned char* row, const unsigned char* previous, size_t size, size_t pixel_size)
+	{
+		switch (filter)
+		{
+			case FILTER_NONE:
+				return true;
+			case FILTER_SUB:
+				for (size_t i = pixel_size; i < size; i++)
+					row[i] += row[i - pixel_size];
+				return true;
+			case FILTER_UP:
+				for (size_t i = 0; i < size; i++)
+					row[i] += previous[i];
+				return true;
+			case FILTER_AVERAGE:
+				for (size_t i = 0; i < pixel_size; i++)
+					row[i] += previous[i] >> 1;
+				for (size_t i = pixel_size; i < size; i++)
+					row[i] += (row[i - pixel_size] + previous[i]) >> 1;
+				return true;
+			case FILTER_PAETH:
+				for (size_t i = 0; i < pixel_size; i++)
+					row[i] += previous[i];
+				for (size_t i = pixel_size; i < size; i++)
+					row[i] += (unsigned char)PaethPredictor(row[i - pixel_size], previous[i], previous[i - pixel_size]);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	static uint16_t GetSample(const unsigned char* row, size_t index, int bit_depth)
+	{
+		if (bit_depth == 8)
+			return row[index];
+		if (bit_depth == 16)
+			return (uint16_t)(row[index * 2] << 8 | row[index * 2 + 1]);
+
+		// Pixels smaller than a byte are packed from the high bits
+		size_t bit = index * bit_depth;
+		return (row[bit / 8] >> (8 - bit_depth - bit % 8)) & ((1 << bit_depth) - 1);
+	}
+
+	// Same rounding as stb_image: 16 bit samples keep their high byte, smaller ones are stretched to 0..255
+	static unsigned char ScaleSample(uint16_t sample, int bit_depth)
+	{
+		if (bit_depth == 16)
+			return (unsigned char)(sample >> 8);
+		return (unsigned char)(sample * 255 / ((1 << bit_depth) - 1));
+	}
+
+	static void ConvertRow(const unsigned char* row, const PngInfo& info, const Transparency& transparency, unsigned char* out)
+	{
+		int bit_depth = info.bit_depth;
+		if (bit_depth == 8 && info.color_type == COLOR_RGBA)
+		{
+			memcpy(out, row, (size_t)info.width * 4);
+			return;
+		}
+
+		if (bit_depth == 8 && info.color_type == COLOR_RGB && !transparency.has_key)
+		{
+			for (int x = 0; x < info.width; x++)
+			{
+				memcpy(out + x * 4, row + x * 3, 3);
+				out[x * 4 + 3] = 255;
+			}
+			return;
+		}
+
+		for (int x = 0; x < info.width; x++)
+		{
+			unsigned char* pixel = out + (size_t)x * 4;
+			switch (info.color_type)
+			{
+				case COLOR_GRAY:
+				{
+					uint16_t gray = GetSample(row, x, bit_depth);
+					pixel[0] = pixel[1] = pixel[2] = ScaleSample(gray, bit_depth);
+					pixel[3] = transparency.has_key && gray == transparency.key[0] ? 0 : 255;
+					break;
+				}
+				case COLOR_RGB:
+				{
+					bool is_key = transparency.has_key;
+					for (int channel = 0; channel < 3; channel++)
+					{
+						uint16_t sample = GetSample(row, (size_t)x * 3 + channel, bit_depth);
+						pixel[channel] = ScaleSample(sample, bit_depth);
+						is_key = is_key && sample == transparency.key[channel];
+					}
+					pixel[3] = is_key ? 0 : 255;
+					break;
+				}
+				case COLOR_PALETTE:
+				{
+					// Indices past the palette are black like in libpng
+					int index = GetSample(row, x, bit_depth);
+					if (index < transparency.palette_size)
+						memcpy(pixel, transparency.palette + index * 4, 4);
+					else
+					{
+						pixel[0] = pixel[1] = pixel[2] = 0;
+						pixel[3] = 255;
+					}
+					break;
+				}
+				case COLOR_GRAY_ALPHA:
+					pixel[0] = pixel[1] = pixel[2] = ScaleSample(GetSample(row, (size_t)x * 2, bit_depth), bit_depth);
+					pixel[3] = ScaleSample(GetSample(row, (size_t)x * 2 + 1, bit_depth), bit_depth);
+					break;
+				case COLOR_RGBA:
+					for (int channel = 0; channel < 4; channel++)
+						pixel[channel] = ScaleSample(GetSample(row, (size_t)x * 4 + channel, bit_depth), bit_depth);
+					break;
+			}
+		}
+	}
+
+	// Reads the PLTE and tRNS chunks, the other ones before the image data are skipped
+	// @return false if the file ends or a chunk is invalid, otherwise the file is at the data of the first IDAT chunk
+	static bool ReadChunksBeforeData(FILE* file, const PngInfo& info, Transparency& transparency, uint32_t& data_size)
+	{
+		uint32_t size;
+		char type[4];
+		unsigned char data[MAX_PALETTE_CHUNK_SIZE];
+		while (ReadChunkHeader(file, size, type))
+		{
+			if (memcmp(type, "IDAT", 4) == 0)
+			{
+				data_size = size;
+				// Palette images can not be drawn without their palette
+				return info.color_type != COLOR_PALETTE || transparency.palette_size > 0;
+			}
+			if (memcmp(type, "IEND", 4) == 0)
+				return false;
+
+			bool is_palette = memcmp(type, "PLTE", 4) == 0;
+			bool is_transparency = memcmp(type, "tRNS", 4) == 0;
+			if (!is_palette && !is_transparency)
+			{
+				if (!SkipChunk(file, size))
+					return false;
+				continue;
+			}
+
+			if (size > MAX_PALETTE_CHUNK_SIZE || fread(data, 1, size, file) != size || fseek(file, 4, SEEK_CUR) != 0)
+				return false;
+
+			if (is_palette)
+			{
+				if (size % 3 != 0)
+					return false;
+
+				transparency.palette_size = (int)size / 3;
+				for (int i = 0; i < transparency.palette_size; i++)
+				{
+					memcpy(transparency.palette + i * 4, data + i * 3, 3);
+					transparency.palette[i * 4 + 3] = 255;
+				}
+			}
+			else if (info.color_type == COLOR_PALETTE)
+			{
+				// Alpha of the first palette entries, the others stay opaque
+				for (uint32_t i = 0; i < size && (int)i < transparency.palette_size; i++)
+					transparency.palette[i * 4 + 3] = data[i];
+			}
+			else if ((info.color_type == COLOR_GRAY && size == 2) || (info.color_type == COLOR_RGB && size == 6))
+			{
+				transparency.has_key = true;
+				for (uint32_t i = 0; i < size / 2; i++)
+					transparency.key[i] = (uint16_t)(data[i * 2] << 8 | data[i * 2 + 1]);
+			}
+		}
+
+		return false;
+	}
+
+	bool ReadInfo(const std::string& filepath, PngInfo& info)
+	{
+		FILE* file = OpenPng(filepath, info);
+		if (file == nullptr)
+			return false;
+
+		fclose(file);
+		return true;
+	}
+
+	bool Decode(const std::string& filepath, const RowFunction& on_row)
+	{
+		PngInfo info;
+		FILE* file = OpenPng(filepath, info);
+		if (file == nullptr)
+			return false;
+
+		Transparency transparency;
+		uint32_t data_left = 0;
+		if (info.is_interlaced || !ReadChunksBeforeData(file, info, transparency, data_left))
+		{
+			fclose(file);
+			return false;
+		}
+
+		// The image data can be split in any number of consecutive IDAT chunks
+		bool is_data_over = false;
+		auto read = [&](unsigned char* buffer, size_t capacity) -> size_t
+		{
+			while (data_left == 0 && !is_data_over)
+			{
+				char type[4];
+				is_data_over = fseek(file, 4, SEEK_CUR) != 0 || !ReadChunkHeader(file, data_left, type) || memcmp(type, "IDAT", 4) != 0;
+				if (is_data_over)
+					data_left = 0;
+			}
+
+			size_t count = fread(buffer, 1, std::min(capacity, (size_t)data_left), file);
+			data_left -= (uint32_t)count;
+			return count;
+		};
+
+		// Every row starts with its filter type, the row above starts as zeros
+		size_t row_size = ((size_t)info.width * GetChannelCount(info.color_type) * info.bit_depth + 7) / 8;
+		size_t pixel_size = std::max(GetChannelCount(info.color_type) * info.bit_depth / 8, 1);
+		std::vector<unsigned char> row(1 + row_size);
+		std::vector<unsigned char> previous_row(1 + row_size, 0);
+		std::vector<unsigned char> pixels((size_t)info.width * 4);
+		size_t row_filled = 0;
+		int y = 0;
+		bool is_stopped = false;
+		auto write = [&](const unsigned char* data, size_t size)
+		{
+			// Bytes after the last row are ignored
+			while (size > 0 && y < info.height)
+			{
+				size_t count = std::min(size, row.size() - row_filled);
+				memcpy(row.data() + row_filled, data, count);
+				row_filled += count;
+				data += count;
+				size -= count;
+				if (row_filled < row.size())
+					break;
+
+				is_stopped = !Unfilter(row[0], row.data() + 1, previous_row.data() + 1, row_size, pixel_size);
+				if (is_stopped)
+					return false;
+
+				ConvertRow(row.data() + 1, info, transparency, pixels.data());
+				is_stopped = !on_row(y, pixels.data());
+				if (is_stopped)
+					return false;
+
+				row.swap(previous_row);
+				row_filled = 0;
+				y++;
+			}
+			return true;
+		};
+
+		// Like stb_image, once every row is there a bad checksum or a cut end of stream is forgiven
+		StreamingInflate::Decompress(read, write);
+		fclose(file);
+		return !is_stopped && y == info.height;
+	}
+
+	Image LoadMapped(const std::string& filepath)
+	{
+		PngInfo info;
+		if (!ReadInfo(filepath, info) || info.is_interlaced)
+			return {};
+
+		Image image = MappedImage::Create(info.width, info.height);
+		if (image.data == nullptr)
+			return {};
+
+		size_t row_size = (size_t)info.width * 4;
+		size_t released = 0;
+		bool is_decoded = Decode(filepath, [&](int y, const unsigned char* pixels)
+		{
+			memcpy((unsigned char*)image.data + (size_t)y * row_size, pixels, row_size);
+
+			size_t written = (size_t)(y + 1) * row_size;
+			if (written - released >= RELEASE_SIZE)
+			{
+				MappedImage::Release(image, released, written - released);
+				released = written;
+			}
+			return true;
+		});
+
+		if (!is_decoded)
+		{
+			MappedImage::Unload(image);
+			return {};
+		}
+
+		// Afterwards only the tiles drawn are paged back in
+		MipChain::GenerateLevels(&image, [&](size_t offset, size_t size) { MappedImage::Release(image, offset, size); });
+		MappedImage::Release(image, 0, MipChain::GetChainSize(image.width, image.height));
+		return image;
+	}
+}
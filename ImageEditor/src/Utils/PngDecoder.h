@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <raylib.h>
+
+struct PngInfo
+{
+	int width = 0;
+	int height = 0;
+	int bit_depth = 0;
+	int color_type = 0;
+	bool is_interlaced = false;
+};
+
+// Decodes PNGs a row at a time without materialising the whole image, only the current and previous rows and the inflate window are kept in memory
+// Every bit depth and color type is read, 16 bit channels are reduced to 8 bits like LoadImage does; interlaced images are not supported
+namespace PngDecoder
+{
+	// Receives every row in order as R8G8B8A8 pixels, returns false to stop decoding
+	using RowFunction = std::function<bool(int y, const unsigned char* pixels)>;
+
+	// Reads the header only
+	// @return false if the file is not a PNG
+	bool ReadInfo(const std::string& filepath, PngInfo& info);
+	// @return false if the file is not a PNG, is interlaced, corrupted, or on_row stopped it
+	bool Decode(const std::string& filepath, const RowFunction& on_row);
+
+	// Decodes into a MappedImage and generates its mip chain, the rows already decoded are handed to the system as the decoding goes
+	// so the memory used stays bounded whatever the size of the image
+	// @return an empty image on failure, unload it with MappedImage::Unload
+	Image LoadMapped(const std::string& filepath);
+}
@@ -0,0 +1,264 @@
+#include "PngEncoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Utils/ParallelDeflate.h"
+
+#define BYTES_PER_PIXEL 4
+// The zlib stream is cut in IDAT chunks of this size, their CRCs are computed in parallel
+#define IDAT_CHUNK_SIZE (1024 * 1024)
+// Fewer filtered bytes are not worth a thread of their own
+#define MIN_BYTES_PER_FILTER_JOB (256 * 1024)
+
+namespace PngEncoder
+{
+	enum RowFilter
+	{
+		FILTER_NONE,
+		FILTER_SUB,
+		FILTER_UP,
+		FILTER_AVERAGE,
+		FILTER_PAETH,
+		FILTER_COUNT
+	};
+
+	static const unsigned char PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	// Slicing by 8: table n gives the CRC of a byte followed by n zero bytes, so 8 bytes are folded per step
+	static const uint32_t* GetCrcTables()
+	{
+		static const std::vector<uint32_t> tables = []()
+		{
+			std::vector<uint32_t> result(256 * 8);
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; bit++)
+					crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+				result[i] = crc;
+			}
+			for (int table = 1; table < 8; table++)
+			{
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					uint32_t previous = result[(table - 1) * 256 + i];
+					result[table * 256 + i] = (previous >> 8) ^ result[previous & 0xFF];
+				}
+			}
+			return result;
+		}();
+
+		return tables.data();
+	}
+
+	static uint32_t Crc32(const unsigned char* data, size_t size)
+	{
+		const uint32_t* tables = GetCrcTables();
+		uint32_t crc = 0xFFFFFFFFu;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint32_t low = crc ^ ((uint32_t)data[i] | (uint32_t)data[i + 1] << 8 | (uint32_t)data[i + 2] << 16 | (uint32_t)data[i + 3] << 24);
+			crc = tables[7 * 256 + (low & 0xFF)] ^ tables[6 * 256 + ((low >> 8) & 0xFF)] ^ tables[5 * 256 + ((low >> 16) & 0xFF)] ^ tables[4 * 256 + (low >> 24)] ^
+				tables[3 * 256 + data[i + 4]] ^ tables[2 * 256 + data[i + 5]] ^ tables[1 * 256 + data[i + 6]] ^ tables[data[i + 7]];
+		}
+		for (; i < size; i++)
+			crc = tables[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+		return crc ^ 0xFFFFFFFFu;
+	}
+
+	static unsigned char* WriteBigEndian(unsigned char* out, uint32_t value)
+	{
+		out[0] = (unsigned char)(value >> 24);
+		out[1] = (unsigned char)(value >> 16);
+		out[2] = (unsigned char)(value >> 8);
+		out[3] = (unsigned char)value;
+		return out + 4;
+	}
+
+	// Length, type, data and the CRC of the type and data
+	static unsigned char* WriteChunk(unsigned char* out, const char* type, const unsigned char* data, size_t size)
+	{
+		out = WriteBigEndian(out, (uint32_t)size);
+		memcpy(out, type, 4);
+		if (size > 0)
+			memcpy(out + 4, data, size);
+		uint32_t crc = Crc32(out, size + 4);
+		return WriteBigEndian(out + 4 + size, crc);
+	}
+
+	static unsigned char GetPaeth(int left, int up, int up_left)
+	{
+		// Distances of left + up - up_left to each neighbour, simplified
+		int left_distance = abs(up - up_left);
+		int up_distance = abs(left - up_left);
+		int up_left_distance = abs(left + up - 2 * up_left);
+		if (left_distance <= up_distance && left_distance <= up_left_distance)
+			return (unsigned char)left;
+
+		return (unsigned char)(up_distance <= up_left_distance ? up : up_left);
+	}
+
+	// @param previous Row above, zeros for the first row
+	static void FilterRow(const unsigned char* row, const unsigned char* previous, int row_size, int filter, unsigned char* out)
+	{
+		switch (filter)
+		{
+			case FILTER_NONE:
+				memcpy(out, row, row_size);
+				break;
+
+			case FILTER_SUB:
+				memcpy(out, row, BYTES_PER_PIXEL);
+				for (int i = BYTES_PER_PIXEL; i < row_size; i++)
+					out[i] = (unsigned char)(row[i] - row[i - BYTES_PER_PIXEL]);
+				break;
+
+			case FILTER_UP:
+				for (int i = 0; i < row_size; i++)
+					out[i] = (unsigned char)(row[i] - previous[i]);
+				break;
+
+			case FILTER_AVERAGE:
+				for (int i = 0; i < BYTES_PER_PIXEL; i++)
+					out[i] = (unsigned char)(row[i] - (previous[i] >> 1));
+				for (int i = BYTES_PER_PIXEL; i < row_size; i++)
+					out[i] = (unsigned char)(row[i] - ((row[i - BYTES_PER_PIXEL] + previous[i]) >> 1));
+				break;
+
+			default:
+				for (int i = 0; i < BYTES_PER_PIXEL; i++)
+					out[i] = (unsigned char)(row[i] - previous[i]);
+				for (int i = BYTES_PER_PIXEL; i < row_size; i++)
+					out[i] = (unsigned char)(row[i] - GetPaeth(row[i - BYTES_PER_PIXEL], previous[i], previous[i - BYTES_PER_PIXEL]));
+				break;
+		}
+	}
+
+	// Sum of the filtered bytes taken as signed, the usual guess of which filter deflates best
+	static uint64_t GetFilterCost(const unsigned char* filtered, int row_size)
+	{
+		uint64_t cost = 0;
+		for (int i = 0; i < row_size; i++)
+			cost += abs((signed char)filtered[i]);
+
+		return cost;
+	}
+
+	// Every output row is the filter type followed by the filtered bytes
+	static void FilterRows(const unsigned char* pixels, size_t stride, int width, int first_row, int last_row, int filter, unsigned char* out)
+	{
+		int row_size = width * BYTES_PER_PIXEL;
+		std::vector<unsigned char> candidate(filter < 0 ? row_size : 0);
+		std::vector<unsigned char> zeros(first_row == 0 ? row_size : 0);
+		for (int y = first_row; y < last_row; y++)
+		{
+			const unsigned char* row = pixels + (size_t)y * stride;
+			const unsigned char* previous = y > 0 ? row - stride : zeros.data();
+			unsigned char* filtered = out + (size_t)y * (row_size + 1);
+			if (filter >= 0)
+			{
+				filtered[0] = (unsigned char)filter;
+				FilterRow(row, previous, row_size, filter, filtered + 1);
+				continue;
+			}
+
+			uint64_t best_cost = UINT64_MAX;
+			for (int candidate_filter = 0; candidate_filter < FILTER_COUNT; candidate_filter++)
+			{
+				FilterRow(row, previous, row_size, candidate_filter, candidate.data());
+				uint64_t cost = GetFilterCost(candidate.data(), row_size);
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					filtered[0] = (unsigned char)candidate_filter;
+					memcpy(filtered + 1, candidate.data(), row_size);
+				}
+			}
+		}
+	}
+
+	template <typename Function>
+	static void ForEachParallel(size_t count, unsigned int jobs, Function function)
+	{
+		std::atomic<size_t> next = 0;
+		auto worker = [&]()
+		{
+			for (size_t i = next++; i < count; i = next++)
+				function(i);
+		};
+
+		jobs = std::max(1u, std::min(jobs, (unsigned int)count));
+		std::vector<std::thread> threads;
+		for (unsigned int i = 1; i < jobs; i++)
+			threads.emplace_back(worker);
+		worker();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	unsigned char* Encode(const unsigned char* pixels, size_t stride, int width, int height, int level, int filter, unsigned int jobs, int* size)
+	{
+		*size = 0;
+		if (!pixels || width <= 0 || height <= 0 || width > (INT_MAX - 1) / BYTES_PER_PIXEL)
+			return nullptr;
+
+		jobs = jobs > 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
+		filter = std::clamp(filter, -1, FILTER_COUNT - 1);
+		size_t filtered_row_size = (size_t)width * BYTES_PER_PIXEL + 1;
+		std::vector<unsigned char> filtered(filtered_row_size * height);
+
+		// Rows only read the pixels above them, so bands of rows are filtered independently
+		size_t band_count = std::max((size_t)1, std::min((size_t)jobs, filtered.size() / MIN_BYTES_PER_FILTER_JOB));
+		ForEachParallel(band_count, jobs, [&](size_t band)
+		{
+			int first_row = (int)((int64_t)height * band / band_count);
+			int last_row = (int)((int64_t)height * (band + 1) / band_count);
+			FilterRows(pixels, stride, width, first_row, last_row, filter, filtered.data());
+		});
+
+		std::vector<unsigned char> compressed = ParallelDeflate::Compress(filtered.data(), filtered.size(), level, jobs);
+		std::vector<unsigned char>().swap(filtered);
+
+		size_t chunk_count = std::max((size_t)1, (compressed.size() + IDAT_CHUNK_SIZE - 1) / IDAT_CHUNK_SIZE);
+		size_t png_size = sizeof(PNG_SIGNATURE) + (12 + 13) + chunk_count * 12 + compressed.size() + 12;
+		if (png_size > INT_MAX)
+			return nullptr;
+
+		unsigned char* data = (unsigned char*)malloc(png_size);
+		if (!data)
+			return nullptr;
+
+		memcpy(data, PNG_SIGNATURE, sizeof(PNG_SIGNATURE));
+		unsigned char header[13];
+		WriteBigEndian(header, (uint32_t)width);
+		WriteBigEndian(header + 4, (uint32_t)height);
+		header[8] = 8; // Bits per channel
+		header[9] = 6; // RGBA
+		header[10] = 0; // Deflate
+		header[11] = 0; // Adaptive filtering
+		header[12] = 0; // Not interlaced
+		unsigned char* chunks = WriteChunk(data + sizeof(PNG_SIGNATURE), "IHDR", header, sizeof(header));
+
+		// Every IDAT has a known place, so they are copied and checksummed on separate threads
+		ForEachParallel(chunk_count, jobs, [&](size_t chunk)
+		{
+			size_t offset = chunk * IDAT_CHUNK_SIZE;
+			size_t chunk_size = std::min(compressed.size() - offset, (size_t)IDAT_CHUNK_SIZE);
+			WriteChunk(chunks + offset + chunk * 12, "IDAT", compressed.data() + offset, chunk_size);
+		});
+
+		WriteChunk(chunks + compressed.size() + chunk_count * 12, "IEND", nullptr, 0);
+
+		*size = (int)png_size;
+		return data;
+	}
+}
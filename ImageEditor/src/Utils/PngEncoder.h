@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+namespace PngEncoder
+{
+	// Encodes R8G8B8A8 pixels as a PNG, the rows are filtered, deflated and checksummed on several threads
+	// so a single large image takes a fraction of the time of stb_image_write, see ParallelDeflate
+	// @param stride Bytes between the starts of two rows
+	// @param level 0 to 9 like zlib
+	// @param filter -1 picks the filter of every row with the smallest sum of absolute differences, 0 to 4 always use none, sub, up, average or paeth
+	// @param jobs 0 picks one per core
+	// @return Allocated with malloc like the stb_image_write buffers, nullptr on failure
+	unsigned char* Encode(const unsigned char* pixels, size_t stride, int width, int height, int level, int filter, unsigned int jobs, int* size);
+}
@@ -0,0 +1,389 @@
+#include "ProjectFile.h"
+
+#include <Difu/Utils/Logger.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <type_traits>
+
+#ifdef _WIN32
+// Keeps the GDI and USER declarations that clash with raylib out
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#define NOUSER
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Utils/PieceEntity.h"
+
+#define PROJECT_MAGIC "IMGEPROJ"
+// Increase when the layout changes, older versions must stay readable
+#define PROJECT_VERSION 1
+
+struct ProjectHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t image_count;
+	uint32_t padding;
+	uint64_t piece_count;
+	uint64_t rectangle_count;
+	uint64_t images_offset;
+	uint64_t pieces_offset;
+	uint64_t rectangles_offset;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+};
+
+struct ProjectImageRecord
+{
+	uint64_t path_offset; // In the string table
+	uint32_t path_size;
+	int32_t width, height;
+	uint32_t padding;
+	uint64_t hash;
+};
+
+struct ProjectPieceRecord
+{
+	Vector2 position;
+	Rectangle bounds;
+	uint64_t first_rectangle;
+	uint64_t rectangle_count;
+};
+
+// Rectangles are stored as the SourceDestinationPair themselves
+static_assert(std::is_trivially_copyable_v<SourceDestinationPair> && sizeof(SourceDestinationPair) == 36, "the project rectangle table depends on the layout of SourceDestinationPair");
+static_assert(sizeof(ProjectHeader) % 8 == 0 && sizeof(ProjectImageRecord) % 8 == 0 && sizeof(ProjectPieceRecord) % 8 == 0);
+
+static uint64_t AlignOffset(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+// True when count elements of element_size bytes starting at offset are inside the file
+static bool IsTableInside(uint64_t offset, uint64_t count, uint64_t element_size, uint64_t file_size)
+{
+	if (offset > file_size || offset % 8 != 0)
+		return false;
+
+	return count <= (file_size - offset) / element_size;
+}
+
+ProjectFile::ProjectFile()
+{
+}
+
+ProjectFile::~ProjectFile()
+{
+	Close();
+}
+
+bool ProjectFile::Open(const std::string& filepath)
+{
+	Close();
+
+#ifdef _WIN32
+	file_handle = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER file_size;
+	if (file_handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_handle, &file_size))
+	{
+		if (file_handle != INVALID_HANDLE_VALUE)
+			CloseHandle(file_handle);
+		file_handle = nullptr;
+		Logger::Error("Could not open project file: {}", filepath);
+		return false;
+	}
+	size = (size_t)file_size.QuadPart;
+	mapping_handle = size > 0 ? CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	data = mapping_handle ? (const uint8_t*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+	file_descriptor = open(filepath.c_str(), O_RDONLY);
+	struct stat file_stat;
+	if (file_descriptor < 0 || fstat(file_descriptor, &file_stat) != 0)
+	{
+		if (file_descriptor >= 0)
+			close(file_descriptor);
+		file_descriptor = -1;
+		Logger::Error("Could not open project file: {}", filepath);
+		return false;
+	}
+	size = (size_t)file_stat.st_size;
+	void* mapping = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0) : MAP_FAILED;
+	data = mapping != MAP_FAILED ? (const uint8_t*)mapping : nullptr;
+#endif
+
+	if (!data || size < sizeof(ProjectHeader))
+	{
+		Logger::Error("Not a project file: {}", filepath);
+		Close();
+		return false;
+	}
+
+	const ProjectHeader* header = (const ProjectHeader*)data;
+	if (memcmp(header->magic, PROJECT_MAGIC, sizeof(header->magic)) != 0 || header->header_size < sizeof(ProjectHeader))
+	{
+		Logger::Error("Not a project file: {}", filepath);
+		Close();
+		return false;
+	}
+
+	if (header->version > PROJECT_VERSION)
+	{
+		Logger::Error("'{}' was saved by a newer version (project version {}, supported up to {})", filepath, header->version, PROJECT_VERSION);
+		Close();
+		return false;
+	}
+
+	if (!IsTableInside(header->images_offset, header->image_count, sizeof(ProjectImageRecord), size) ||
+		!IsTableInside(header->pieces_offset, header->piece_count, sizeof(ProjectPieceRecord), size) ||
+		!IsTableInside(header->rectangles_offset, header->rectangle_count, sizeof(SourceDestinationPair), size) ||
+		!IsTableInside(header->strings_offset, header->strings_size, 1, size))
+	{
+		Logger::Error("Project file is truncated or corrupted: {}", filepath);
+		Close();
+		return false;
+	}
+
+	const ProjectImageRecord* image_records = (const ProjectImageRecord*)(data + header->images_offset);
+	for (uint32_t i = 0; i < header->image_count; i++)
+	{
+		const ProjectImageRecord& record = image_records[i];
+		if (record.path_offset > header->strings_size || record.path_size > header->strings_size - record.path_offset)
+		{
+			Logger::Error("Project file is truncated or corrupted: {}", filepath);
+			Close();
+			return false;
+		}
+
+		ProjectImage& image = images.emplace_back();
+		image.filepath.assign((const char*)data + header->strings_offset + record.path_offset, record.path_size);
+		image.width = record.width;
+		image.height = record.height;
+		image.hash = record.hash;
+	}
+
+	// The pieces are checked once here so that CreatePieces can trust them
+	const ProjectPieceRecord* piece_records = (const ProjectPieceRecord*)(data + header->pieces_offset);
+	for (uint64_t i = 0; i < header->piece_count; i++)
+	{
+		const ProjectPieceRecord& record = piece_records[i];
+		if (record.first_rectangle > header->rectangle_count || record.rectangle_count > header->rectangle_count - record.first_rectangle)
+		{
+			Logger::Error("Project file is truncated or corrupted: {}", filepath);
+			Close();
+			return false;
+		}
+	}
+
+	piece_count = header->piece_count;
+	rectangle_count = header->rectangle_count;
+	pieces_offset = header->pieces_offset;
+	rectangles_offset = header->rectangles_offset;
+	return true;
+}
+
+void ProjectFile::Close()
+{
+#ifdef _WIN32
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping_handle)
+		CloseHandle(mapping_handle);
+	if (file_handle)
+		CloseHandle(file_handle);
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+#else
+	if (data)
+		munmap((void*)data, size);
+	if (file_descriptor >= 0)
+		close(file_descriptor);
+	file_descriptor = -1;
+#endif
+
+	data = nullptr;
+	size = 0;
+	images.clear();
+	piece_count = 0;
+	rectangle_count = 0;
+}
+
+bool ProjectFile::IsOpen() const
+{
+	return data != nullptr;
+}
+
+const std::vector<ProjectImage>& ProjectFile::GetImages() const
+{
+	return images;
+}
+
+size_t ProjectFile::GetPieceCount() const
+{
+	return piece_count;
+}
+
+size_t ProjectFile::GetRectangleCount() const
+{
+	return rectangle_count;
+}
+
+void ProjectFile::CreatePieces(entt::registry& pieces, const std::vector<uint32_t>& image_ids) const
+{
+	if (!data)
+		return;
+
+	// Only touch the rectangles one by one when the images did not keep their index
+	bool remap_images = false;
+	for (size_t i = 0; i < image_ids.size(); i++)
+		remap_images |= image_ids[i] != i;
+
+	const ProjectPieceRecord* piece_records = (const ProjectPieceRecord*)(data + pieces_offset);
+	const SourceDestinationPair* rectangles = (const SourceDestinationPair*)(data + rectangles_offset);
+	for (size_t i = 0; i < piece_count; i++)
+	{
+		const ProjectPieceRecord& record = piece_records[i];
+
+		ImagePiece piece;
+		piece.first_piece_pos = record.position;
+		piece.bounds = record.bounds;
+		piece.sources_dests.resize(record.rectangle_count);
+		memcpy(piece.sources_dests.data(), rectangles + record.first_rectangle, record.rectangle_count * sizeof(SourceDestinationPair));
+
+		if (remap_images)
+		{
+			for (SourceDestinationPair& source_dest : piece.sources_dests)
+				source_dest.image = source_dest.image < image_ids.size() ? image_ids[source_dest.image] : std::numeric_limits<uint32_t>::max();
+		}
+
+		PieceEntity::Create(pieces, std::move(piece));
+	}
+}
+
+bool ProjectFile::Save(const std::string& filepath, const entt::registry& pieces, const std::vector<ProjectImage>& images)
+{
+	std::vector<PieceHandle> draw_order = PieceEntity::GetDrawOrder(pieces);
+
+	ProjectHeader header = {};
+	memcpy(header.magic, PROJECT_MAGIC, sizeof(header.magic));
+	header.version = PROJECT_VERSION;
+	header.header_size = sizeof(ProjectHeader);
+	header.image_count = images.size();
+	header.piece_count = draw_order.size();
+
+	std::vector<ProjectImageRecord> image_records;
+	std::string strings;
+	for (const ProjectImage& image : images)
+	{
+		ProjectImageRecord& record = image_records.emplace_back();
+		record.path_offset = strings.size();
+		record.path_size = image.filepath.size();
+		record.width = image.width;
+		record.height = image.height;
+		record.padding = 0;
+		record.hash = image.hash;
+		strings += image.filepath;
+	}
+
+	std::vector<ProjectPieceRecord> piece_records;
+	piece_records.reserve(draw_order.size());
+	for (PieceHandle piece : draw_order)
+	{
+		auto [position, bounds, rectangles] = pieces.get<PiecePosition, PieceBounds, PieceRectangles>(piece);
+		piece_records.push_back({position.value, bounds.local, header.rectangle_count, rectangles.sources_dests.size()});
+		header.rectangle_count += rectangles.sources_dests.size();
+	}
+
+	header.images_offset = sizeof(ProjectHeader);
+	header.pieces_offset = AlignOffset(header.images_offset + image_records.size() * sizeof(ProjectImageRecord));
+	header.rectangles_offset = AlignOffset(header.pieces_offset + piece_records.size() * sizeof(ProjectPieceRecord));
+	header.strings_offset = AlignOffset(header.rectangles_offset + header.rectangle_count * sizeof(SourceDestinationPair));
+	header.strings_size = strings.size();
+
+	// Written next to the destination first so that a failed save does not destroy the previous project
+	std::string temporary_path = filepath + ".tmp";
+	FILE* file = fopen(temporary_path.c_str(), "wb");
+	if (!file)
+	{
+		Logger::Error("Could not write project file: {}", filepath);
+		return false;
+	}
+
+	uint64_t written = 0;
+	bool ok = true;
+	auto write = [&](const void* bytes, size_t byte_count)
+	{
+		ok = ok && (byte_count == 0 || fwrite(bytes, 1, byte_count, file) == byte_count);
+		written += byte_count;
+	};
+	auto pad_to = [&](uint64_t offset)
+	{
+		const uint8_t zeros[8] = {};
+		write(zeros, offset - written);
+	};
+
+	write(&header, sizeof(header));
+	write(image_records.data(), image_records.size() * sizeof(ProjectImageRecord));
+	pad_to(header.pieces_offset);
+	write(piece_records.data(), piece_records.size() * sizeof(ProjectPieceRecord));
+	pad_to(header.rectangles_offset);
+	for (PieceHandle piece : draw_order)
+	{
+		const auto& sources_dests = pieces.get<PieceRectangles>(piece).sources_dests;
+		write(sources_dests.data(), sources_dests.size() * sizeof(SourceDestinationPair));
+	}
+	pad_to(header.strings_offset);
+	write(strings.data(), strings.size());
+
+	ok = fclose(file) == 0 && ok;
+	// Replaces the previous project in a single step, there is no moment where neither file exists
+#ifdef _WIN32
+	ok = ok && MoveFileExW(std::filesystem::path(temporary_path).c_str(), std::filesystem::path(filepath).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	ok = ok && std::rename(temporary_path.c_str(), filepath.c_str()) == 0;
+#endif
+
+	if (!ok)
+	{
+		std::remove(temporary_path.c_str());
+		Logger::Error("Could not write project file: {}", filepath);
+	}
+
+	return ok;
+}
+
+uint64_t ProjectFile::HashImage(const Image& image)
+{
+	if (!image.data)
+		return 0;
+
+	// FNV-1a over 8 byte words, the sizes are mixed in so that reshaped pixels do not collide
+	const uint64_t prime = 0x100000001b3ULL;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = (hash ^ (uint64_t)image.width) * prime;
+	hash = (hash ^ (uint64_t)image.height) * prime;
+
+	size_t byte_count = (size_t)GetPixelDataSize(image.width, image.height, image.format);
+	const uint8_t* bytes = (const uint8_t*)image.data;
+	size_t i = 0;
+	for (; i + 8 <= byte_count; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < byte_count; i++)
+		hash = (hash ^ bytes[i]) * prime;
+
+	return hash;
+}
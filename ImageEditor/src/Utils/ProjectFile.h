@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <entt.hpp>
+#include <raylib.h>
+
+#include "Utils/ImagePiece.h"
+
+struct ProjectImage
+{
+	std::string filepath;
+	int width, height;
+	uint64_t hash; // Of the level 0 pixels, see ProjectFile::HashImage
+};
+
+// Saved layout of the pieces of a document and the images they are cut from
+// The file is a header followed by flat tables (images, pieces, rectangles, strings), all 8 byte aligned,
+// so it is memory mapped and the rectangles of a piece are copied with a single memcpy
+// Values are stored in the byte order of the machine, which is little endian on every supported platform
+class ProjectFile
+{
+public:
+	ProjectFile();
+	~ProjectFile();
+	ProjectFile(const ProjectFile&) = delete;
+	ProjectFile& operator=(const ProjectFile&) = delete;
+
+	// Maps the file and checks that every table is inside of it
+	// @return false if it is not a project file or was written by a newer version
+	bool Open(const std::string& filepath);
+	void Close();
+	bool IsOpen() const;
+
+	const std::vector<ProjectImage>& GetImages() const;
+	size_t GetPieceCount() const;
+	size_t GetRectangleCount() const;
+
+	// Creates the pieces in the registry, bottom to top as they were saved
+	// @param image_ids Maps the images of the project to the document image table, UINT32_MAX for the ones that could not be loaded
+	void CreatePieces(entt::registry& pieces, const std::vector<uint32_t>& image_ids) const;
+
+	// Writes the pieces from the bottom to the top, images are indexed by SourceDestinationPair::image
+	static bool Save(const std::string& filepath, const entt::registry& pieces, const std::vector<ProjectImage>& images);
+	// Cheap 64 bit hash of the level 0 pixels, used to warn when a source image changed since the project was saved
+	static uint64_t HashImage(const Image& image);
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+
+	std::vector<ProjectImage> images;
+	size_t piece_count = 0;
+	size_t rectangle_count = 0;
+	uint64_t pieces_offset = 0;
+	uint64_t rectangles_offset = 0;
+};
@@ -0,0 +1,134 @@
+#include "QoiEncoder.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+// Image size limit of the reference decoder, larger files are refused when read back
+#define QOI_MAX_PIXELS 400000000ULL
+
+static const unsigned char QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+namespace QoiEncoder
+{
+	static unsigned char* WriteBigEndian(unsigned char* out, uint32_t value)
+	{
+		out[0] = (unsigned char)(value >> 24);
+		out[1] = (unsigned char)(value >> 16);
+		out[2] = (unsigned char)(value >> 8);
+		out[3] = (unsigned char)value;
+		return out + 4;
+	}
+
+	unsigned char* Encode(const unsigned char* pixels, size_t stride, int width, int height, int* size)
+	{
+		*size = 0;
+		if (!pixels || width <= 0 || height <= 0 || (unsigned long long)width * height > QOI_MAX_PIXELS)
+			return nullptr;
+
+		// Worst case is every pixel written as QOI_OP_RGBA
+		size_t max_size = QOI_HEADER_SIZE + (size_t)width * height * 5 + sizeof(QOI_END_MARKER);
+		unsigned char* data = (unsigned char*)malloc(max_size);
+		if (!data)
+			return nullptr;
+
+		unsigned char* out = data;
+		memcpy(out, "qoif", 4);
+		out = WriteBigEndian(out + 4, (uint32_t)width);
+		out = WriteBigEndian(out, (uint32_t)height);
+		*out++ = 4; // RGBA
+		*out++ = 0; // sRGB with linear alpha
+
+		// Pixels are compared as whole words, the byte order does not matter for equality
+		uint32_t seen[64];
+		memset(seen, 0, sizeof(seen));
+		unsigned char previous[4] = {0, 0, 0, 255};
+		uint32_t previous_word;
+		memcpy(&previous_word, previous, 4);
+		int run = 0;
+
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char* pixel = pixels + (size_t)y * stride;
+			for (int x = 0; x < width; x++, pixel += 4)
+			{
+				uint32_t word;
+				memcpy(&word, pixel, 4);
+				if (word == previous_word)
+				{
+					if (++run == QOI_MAX_RUN)
+					{
+						*out++ = QOI_OP_RUN | (run - 1);
+						run = 0;
+					}
+					continue;
+				}
+
+				if (run > 0)
+				{
+					*out++ = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+
+				int index = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+				if (seen[index] == word)
+					*out++ = QOI_OP_INDEX | index;
+				else
+				{
+					seen[index] = word;
+					if (pixel[3] == previous[3])
+					{
+						// Differences wrap around like the decoder adds them
+						signed char red = (signed char)(pixel[0] - previous[0]);
+						signed char green = (signed char)(pixel[1] - previous[1]);
+						signed char blue = (signed char)(pixel[2] - previous[2]);
+						signed char red_green = (signed char)(red - green);
+						signed char blue_green = (signed char)(blue - green);
+
+						if (red >= -2 && red <= 1 && green >= -2 && green <= 1 && blue >= -2 && blue <= 1)
+							*out++ = QOI_OP_DIFF | (red + 2) << 4 | (green + 2) << 2 | (blue + 2);
+						else if (green >= -32 && green <= 31 && red_green >= -8 && red_green <= 7 && blue_green >= -8 && blue_green <= 7)
+						{
+							*out++ = QOI_OP_LUMA | (green + 32);
+							*out++ = (red_green + 8) << 4 | (blue_green + 8);
+						}
+						else
+						{
+							*out++ = QOI_OP_RGB;
+							*out++ = pixel[0];
+							*out++ = pixel[1];
+							*out++ = pixel[2];
+						}
+					}
+					else
+					{
+						*out++ = QOI_OP_RGBA;
+						memcpy(out, pixel, 4);
+						out += 4;
+					}
+				}
+
+				memcpy(previous, pixel, 4);
+				previous_word = word;
+			}
+		}
+
+		if (run > 0)
+			*out++ = QOI_OP_RUN | (run - 1);
+
+		memcpy(out, QOI_END_MARKER, sizeof(QOI_END_MARKER));
+		out += sizeof(QOI_END_MARKER);
+
+		*size = (int)(out - data);
+		return data;
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+
+namespace QoiEncoder
+{
+	// Encodes R8G8B8A8 pixels as a QOI image (https://qoiformat.org), a single pass with no search so it runs close to memcpy speed
+	// Files are larger than PNG, they are meant for intermediate images read back by raylib or other tools
+	// @param stride Bytes between the starts of two rows, so a box inside a larger image is encoded without copying it
+	// @return Allocated with malloc like the stb_image_write buffers, nullptr on failure
+	unsigned char* Encode(const unsigned char* pixels, size_t stride, int width, int height, int* size);
+}
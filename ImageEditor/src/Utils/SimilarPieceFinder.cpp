@@ -0,0 +1,90 @@
+#include "SimilarPieceFinder.h"
+
+#include <algorithm>
+
+SimilarPieceFinder::SimilarPieceFinder()
+{
+}
+
+SimilarPieceFinder::~SimilarPieceFinder()
+{
+	Cancel();
+}
+
+void SimilarPieceFinder::Start(const std::vector<Image>& _sources, std::vector<ImagePiece> _pieces, std::vector<PieceHandle> _handles)
+{
+	Cancel();
+
+	sources = _sources;
+	pieces = std::move(_pieces);
+	handles = std::move(_handles);
+	groups.clear();
+	cancelled = false;
+	done = false;
+	hashed_count = 0;
+	thread = std::thread(&SimilarPieceFinder::Run, this);
+}
+
+void SimilarPieceFinder::Cancel()
+{
+	cancelled = true;
+	if (thread.joinable())
+		thread.join();
+
+	done = false;
+	pieces.clear();
+	handles.clear();
+	groups.clear();
+}
+
+bool SimilarPieceFinder::IsBusy() const
+{
+	return thread.joinable() && !done;
+}
+
+size_t SimilarPieceFinder::GetHashedCount() const
+{
+	return hashed_count;
+}
+
+size_t SimilarPieceFinder::GetPieceCount() const
+{
+	return pieces.size();
+}
+
+bool SimilarPieceFinder::TakeGroups(std::vector<std::vector<PieceHandle>>& _groups)
+{
+	if (!thread.joinable() || !done)
+		return false;
+
+	thread.join();
+	_groups = std::move(groups);
+	Cancel();
+	return true;
+}
+
+void SimilarPieceFinder::Run()
+{
+	// A single thread is enough in the background, the editor keeps the other cores
+	std::vector<PerceptualHashValue> hashes(pieces.size());
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		if (cancelled)
+			return;
+
+		Image composed = Piece::Compose(sources, pieces[i]);
+		hashes[i] = PerceptualHash::Compute(composed);
+		UnloadImage(composed);
+		hashed_count++;
+	}
+
+	for (const std::vector<uint32_t>& group : PerceptualHash::GroupSimilar(hashes))
+	{
+		std::vector<PieceHandle> group_handles;
+		for (uint32_t piece : group)
+			group_handles.push_back(handles[piece]);
+		groups.emplace_back(std::move(group_handles));
+	}
+
+	done = true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+#include <raylib.h>
+
+#include "Utils/ImagePiece.h"
+#include "Utils/PieceEntity.h"
+#include "Utils/PerceptualHash.h"
+
+// Composes and hashes every piece on a background thread, then groups the ones that look alike, see PerceptualHash::GroupSimilar
+// The thread reads the pixels of the document images, so it must be cancelled before they are unloaded
+class SimilarPieceFinder
+{
+public:
+	SimilarPieceFinder();
+	~SimilarPieceFinder();
+	SimilarPieceFinder(const SimilarPieceFinder&) = delete;
+	SimilarPieceFinder& operator=(const SimilarPieceFinder&) = delete;
+
+	// Cancels any search in progress
+	// @param handles Of every piece, the groups are made of them
+	void Start(const std::vector<Image>& sources, std::vector<ImagePiece> pieces, std::vector<PieceHandle> handles);
+	// Waits for the thread, which stops after the piece it is hashing
+	void Cancel();
+
+	bool IsBusy() const;
+	// Pieces hashed so far and in total
+	size_t GetHashedCount() const;
+	size_t GetPieceCount() const;
+
+	// Hands over the groups once the search is done, their first piece is the representative
+	// @return false while busy or when there is nothing to take
+	bool TakeGroups(std::vector<std::vector<PieceHandle>>& groups);
+
+private:
+	void Run();
+
+private:
+	std::thread thread;
+	std::atomic<bool> cancelled = false;
+	std::atomic<bool> done = false;
+	std::atomic<size_t> hashed_count = 0;
+
+	std::vector<Image> sources;
+	std::vector<ImagePiece> pieces;
+	std::vector<PieceHandle> handles;
+	std::vector<std::vector<PieceHandle>> groups; // Written by the thread before done is set
+};
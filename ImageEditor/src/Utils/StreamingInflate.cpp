@@ -0,0 +1,380 @@
+#include "StreamingInflate.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define WINDOW_SIZE 32768
+#define READ_BUFFER_SIZE (64 * 1024)
+// Decompressed bytes are handed over when a match might not fit anymore, the last window stays for the next matches
+#define OUTPUT_BUFFER_SIZE (4 * WINDOW_SIZE)
+#define MAX_MATCH 258
+#define MAX_CODE_BITS 15
+#define ADLER_MODULO 65521
+// Most bytes summed before the adler sums could overflow 32 bits
+#define ADLER_MAX_RUN 5552
+
+namespace StreamingInflate
+{
+	static const uint16_t LENGTH_BASES[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+	static const uint8_t LENGTH_EXTRA_BITS[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+	static const uint16_t DISTANCE_BASES[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+	static const uint8_t DISTANCE_EXTRA_BITS[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+	static const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	// Keeps at least 57 bits ready, past the end of the input it reads zeros and counts them
+	struct BitReader
+	{
+		const ReadFunction& read;
+		std::vector<unsigned char> buffer;
+		size_t position = 0;
+		size_t end = 0;
+		uint64_t bits = 0;
+		int bit_count = 0;
+		int overrun_bytes = 0;
+
+		BitReader(const ReadFunction& _read) : read(_read), buffer(READ_BUFFER_SIZE)
+		{
+		}
+
+		void Refill()
+		{
+			while (bit_count <= 56)
+			{
+				if (position == end && overrun_bytes == 0)
+				{
+					end = read(buffer.data(), buffer.size());
+					position = 0;
+				}
+
+				if (position == end)
+					overrun_bytes++;
+				else
+					bits |= (uint64_t)buffer[position++] << bit_count;
+				bit_count += 8;
+			}
+		}
+
+		uint32_t Get(int length)
+		{
+			if (bit_count < length)
+				Refill();
+			uint32_t value = (uint32_t)(bits & ((1ULL << length) - 1));
+			bits >>= length;
+			bit_count -= length;
+			return value;
+		}
+
+		void AlignToByte()
+		{
+			Get(bit_count % 8);
+		}
+
+		// True once some of the zeros read past the end were used, the stream was truncated
+		bool IsOverrun() const
+		{
+			return overrun_bytes * 8 > bit_count;
+		}
+	};
+
+	// Indexed by the next max_bits bits, the low 4 bits of an entry are the code length and the others the symbol
+	// Bits that start no code have a 0 entry
+	struct HuffmanTable
+	{
+		std::vector<uint16_t> entries;
+		int max_bits = 0;
+	};
+
+	static bool BuildTable(const uint8_t* lengths, int count, HuffmanTable& table)
+	{
+		int length_counts[MAX_CODE_BITS + 1] = {};
+		for (int symbol = 0; symbol < count; symbol++)
+			length_counts[lengths[symbol]]++;
+		length_counts[0] = 0;
+
+		// Over subscribed codes are invalid, incomplete ones are allowed as a single distance code is
+		int left = 1;
+		table.max_bits = 1;
+		for (int bits = 1; bits <= MAX_CODE_BITS; bits++)
+		{
+			left = (left << 1) - length_counts[bits];
+			if (left < 0)
+				return false;
+			if (length_counts[bits] > 0)
+				table.max_bits = bits;
+		}
+
+		int next_codes[MAX_CODE_BITS + 1] = {};
+		int code = 0;
+		for (int bits = 1; bits <= MAX_CODE_BITS; bits++)
+		{
+			code = (code + length_counts[bits - 1]) << 1;
+			next_codes[bits] = code;
+		}
+
+		table.entries.assign((size_t)1 << table.max_bits, 0);
+		for (int symbol = 0; symbol < count; symbol++)
+		{
+			int length = lengths[symbol];
+			if (length == 0)
+				continue;
+
+			int value = next_codes[length]++;
+			int reversed = 0;
+			for (int bit = 0; bit < length; bit++)
+				reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+
+			// The bits after the code can be anything
+			for (size_t index = reversed; index < table.entries.size(); index += (size_t)1 << length)
+				table.entries[index] = (uint16_t)(symbol << 4 | length);
+		}
+
+		return true;
+	}
+
+	// @return The symbol, -1 for bits that are no code
+	static int DecodeSymbol(BitReader& reader, const HuffmanTable& table)
+	{
+		if (reader.bit_count < MAX_CODE_BITS)
+			reader.Refill();
+
+		uint16_t entry = table.entries[reader.bits & ((1ULL << table.max_bits) - 1)];
+		if (entry == 0)
+			return -1;
+
+		reader.Get(entry & 0xF);
+		return entry >> 4;
+	}
+
+	struct FixedTables
+	{
+		HuffmanTable literals;
+		HuffmanTable distances;
+	};
+
+	static const FixedTables& GetFixedTables()
+	{
+		static const FixedTables tables = []()
+		{
+			FixedTables result;
+			uint8_t lengths[288];
+			for (int symbol = 0; symbol < 288; symbol++)
+				lengths[symbol] = symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8;
+			BuildTable(lengths, 288, result.literals);
+
+			memset(lengths, 5, 30);
+			BuildTable(lengths, 30, result.distances);
+			return result;
+		}();
+
+		return tables;
+	}
+
+	static bool ReadDynamicTables(BitReader& reader, HuffmanTable& literals, HuffmanTable& distances)
+	{
+		int literal_count = reader.Get(5) + 257;
+		int distance_count = reader.Get(5) + 1;
+		int code_length_count = reader.Get(4) + 4;
+		if (literal_count > 286 || distance_count > 30)
+			return false;
+
+		uint8_t code_length_lengths[19] = {};
+		for (int i = 0; i < code_length_count; i++)
+			code_length_lengths[CODE_LENGTH_ORDER[i]] = (uint8_t)reader.Get(3);
+
+		HuffmanTable code_lengths;
+		if (!BuildTable(code_length_lengths, 19, code_lengths))
+			return false;
+
+		uint8_t lengths[286 + 30] = {};
+		int total = literal_count + distance_count;
+		for (int i = 0; i < total;)
+		{
+			int symbol = DecodeSymbol(reader, code_lengths);
+			if (symbol < 0)
+				return false;
+			if (symbol < 16)
+			{
+				lengths[i++] = (uint8_t)symbol;
+				continue;
+			}
+
+			uint8_t value = 0;
+			int repeat;
+			if (symbol == 16)
+			{
+				if (i == 0)
+					return false;
+				value = lengths[i - 1];
+				repeat = 3 + reader.Get(2);
+			}
+			else if (symbol == 17)
+				repeat = 3 + reader.Get(3);
+			else
+				repeat = 11 + reader.Get(7);
+
+			if (i + repeat > total)
+				return false;
+			memset(lengths + i, value, repeat);
+			i += repeat;
+		}
+
+		// A block can not end without the end of block symbol
+		if (lengths[256] == 0)
+			return false;
+
+		return BuildTable(lengths, literal_count, literals) && BuildTable(lengths + literal_count, distance_count, distances);
+	}
+
+	// Decompressed bytes waiting to be written, after the window the next matches may refer to
+	struct Output
+	{
+		const WriteFunction& write;
+		std::vector<unsigned char> buffer;
+		size_t position = 0; // End of the decompressed bytes
+		size_t written = 0; // End of the bytes already written
+		uint32_t adler_a = 1;
+		uint32_t adler_b = 0;
+
+		Output(const WriteFunction& _write) : write(_write), buffer(OUTPUT_BUFFER_SIZE)
+		{
+		}
+
+		bool Flush()
+		{
+			const unsigned char* data = buffer.data() + written;
+			size_t size = position - written;
+			if (size > 0 && !write(data, size))
+				return false;
+
+			while (size > 0)
+			{
+				size_t run = std::min(size, (size_t)ADLER_MAX_RUN);
+				for (size_t i = 0; i < run; i++)
+				{
+					adler_a += data[i];
+					adler_b += adler_a;
+				}
+				adler_a %= ADLER_MODULO;
+				adler_b %= ADLER_MODULO;
+				data += run;
+				size -= run;
+			}
+
+			if (position > WINDOW_SIZE)
+			{
+				memmove(buffer.data(), buffer.data() + position - WINDOW_SIZE, WINDOW_SIZE);
+				position = WINDOW_SIZE;
+			}
+			written = position;
+			return true;
+		}
+	};
+
+	static bool InflateBlock(BitReader& reader, Output& output, const HuffmanTable& literals, const HuffmanTable& distances)
+	{
+		unsigned char* buffer = output.buffer.data();
+		while (true)
+		{
+			if (output.position + MAX_MATCH > OUTPUT_BUFFER_SIZE && !output.Flush())
+				return false;
+			if (reader.IsOverrun())
+				return false;
+
+			int symbol = DecodeSymbol(reader, literals);
+			if (symbol < 0)
+				return false;
+			if (symbol < 256)
+			{
+				buffer[output.position++] = (unsigned char)symbol;
+				continue;
+			}
+			if (symbol == 256)
+				return true;
+
+			symbol -= 257;
+			if (symbol >= 29)
+				return false;
+			size_t length = LENGTH_BASES[symbol] + reader.Get(LENGTH_EXTRA_BITS[symbol]);
+
+			int distance_symbol = DecodeSymbol(reader, distances);
+			if (distance_symbol < 0 || distance_symbol >= 30)
+				return false;
+			size_t distance = DISTANCE_BASES[distance_symbol] + reader.Get(DISTANCE_EXTRA_BITS[distance_symbol]);
+			// The window kept by Flush always holds the 32 KB a distance can go back, so this only fails at the start of the stream
+			if (distance > output.position)
+				return false;
+
+			unsigned char* out = buffer + output.position;
+			const unsigned char* match = out - distance;
+			if (distance >= length)
+				memcpy(out, match, length);
+			else
+			{
+				// Overlapping, the bytes copied first are repeated
+				for (size_t i = 0; i < length; i++)
+					out[i] = match[i];
+			}
+			output.position += length;
+		}
+	}
+
+	static bool InflateStored(BitReader& reader, Output& output)
+	{
+		reader.AlignToByte();
+		uint32_t length = reader.Get(16);
+		uint32_t inverted_length = reader.Get(16);
+		if (length != (~inverted_length & 0xFFFF))
+			return false;
+
+		for (uint32_t i = 0; i < length; i++)
+		{
+			if (output.position == OUTPUT_BUFFER_SIZE && !output.Flush())
+				return false;
+			output.buffer[output.position++] = (unsigned char)reader.Get(8);
+		}
+
+		return !reader.IsOverrun();
+	}
+
+	bool Decompress(const ReadFunction& read, const WriteFunction& write)
+	{
+		BitReader reader(read);
+
+		// Deflate with a window of at most 32 KB and no preset dictionary
+		uint32_t method = reader.Get(8);
+		uint32_t flags = reader.Get(8);
+		if ((method & 0xF) != 8 || (method >> 4) > 7 || (method * 256 + flags) % 31 != 0 || (flags & 0x20) != 0 || reader.IsOverrun())
+			return false;
+
+		Output output(write);
+		HuffmanTable literals, distances;
+		bool is_final = false;
+		while (!is_final)
+		{
+			is_final = reader.Get(1) == 1;
+			uint32_t type = reader.Get(2);
+			bool is_inflated = false;
+			if (type == 0)
+				is_inflated = InflateStored(reader, output);
+			else if (type == 1)
+				is_inflated = InflateBlock(reader, output, GetFixedTables().literals, GetFixedTables().distances);
+			else if (type == 2)
+				is_inflated = ReadDynamicTables(reader, literals, distances) && InflateBlock(reader, output, literals, distances);
+
+			if (!is_inflated)
+				return false;
+		}
+
+		if (!output.Flush())
+			return false;
+
+		reader.AlignToByte();
+		uint32_t adler = 0;
+		for (int i = 0; i < 4; i++)
+			adler = (adler << 8) | reader.Get(8);
+
+		return !reader.IsOverrun() && adler == ((output.adler_b << 16) | output.adler_a);
+	}
+}
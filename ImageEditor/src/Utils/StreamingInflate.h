@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace StreamingInflate
+{
+	// Fills the buffer with the next compressed bytes, returns how many were put, 0 once the input is over
+	using ReadFunction = std::function<size_t(unsigned char* buffer, size_t capacity)>;
+	// Receives the decompressed bytes in order, returns false to stop
+	using WriteFunction = std::function<bool(const unsigned char* data, size_t size)>;
+
+	// Decompresses a zlib stream (RFC 1950) pulled from read, only the 32 KB window and a read buffer are kept in memory
+	// @return false if the stream is corrupted, truncated, fails its adler32, or write stopped it
+	bool Decompress(const ReadFunction& read, const WriteFunction& write);
+}
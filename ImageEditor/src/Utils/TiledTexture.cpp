@@ -0,0 +1,223 @@
+#include "TiledTexture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Utils/MipChain.h"
+
+#define TILE_SIZE 512
+// One texel copied from the neighbours on every side, so bilinear filtering does not show seams
+#define TILE_BORDER 1
+#define MAX_RESIDENT_BYTES ((size_t)256 * 1024 * 1024)
+#define MAX_TILE_UPLOADS_PER_FRAME 8
+
+#define GL_MAX_TEXTURE_SIZE 0x0D33
+
+// Part of the glad loader bundled in raylib, rlgl does not expose the texture size limit
+extern "C" void (*glad_glGetIntegerv)(unsigned int name, int* data);
+
+TiledTexture::TiledTexture()
+{
+}
+
+void TiledTexture::Load(const Image* _pixels)
+{
+	Unload();
+	pixels = _pixels;
+
+	// The first level that fits in one tile stays resident, every draw can fall back to it
+	pinned_level = 0;
+	while (pinned_level < pixels->mipmaps - 1 && std::max(pixels->width >> pinned_level, pixels->height >> pinned_level) > TILE_SIZE)
+		pinned_level++;
+	LoadTile(pinned_level, 0, 0, true);
+}
+
+void TiledTexture::Unload()
+{
+	for (auto& [key, tile] : tiles)
+		UnloadTexture(tile.texture);
+
+	tiles.clear();
+	requests.clear();
+	resident_bytes = 0;
+	pixels = nullptr;
+}
+
+bool TiledTexture::IsLoaded() const
+{
+	return pixels != nullptr;
+}
+
+void TiledTexture::Update()
+{
+	std::sort(requests.begin(), requests.end());
+	requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+
+	int uploads = 0;
+	for (uint64_t key : requests)
+	{
+		if (uploads >= MAX_TILE_UPLOADS_PER_FRAME)
+			break;
+
+		if (tiles.find(key) == tiles.end())
+		{
+			LoadTile((int)(key >> 48), (int)((key >> 24) & 0xFFFFFF), (int)(key & 0xFFFFFF), false);
+			uploads++;
+		}
+	}
+	requests.clear();
+
+	while (resident_bytes > MAX_RESIDENT_BYTES)
+	{
+		auto oldest = tiles.end();
+		for (auto it = tiles.begin(); it != tiles.end(); it++)
+		{
+			if (!it->second.pinned && it->second.last_used_frame < frame && (oldest == tiles.end() || it->second.last_used_frame < oldest->second.last_used_frame))
+				oldest = it;
+		}
+
+		// Everything left is needed by the current view
+		if (oldest == tiles.end())
+			break;
+
+		resident_bytes -= (size_t)oldest->second.texture.width * oldest->second.texture.height * 4;
+		UnloadTexture(oldest->second.texture);
+		tiles.erase(oldest);
+	}
+
+	frame++;
+}
+
+void TiledTexture::Draw(Rectangle source, Rectangle dest, float zoom, Color tint)
+{
+	if (pixels == nullptr || source.width <= 0.0f || source.height <= 0.0f)
+		return;
+
+	// Level where one texel covers about one screen pixel
+	float texels_per_pixel = source.width / (dest.width * zoom);
+	int level = texels_per_pixel > 1.0f ? (int)floorf(log2f(texels_per_pixel)) : 0;
+	DrawLevel(source, dest, std::min(level, pinned_level), true, tint);
+}
+
+int TiledTexture::GetResidentTiles() const
+{
+	return (int)tiles.size();
+}
+
+size_t TiledTexture::GetResidentBytes() const
+{
+	return resident_bytes;
+}
+
+bool TiledTexture::IsNeeded(int width, int height)
+{
+	int max_texture_size = 0;
+	glad_glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+	return width > max_texture_size || height > max_texture_size || (size_t)width * height * 4 > MAX_RESIDENT_BYTES;
+}
+
+void TiledTexture::DrawLevel(Rectangle source, Rectangle dest, int level, bool request_missing, Color tint)
+{
+	// Tile size in level 0 texels
+	float tile_extent = (float)(TILE_SIZE << level);
+	int first_tile_x = std::max((int)floorf(source.x / tile_extent), 0);
+	int first_tile_y = std::max((int)floorf(source.y / tile_extent), 0);
+	int last_tile_x = (int)ceilf((source.x + source.width) / tile_extent) - 1;
+	int last_tile_y = (int)ceilf((source.y + source.height) / tile_extent) - 1;
+	last_tile_x = std::min(last_tile_x, (std::max(pixels->width >> level, 1) - 1) / TILE_SIZE);
+	last_tile_y = std::min(last_tile_y, (std::max(pixels->height >> level, 1) - 1) / TILE_SIZE);
+
+	for (int tile_y = first_tile_y; tile_y <= last_tile_y; tile_y++)
+	{
+		for (int tile_x = first_tile_x; tile_x <= last_tile_x; tile_x++)
+		{
+			Rectangle tile_rect = {tile_x * tile_extent, tile_y * tile_extent, tile_extent, tile_extent};
+			if (!CheckCollisionRecs(tile_rect, source))
+				continue;
+
+			Rectangle tile_source = GetCollisionRec(tile_rect, source);
+			Rectangle tile_dest = {
+				dest.x + (tile_source.x - source.x) * dest.width / source.width,
+				dest.y + (tile_source.y - source.y) * dest.height / source.height,
+				tile_source.width * dest.width / source.width,
+				tile_source.height * dest.height / source.height
+			};
+
+			auto tile = tiles.find(TileKey(level, tile_x, tile_y));
+			if (tile == tiles.end())
+			{
+				if (request_missing)
+					requests.push_back(TileKey(level, tile_x, tile_y));
+
+				// Blurry for a few frames is better than a hole
+				if (level < pinned_level)
+					DrawLevel(tile_source, tile_dest, level + 1, false, tint);
+				continue;
+			}
+
+			tile->second.last_used_frame = frame;
+			float scale = 1.0f / (1 << level);
+			Rectangle texel_source = {
+				(tile_source.x - tile_rect.x) * scale + TILE_BORDER,
+				(tile_source.y - tile_rect.y) * scale + TILE_BORDER,
+				std::min(tile_source.width * scale, (float)tile->second.width),
+				std::min(tile_source.height * scale, (float)tile->second.height)
+			};
+			DrawTexturePro(tile->second.texture, texel_source, tile_dest, {0.0f, 0.0f}, 0.0f, tint);
+		}
+	}
+}
+
+void TiledTexture::LoadTile(int level, int tile_x, int tile_y, bool pinned)
+{
+	int level_width = std::max(pixels->width >> level, 1);
+	int level_height = std::max(pixels->height >> level, 1);
+	int x = tile_x * TILE_SIZE;
+	int y = tile_y * TILE_SIZE;
+	if (x >= level_width || y >= level_height)
+		return;
+
+	int width = std::min(TILE_SIZE, level_width - x);
+	int height = std::min(TILE_SIZE, level_height - y);
+
+	Image tile_image = GenImageColor(width + 2 * TILE_BORDER, height + 2 * TILE_BORDER, BLANK);
+	const unsigned char* level_data = (const unsigned char*)pixels->data + MipChain::GetLevelOffset(*pixels, level);
+	unsigned char* tile_data = (unsigned char*)tile_image.data;
+	for (int row = 0; row < tile_image.height; row++)
+	{
+		int src_y = std::clamp(y + row - TILE_BORDER, 0, level_height - 1);
+		const unsigned char* src_row = level_data + (size_t)src_y * level_width * 4;
+		unsigned char* dst_row = tile_data + (size_t)row * tile_image.width * 4;
+
+		int first_x = std::max(x - TILE_BORDER, 0);
+		int last_x = std::min(x + width + TILE_BORDER, level_width);
+		int dst_offset = first_x - (x - TILE_BORDER);
+		memcpy(dst_row + dst_offset * 4, src_row + (size_t)first_x * 4, (size_t)(last_x - first_x) * 4);
+
+		// Repeat the edge where the image ends
+		if (dst_offset > 0)
+			memcpy(dst_row, dst_row + dst_offset * 4, 4);
+		if (dst_offset + last_x - first_x < tile_image.width)
+			memcpy(dst_row + (tile_image.width - 1) * 4, dst_row + (tile_image.width - 2) * 4, 4);
+	}
+
+	ResidentTile tile;
+	tile.texture = LoadTextureFromImage(tile_image);
+	SetTextureFilter(tile.texture, TEXTURE_FILTER_BILINEAR);
+	SetTextureWrap(tile.texture, TEXTURE_WRAP_CLAMP);
+	tile.width = width;
+	tile.height = height;
+	tile.last_used_frame = frame;
+	tile.pinned = pinned;
+	UnloadImage(tile_image);
+
+	resident_bytes += (size_t)tile.texture.width * tile.texture.height * 4;
+	tiles[TileKey(level, tile_x, tile_y)] = tile;
+}
+
+uint64_t TiledTexture::TileKey(int level, int tile_x, int tile_y)
+{
+	return ((uint64_t)level << 48) | ((uint64_t)tile_x << 24) | (uint64_t)tile_y;
+}
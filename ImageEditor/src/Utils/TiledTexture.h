@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <raylib.h>
+
+struct ResidentTile
+{
+	Texture2D texture;
+	int width, height; // Without the border
+	uint64_t last_used_frame;
+	bool pinned; // Coarsest level, always kept as a fallback
+};
+
+// Draws an image that is too big for a single texture from fixed size tiles of its mip chain
+// Only the tiles seen by the camera are uploaded, the least recently used ones are evicted over the budget
+class TiledTexture
+{
+public:
+	TiledTexture();
+
+	// pixels must be R8G8B8A8 with its mip chain and outlive the tiled texture
+	void Load(const Image* pixels);
+	void Unload();
+	bool IsLoaded() const;
+
+	// Uploads some of the tiles requested by the draws of this frame and evicts the unused ones over the budget
+	void Update();
+
+	// Draws the source rectangle (level 0 texels) choosing the mip level from the size on screen
+	void Draw(Rectangle source, Rectangle dest, float zoom, Color tint);
+
+	int GetResidentTiles() const;
+	size_t GetResidentBytes() const;
+
+	// True when the image does not fit in a single texture or would take too much video memory
+	static bool IsNeeded(int width, int height);
+
+private:
+	void DrawLevel(Rectangle source, Rectangle dest, int level, bool request_missing, Color tint);
+	void LoadTile(int level, int tile_x, int tile_y, bool pinned);
+
+	static uint64_t TileKey(int level, int tile_x, int tile_y);
+
+private:
+	const Image* pixels = nullptr;
+	int pinned_level = 0;
+
+	std::unordered_map<uint64_t, ResidentTile> tiles;
+	std::vector<uint64_t> requests;
+	size_t resident_bytes = 0;
+	uint64_t frame = 0;
+};
@@ -4,4 +4,7 @@ namespace Variables
 {
 	bool ask_confirm_dialog_result = false;
 	AskCropFormatDialogResult ask_crop_dialog_result = {1, 1};
+	bool crop_skip_uniform_cells = false;
+	bool export_deduplicate = false;
+	unsigned int export_encoder = 0;
 }
@@ -9,4 +9,7 @@ namespace Variables
 {
 	extern bool ask_confirm_dialog_result;
 	extern AskCropFormatDialogResult ask_crop_dialog_result;
+	extern bool crop_skip_uniform_cells; // Kept between crops
+	extern bool export_deduplicate; // Kept between exports
+	extern unsigned int export_encoder; // Index of the encoder preset of the editor, kept between exports
 }
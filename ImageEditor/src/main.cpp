@@ -1,9 +1,19 @@
 #include <Difu/ScreenManagement/ScreenManager.h>
 #include "Screens/EditorScreen.h"
+#include "Utils/BatchSlicer.h"
+#include "Utils/CropBenchmark.h"
+#include "Utils/EncodeBenchmark.h"
 #include <Difu/WindowManagement/WindowManager.h>
 
-int main()
+int main(int argc, char** argv)
 {
+	if (BatchSlicer::IsRequested(argc, argv))
+		return BatchSlicer::Run(argc, argv);
+	if (CropBenchmark::IsRequested(argc, argv))
+		return CropBenchmark::Run(argc, argv);
+	if (EncodeBenchmark::IsRequested(argc, argv))
+		return EncodeBenchmark::Run(argc, argv);
+
 	if (WindowManager::InitWindow("ImageEditor", 800, 480, true))
 	{
 		ScreenManager::ChangeScreen(EditorScreen::GetScreen());
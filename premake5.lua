@@ -47,7 +47,7 @@ project "ImageEditor"
 		"~/Dev/c++/ResourceManager/bin/ResourceManager/Debug/ResourceManager  ImageEditor/Globals.txt -o ImageEditor/src/Globals.hpp -p rl",
 	}
 
-	links { "Difu", "raylib", "fmt", "nfd" } -- , "m", "dl", "rt", "X11"
+	links { "Difu", "raylib", "fmt", "nfd", "pthread" } -- , "m", "dl", "rt", "X11"
 	linkoptions { "`pkg-config gtk+-3.0 --libs`" }
 
     filter {}